@@ -0,0 +1,104 @@
+#ifndef CS561_BEHAVIOR_STATES_H
+#define CS561_BEHAVIOR_STATES_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include "HugePages.h"
+
+// Behavior state of an agent.  Every state runs the same flocking kernel, only with its own
+// rule weights, so agents are grouped by state and each group is updated as one batch.
+enum class BoidState : uint8_t {
+    FLOCKING, FLEEING, RESTING, FORAGING, COUNT
+};
+
+const int BOID_STATE_COUNT = static_cast<int>(BoidState::COUNT);
+
+// Rule weights applied while an agent is in a given state (scales of the flock-wide weights)
+struct StateRules {
+    float SeparationScale = 1;
+    float AlignmentScale = 1;
+    float CohesionScale = 1;
+    float SteeringScale = 1;
+    float FleeWeight = 0;         // push directly away from the obstacle sphere
+    float MaxVelocityScale = 1;
+};
+
+// Thresholds driving the transitions between states
+struct StateTransitions {
+    float FleeDistance = 3.0f;      // distance to the obstacle surface that triggers fleeing
+    float RestDistance = 1.5f;      // agents closer than this to their target rest
+    float ForageDistance = 12.0f;   // agents farther than this from their target forage
+    float MinStateDuration = 0.5f;  // seconds spent in a state before it may change (fleeing always wins)
+};
+
+inline std::array<StateRules, BOID_STATE_COUNT> defaultStateRules() {
+    std::array<StateRules, BOID_STATE_COUNT> rules;
+    StateRules& fleeing = rules[static_cast<int>(BoidState::FLEEING)];
+    fleeing.SeparationScale = 2.0f;
+    fleeing.AlignmentScale = 0.5f;
+    fleeing.CohesionScale = 0.25f;
+    fleeing.SteeringScale = 0.0f;
+    fleeing.FleeWeight = 8.0f;
+    fleeing.MaxVelocityScale = 1.5f;
+    StateRules& resting = rules[static_cast<int>(BoidState::RESTING)];
+    resting.AlignmentScale = 2.0f;
+    resting.CohesionScale = 0.5f;
+    resting.SteeringScale = 0.25f;
+    resting.MaxVelocityScale = 0.4f;
+    StateRules& foraging = rules[static_cast<int>(BoidState::FORAGING)];
+    foraging.AlignmentScale = 0.5f;
+    foraging.CohesionScale = 0.5f;
+    foraging.SteeringScale = 2.0f;
+    foraging.MaxVelocityScale = 1.2f;
+    return rules;
+}
+
+// Picks the next state of an agent from a handful of distances.  Written as a chain of selects
+// so the transition pass over the whole flock stays free of data dependent branches.  Compares in
+// the flock's scalar type, so the fixed point build decides transitions without any float.
+//   obstacleDistance: distance to the obstacle surface
+//   targetDistance:   distance to the nearest steering target, negative when there is none
+template <class Scalar>
+BoidState nextBoidState(BoidState current, Scalar stateTime, Scalar obstacleDistance,
+                        Scalar targetDistance, const StateTransitions& t) {
+    int next = static_cast<int>(BoidState::FLOCKING);
+    next = targetDistance > Scalar(t.ForageDistance) ? static_cast<int>(BoidState::FORAGING) : next;
+    next = (targetDistance >= Scalar(0) && targetDistance < Scalar(t.RestDistance)) ? static_cast<int>(BoidState::RESTING) : next;
+    next = stateTime < Scalar(t.MinStateDuration) ? static_cast<int>(current) : next;
+    next = obstacleDistance < Scalar(t.FleeDistance) ? static_cast<int>(BoidState::FLEEING) : next;
+    return static_cast<BoidState>(next);
+}
+
+// Agents partitioned by state: order[offsets[s] .. offsets[s + 1]) holds the indices of all
+// agents in state s, in the relative order of the given sequence (stable counting sort).
+struct StateBatches {
+    HugeVector<int, MemoryTag::BEHAVIOR> order;
+    std::array<int, BOID_STATE_COUNT + 1> offsets = {};
+
+    // sequence: agent indices in the order they should be visited
+    template <class BoidList, class Sequence>
+    void build(const BoidList& boids, const Sequence& sequence) {
+        offsets.fill(0);
+        for (int index : sequence) {
+            offsets[static_cast<int>(boids[index].state) + 1]++;
+        }
+        for (int s = 0; s < BOID_STATE_COUNT; s++) {
+            offsets[s + 1] += offsets[s];
+        }
+        std::array<int, BOID_STATE_COUNT> cursor;
+        for (int s = 0; s < BOID_STATE_COUNT; s++) {
+            cursor[s] = offsets[s];
+        }
+        order.resize(sequence.size());
+        for (int index : sequence) {
+            order[cursor[static_cast<int>(boids[index].state)]++] = index;
+        }
+    }
+
+    int begin(int state) const { return offsets[state]; }
+    int end(int state) const { return offsets[state + 1]; }
+    int count(BoidState state) const { return end(static_cast<int>(state)) - begin(static_cast<int>(state)); }
+};
+
+#endif
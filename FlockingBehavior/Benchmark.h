@@ -0,0 +1,644 @@
+#ifndef CS561_BENCHMARK_H
+#define CS561_BENCHMARK_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <random>
+#include "Flocker.h"
+#include "WorldChunks.h"
+#include "BoidPool.h"
+#include "Lockstep.h"
+#include "CommandQueue.h"
+
+// Headless timing runs of the simulation core, one per scalar type and neighbor configuration.
+// The same seeded flock is simulated for every scalar type, so the checksums (sum of all final
+// position components) show how far double and fixed point drift from the float build.
+
+struct BenchmarkConfig {
+    int agents = 2000;
+    int frames = 100;
+    float worldSize = 20.0f;        // agents start in a cube of this half size
+    float frameTime = 1.0f / 60.0f;
+    unsigned seed = 1;
+    PerfCounters* counters = nullptr;   // hardware counters per phase, summed into the result
+};
+
+struct BenchmarkCase {
+    const char* name;
+    NeighborModel model;
+    int maxNeighbors;
+    bool behaviorStates;
+    const char* rule;     // custom rule source (RuleVM.h), nullptr for none
+    bool rulePlugin;      // fuse VelocityMatchingRule into the neighbor loop
+    bool verlet;          // cached compressed neighbor lists instead of a grid query per agent
+};
+
+// custom rule used by the benchmarks, with a hand written equivalent in runRuleBenchmark
+const char* const BENCHMARK_RULE =
+    "param swirl = 2\n"
+    "let side = cross(vec(0, 0, 1), toTarget)\n"
+    "force = normalize(side) * swirl * step(neighbors, 8) + separation * 0.5\n";
+
+// the cases of runBenchmarks and of the JSON suite (BenchmarkReport.h)
+const BenchmarkCase BENCHMARK_CASES[] = {
+    { "radius", NeighborModel::RADIUS, 0, false, nullptr, false, false },
+    { "k-nearest(7)", NeighborModel::RADIUS, 7, false, nullptr, false, false },
+    { "visual", NeighborModel::VISUAL, 0, false, nullptr, false, false },
+    { "states", NeighborModel::RADIUS, 0, true, nullptr, false, false },
+    { "custom rule", NeighborModel::RADIUS, 0, false, BENCHMARK_RULE, false, false },
+    { "rule plugin", NeighborModel::RADIUS, 0, false, nullptr, true, false },
+    { "verlet", NeighborModel::RADIUS, 0, false, nullptr, false, true },
+    { "verlet k(7)", NeighborModel::RADIUS, 7, false, nullptr, false, true },
+};
+
+// the case of BENCHMARK_CASES with this name, nullptr if there is none
+inline const BenchmarkCase* findBenchmarkCase(const char* name) {
+    for (const BenchmarkCase& benchCase : BENCHMARK_CASES) {
+        if (std::strcmp(benchCase.name, name) == 0) {
+            return &benchCase;
+        }
+    }
+    return nullptr;
+}
+
+struct BenchmarkResult {
+    double msPerFrame = 0;
+    double checksum = 0;
+    NeighborListStats lists;    // Verlet cases only
+    double neighborsPerAgent = 0;   // recorded neighbors in the last frame
+    PhaseCounts phases[PERF_PHASE_COUNT];   // over all frames, with config.counters
+};
+
+template <class Traits, class... ExtraRules>
+BenchmarkResult runBenchmark(const BenchmarkConfig& config, const BenchmarkCase& benchCase) {
+    typedef BasicBoid<Traits> Boid;
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<float> range(-config.worldSize, config.worldSize);
+    BasicBoidList<Traits> boids;
+    boids.reserve(config.agents);
+    for (int i = 0; i < config.agents; i++) {
+        glm::vec3 position(range(rng), range(rng), range(rng));
+        glm::vec3 velocity(range(rng), range(rng), range(rng));
+        boids.push_back(Boid(Traits::fromVec3(position), Traits::fromVec3(velocity * 0.05f)));
+    }
+
+    BasicFlocker<Traits, ExtraRules...> flock(&boids);
+    flock.editParams([&](auto& p) {
+        p.SteeringTargets.push_back(Traits::fromVec3(glm::vec3(0)));
+        p.CollisionRadius = typename Traits::Scalar(2);
+        p.CollisionCenter = Traits::fromVec3(glm::vec3(-3, -3, 0));
+        p.InteractionModel = benchCase.model;
+        p.MaxNeighbors = benchCase.maxNeighbors;
+        p.EnableBehaviorStates = benchCase.behaviorStates;
+        p.VerletNeighbors = benchCase.verlet;
+        if (benchCase.rule != nullptr) {
+            p.CustomRule = compileRule(benchCase.rule);
+            p.EnableCustomRule = true;
+        }
+    });
+
+    BenchmarkResult result;
+    flock.Counters = config.counters;
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < config.frames; f++) {
+        flock.update(config.frameTime);
+        for (int p = 0; p < PERF_PHASE_COUNT && config.counters != nullptr; p++) {
+            result.phases[p].add(config.counters->phase(static_cast<PerfPhase>(p)));
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    result.msPerFrame = config.frames > 0 ? ms / config.frames : 0;
+    result.lists = flock.getNeighborListStats();
+    for (int i = 0; i < config.agents; i++) {
+        result.neighborsPerAgent += double(flock.getNeighborIds(i).size());
+    }
+    result.neighborsPerAgent /= config.agents > 0 ? double(config.agents) : 1.0;
+    for (auto& b : boids) {
+        glm::vec3 p = Traits::toVec3(b.position);
+        result.checksum += double(p.x) + double(p.y) + double(p.z);
+    }
+    return result;
+}
+
+template <class Traits>
+BenchmarkResult runBenchmarkCase(const BenchmarkConfig& config, const BenchmarkCase& benchCase) {
+    if (benchCase.rulePlugin) {
+        return runBenchmark<Traits, VelocityMatchingRule<Traits>>(config, benchCase);
+    }
+    return runBenchmark<Traits>(config, benchCase);
+}
+
+// Cost per agent of BENCHMARK_RULE in the interpreter and as compiled C++, on the same inputs
+template <class Traits>
+void runRuleBenchmark(const BenchmarkConfig& config, const char* name, std::ostream& out) {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    const int agents = (config.agents + RULE_BATCH_SIZE - 1) / RULE_BATCH_SIZE * RULE_BATCH_SIZE;
+    const int repeats = 200;
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<float> range(-config.worldSize, config.worldSize);
+    std::vector<Vec3> toTarget, separation;
+    std::vector<Scalar> neighbors;
+    for (int i = 0; i < agents; i++) {
+        toTarget.push_back(Traits::fromVec3(glm::vec3(range(rng), range(rng), range(rng))));
+        separation.push_back(Traits::fromVec3(glm::vec3(range(rng), range(rng), range(rng))));
+        neighbors.push_back(Scalar(static_cast<int>(rng() % 16)));
+    }
+    std::vector<Vec3> forces(agents);
+
+    RuleProgram rule = compileRule(BENCHMARK_RULE);
+    RuleVM<Scalar> vm;
+    vm.bind(rule);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < agents; i += RULE_BATCH_SIZE) {
+            for (int l = 0; l < RULE_BATCH_SIZE; l++) {
+                vm.setInput(RuleInput::TO_TARGET, l, toTarget[i + l]);
+                vm.setInput(RuleInput::SEPARATION, l, separation[i + l]);
+                vm.setInput(RuleInput::NEIGHBORS, l, neighbors[i + l]);
+            }
+            vm.run();
+            for (int l = 0; l < RULE_BATCH_SIZE; l++) {
+                forces[i + l] += vm.template force<Vec3>(l);
+            }
+        }
+    }
+    double vmNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    const Scalar swirl = Scalar(2);
+    const Vec3 up = Traits::fromVec3(glm::vec3(0, 0, 1));
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < agents; i++) {
+            Vec3 side = cross(up, toTarget[i]);
+            Scalar sideLength = length(side);
+            Vec3 swirlForce = sideLength == Scalar(0) ? Vec3(0) : side / sideLength;
+            Scalar active = neighbors[i] <= Scalar(8) ? Scalar(1) : Scalar(0);
+            forces[i] += swirlForce * (swirl * active) + separation[i] * Scalar(0.5f);
+        }
+    }
+    double nativeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    double perAgent = 1.0 / (double(agents) * repeats);
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-8s %14.2f %14.2f %10.2fx\n",
+                  name, vmNs * perAgent, nativeNs * perAgent, nativeNs > 0 ? vmNs / nativeNs : 0.0);
+    out << line;
+}
+
+// An observer flies along a row of populated chunks while distant chunks are paged out and in
+inline void runStreamingBenchmark(const BenchmarkConfig& config, std::ostream& out) {
+    const int CHUNKS = 16;
+    const float CHUNK_SIZE = 32.0f;
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<float> range(-1.0f, 1.0f);
+    BoidList boids;
+    for (int i = 0; i < config.agents * CHUNKS / 2; i++) {
+        glm::vec3 center((float(i % CHUNKS) + 0.5f) * CHUNK_SIZE, 0.5f * CHUNK_SIZE, 0.5f * CHUNK_SIZE);
+        glm::vec3 offset(range(rng), range(rng), range(rng));
+        boids.push_back(Boid(center + offset * (0.45f * CHUNK_SIZE), glm::vec3(range(rng), range(rng), range(rng))));
+    }
+    long long total = static_cast<long long>(boids.size());
+
+    Flocker flock(&boids);
+    flock.editParams([](Flocker::Params& p) { p.MaxNeighbors = 7; });
+    WorldChunks<FloatTraits> world(&boids);
+    world.ChunkSize = CHUNK_SIZE;
+    world.ActiveRadius = 1.5f * CHUNK_SIZE;
+    world.MaxResidentAgents = config.agents;
+    world.UpdateInterval = 0;
+    world.Directory = "bench_chunks";
+
+    long long peakResident = 0;
+    double streamMs = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < config.frames; f++) {
+        float x = CHUNK_SIZE * CHUNKS * float(f) / float(config.frames);
+        world.Observers.assign(1, glm::vec3(x, 0.5f * CHUNK_SIZE, 0.5f * CHUNK_SIZE));
+        world.update(config.frameTime);
+        streamMs += world.getStats().planMilliseconds;
+        flock.update(config.frameTime);
+        peakResident = std::max(peakResident, static_cast<long long>(boids.size()));
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    world.flush();
+
+    const ChunkStreamStats& stats = world.getStats();
+    int frames = config.frames > 0 ? config.frames : 1;
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "\nchunk streaming: %lld agents, resident bound %lld\n"
+                  "ms/frame %.3f (residency %.3f), peak resident %lld, page outs %lld, page ins %lld, lost %lld\n",
+                  total, world.MaxResidentAgents, ms / frames, streamMs / frames, peakResident,
+                  stats.pageOuts, stats.pageIns, stats.lostAgents);
+    out << line;
+}
+
+// Steady churn: every frame a fixed share of the flock is despawned at random and as many agents
+// are spawned, either through a BoidPool or with vector erase / push_back
+inline void runChurnBenchmark(const BenchmarkConfig& config, std::ostream& out) {
+    const int churn = config.agents / 30 > 0 ? config.agents / 30 : 1;
+    char line[256];
+    std::snprintf(line, sizeof(line), "\nchurn: %d agents, %d spawned and despawned per frame\n%-16s %12s %12s %14s\n",
+                  config.agents, churn, "storage", "ms/frame", "worst ms", "reallocations");
+    out << line;
+
+    for (int usePool = 1; usePool >= 0; usePool--) {
+        std::mt19937 rng(config.seed);
+        std::uniform_real_distribution<float> range(-config.worldSize, config.worldSize);
+        auto randomBoid = [&]() {
+            return Boid(glm::vec3(range(rng), range(rng), range(rng)), glm::vec3(range(rng), range(rng), range(rng)) * 0.05f);
+        };
+        BoidList boids;
+        BoidPool<FloatTraits> pool(&boids);
+        for (int i = 0; i < config.agents; i++) {
+            pool.spawn(randomBoid());
+        }
+        Flocker flock(&boids);
+        flock.editParams([](Flocker::Params& p) { p.MaxNeighbors = 7; });
+
+        long long reallocations = 0;
+        double total = 0, worst = 0;
+        for (int f = 0; f < config.frames; f++) {
+            auto start = std::chrono::steady_clock::now();
+            if (usePool) {
+                for (int i = 0; i < churn; i++) {
+                    int slot = static_cast<int>(rng() % boids.size());
+                    while (!boids[slot].alive) {
+                        slot = (slot + 1) % static_cast<int>(boids.size());
+                    }
+                    pool.despawn(slot);
+                }
+                for (int i = 0; i < churn; i++) {
+                    pool.spawn(randomBoid());
+                }
+                pool.update(config.frameTime);
+            }
+            else {
+                for (int i = 0; i < churn; i++) {
+                    boids.erase(boids.begin() + rng() % boids.size());
+                }
+                for (int i = 0; i < churn; i++) {
+                    reallocations += boids.size() == boids.capacity() ? 1 : 0;
+                    boids.push_back(randomBoid());
+                }
+            }
+            flock.update(config.frameTime);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            total += ms;
+            worst = std::max(worst, ms);
+        }
+        if (usePool) {
+            reallocations = pool.getStats().reallocations;
+        }
+        std::snprintf(line, sizeof(line), "%-16s %12.3f %12.3f %14lld\n", usePool ? "pool" : "erase/push_back",
+                      config.frames > 0 ? total / config.frames : 0.0, worst, reallocations);
+        out << line;
+    }
+}
+
+// Lockstep peers in one process: each adds random inputs of its own, and packets reach the others
+// after a random delay of up to three frames and in shuffled order.  Prints the final state hash,
+// which must also match between runs on different machines, and the first desynced frame if any.
+inline void runLockstepCheck(const BenchmarkConfig& config, int peers, std::ostream& out) {
+    std::vector<std::unique_ptr<LockstepSession>> sessions;
+    for (int p = 0; p < peers; p++) {
+        sessions.emplace_back(new LockstepSession(peers, p, config.seed, config.agents, config.worldSize));
+    }
+    struct Packet {
+        int to;
+        int deliverTick;
+        std::vector<uint8_t> bytes;
+    };
+    std::vector<Packet> network;
+    std::mt19937 rng(config.seed);
+    auto start = std::chrono::steady_clock::now();
+    int ticks = 0;
+    bool done = false;
+    while (!done) {
+        for (int p = 0; p < peers; p++) {
+            LockstepSession& session = *sessions[p];
+            if (rng() % 8 == 0) {
+                glm::vec3 where(float(int(rng() % 21) - 10), float(int(rng() % 21) - 10), float(int(rng() % 21) - 10));
+                switch (rng() % 4) {
+                case 0: session.addInput(LockstepInput::moveTarget(where)); break;
+                case 1: session.addInput(LockstepInput::moveObstacle(where, 1.0f + float(rng() % 4))); break;
+                case 2: session.addInput(LockstepInput::spawn(where, 1 + int(rng() % 8))); break;
+                default: session.addInput(LockstepInput::setWeight(int(rng() % 4), 0.5f * float(rng() % 8))); break;
+                }
+            }
+            std::vector<uint8_t> packet = session.sendInputs();
+            for (int q = 0; q < peers && !packet.empty(); q++) {
+                if (q != p) {
+                    network.push_back(Packet{ q, ticks + int(rng() % 4), packet });
+                }
+            }
+        }
+        std::shuffle(network.begin(), network.end(), rng);
+        for (size_t i = 0; i < network.size();) {
+            if (network[i].deliverTick <= ticks) {
+                sessions[network[i].to]->receive(network[i].bytes.data(), network[i].bytes.size());
+                network[i] = network.back();
+                network.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+        done = true;
+        for (auto& session : sessions) {
+            if (session->frame() < static_cast<uint32_t>(config.frames) && session->canStep()) {
+                session->step();
+            }
+            done = done && session->frame() >= static_cast<uint32_t>(config.frames);
+        }
+        ticks++;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    bool same = true;
+    long long desync = -1;
+    for (const auto& session : sessions) {
+        same = same && session->hash() == sessions[0]->hash();
+        desync = session->desyncFrame() >= 0 && (desync < 0 || session->desyncFrame() < desync) ? session->desyncFrame() : desync;
+    }
+    char line[200];
+    std::snprintf(line, sizeof(line), "\nlockstep: %d peers, %d agents, %d frames in %d ticks, %lld inputs, %.3f ms/frame per peer\n"
+                  "final hash %016llx, %s",
+                  peers, config.agents, config.frames, ticks, sessions[0]->appliedInputs(),
+                  config.frames > 0 ? ms / config.frames / peers : 0.0,
+                  static_cast<unsigned long long>(sessions[0]->hash()), same ? "all peers agree" : "PEERS DIFFER");
+    out << line;
+    if (desync >= 0) {
+        std::snprintf(line, sizeof(line), ", first desync at frame %lld", desync);
+        out << line;
+    }
+    out << "\n";
+}
+
+// CommandQueue with a mutex instead of the lock-free stack, as the baseline of the stress test
+class LockedCommandQueue {
+public:
+    void push(CommandBatch batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        batches.push_back(std::move(batch));
+    }
+
+    size_t drain(std::vector<CommandBatch>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = batches.size();
+        for (CommandBatch& batch : batches) {
+            out.push_back(std::move(batch));
+        }
+        batches.clear();
+        return count;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<CommandBatch> batches;
+};
+
+// Producers push small batches (spawn, despawn of random ids, target and obstacle moves) as fast
+// as they can while the simulation thread drains and applies them frame after frame
+template <class Queue>
+void runCommandStress(const BenchmarkConfig& config, int producers, const char* name, std::ostream& out) {
+    const int batchesPerProducer = 2000;
+    BoidList boids;
+    BoidPool<FloatTraits> pool(&boids);
+    Flocker::Params params;
+    Queue queue;
+    std::atomic<int> running(producers);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p]() {
+            std::mt19937 rng(config.seed + p);
+            for (int b = 0; b < batchesPerProducer; b++) {
+                CommandBatch batch;
+                glm::vec3 where(float(int(rng() % 21) - 10), float(int(rng() % 21) - 10), float(int(rng() % 21) - 10));
+                batch.push_back(FlockCommand::spawn(2, where, 1.0f, glm::vec3(0), 1.0f));
+                batch.push_back(FlockCommand::despawn({ uint32_t(rng() % 100000), uint32_t(rng() % 100000) }));
+                batch.push_back(FlockCommand::moveTarget(where));
+                batch.push_back(FlockCommand::setObstacle(-where, 2.0f));
+                queue.push(std::move(batch));
+            }
+            running--;
+        });
+    }
+    std::mt19937 rng(config.seed);
+    std::vector<CommandBatch> drained;
+    CommandStats stats;
+    double worstApply = 0;
+    int frames = 0;
+    bool more = true;
+    while (more) {
+        more = running.load() > 0;
+        drained.clear();
+        queue.drain(drained);
+        stats = applyCommands(drained, pool, params, rng, stats);
+        pool.update(config.frameTime);
+        worstApply = std::max(worstApply, stats.applyMilliseconds);
+        frames++;
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    char line[200];
+    std::snprintf(line, sizeof(line), "%-10s %9d %14.0f %10d %14.3f %10d\n", name, producers,
+                  ms > 0 ? double(stats.totalCommands) / ms * 1000.0 : 0.0, frames, worstApply, pool.alive());
+    out << line;
+}
+
+inline void runCommandBenchmark(const BenchmarkConfig& config, std::ostream& out) {
+    char line[200];
+    std::snprintf(line, sizeof(line), "\ncommand queue stress\n%-10s %9s %14s %10s %14s %10s\n",
+                  "queue", "producers", "commands/s", "frames", "worst apply ms", "agents");
+    out << line;
+    for (int producers = 1; producers <= 8; producers *= 2) {
+        runCommandStress<CommandQueue>(config, producers, "lock-free", out);
+        runCommandStress<LockedCommandQueue>(config, producers, "mutex", out);
+    }
+}
+
+// Hardware counters per phase for a few float cases: instructions per cycle and misses per agent
+// per frame.  Counters the machine does not provide print as "-".
+inline void runCounterBenchmark(const BenchmarkConfig& config, std::ostream& out) {
+    PerfCounters counters;
+    counters.open();
+    char line[200];
+    out << "\nhardware counters per phase, per agent and frame\n";
+    if (!counters.lastError().empty()) {
+        out << (counters.available() ? "some counters unavailable: " : "counters unavailable: ") << counters.lastError() << "\n";
+    }
+    std::snprintf(line, sizeof(line), "%-14s %-10s %9s %6s %10s %10s %10s %10s\n",
+                  "case", "phase", "ms/frame", "ipc", "L1d miss", "LLC miss", "br miss", "dTLB miss");
+    out << line;
+    static const BenchmarkCase cases[] = {
+        { "radius", NeighborModel::RADIUS, 0, false, nullptr, false, false },
+        { "k-nearest(7)", NeighborModel::RADIUS, 7, false, nullptr, false, false },
+        { "verlet", NeighborModel::RADIUS, 0, false, nullptr, false, true },
+    };
+    BenchmarkConfig counted = config;
+    counted.counters = &counters;
+    for (const BenchmarkCase& benchCase : cases) {
+        BenchmarkResult result = runBenchmark<FloatTraits>(counted, benchCase);
+        for (int p = 0; p < PERF_PHASE_COUNT; p++) {
+            const PhaseCounts& phase = result.phases[p];
+            auto column = [&](PerfCounter counter, char* text, size_t size) {
+                if (counters.available(counter)) {
+                    std::snprintf(text, size, "%.3f", phase.perAgent(counter));
+                }
+                else {
+                    std::snprintf(text, size, "-");
+                }
+            };
+            char ipc[16], l1[16], llc[16], branch[16], tlb[16];
+            if (counters.available(PerfCounter::CYCLES) && counters.available(PerfCounter::INSTRUCTIONS)) {
+                std::snprintf(ipc, sizeof(ipc), "%.2f", phase.ipc());
+            }
+            else {
+                std::snprintf(ipc, sizeof(ipc), "-");
+            }
+            column(PerfCounter::L1D_MISSES, l1, sizeof(l1));
+            column(PerfCounter::LLC_MISSES, llc, sizeof(llc));
+            column(PerfCounter::BRANCH_MISSES, branch, sizeof(branch));
+            column(PerfCounter::DTLB_MISSES, tlb, sizeof(tlb));
+            std::snprintf(line, sizeof(line), "%-14s %-10s %9.3f %6s %10s %10s %10s %10s\n",
+                          p == 0 ? benchCase.name : "", perfPhaseName(static_cast<PerfPhase>(p)),
+                          config.frames > 0 ? phase.milliseconds / config.frames : 0.0, ipc, l1, llc, branch, tlb);
+            out << line;
+        }
+    }
+}
+
+// Upper bounds on the peak footprint of one storage mode (scalar type, grid queries or Verlet
+// lists), in bytes.  The neighbor subsystem grows with the neighbor count, so it is budgeted per
+// agent and recorded neighbor.  Measured with regular heap blocks, so huge page rounding is left out.
+struct MemoryBudget {
+    const char* scalar;
+    bool verlet;
+    double boids;           // per agent
+    double voxelMap;        // per agent
+    double neighbors;       // per agent and neighbor
+};
+
+const MemoryBudget MEMORY_BUDGETS[] = {
+    { "float", false, 72, 40, 8 },
+    { "float", true, 72, 40, 10 },
+    { "double", false, 128, 40, 8 },
+    { "double", true, 128, 40, 10 },
+    { "fixed", false, 128, 40, 8 },
+    { "fixed", true, 128, 40, 10 },
+};
+
+// peak bytes of the boids, voxel map and neighbor subsystems over one benchmark run, scaled as in
+// MemoryBudget
+template <class Traits>
+void measureMemory(const BenchmarkConfig& config, bool verlet, double perAgent[3]) {
+    static const MemoryTag tags[3] = { MemoryTag::BOIDS, MemoryTag::VOXEL_MAP, MemoryTag::NEIGHBORS };
+    long long before[3];
+    for (int i = 0; i < 3; i++) {
+        before[i] = memoryAccount(tags[i]).liveBytes.load();
+    }
+    resetMemoryPeaks();
+    BenchmarkCase benchCase = { "memory", NeighborModel::RADIUS, 0, false, nullptr, false, verlet };
+    BenchmarkResult result = runBenchmark<Traits>(config, benchCase);
+    for (int i = 0; i < 3; i++) {
+        long long peak = memoryAccount(tags[i]).peakBytes.load() - before[i];
+        perAgent[i] = config.agents > 0 ? double(peak) / double(config.agents) : 0.0;
+    }
+    perAgent[2] /= std::max(1.0, result.neighborsPerAgent);
+}
+
+// Checks every storage mode against MEMORY_BUDGETS; false when any subsystem is over budget
+inline bool runMemoryBenchmark(const BenchmarkConfig& config, std::ostream& out) {
+    HugePageMode mode = hugePageMode();
+    hugePageMode() = HugePageMode::OFF;
+    char line[200];
+    std::snprintf(line, sizeof(line), "\npeak bytes per agent (budget)\n%-8s %-7s %16s %16s %20s\n",
+                  "scalar", "lists", "boids", "voxel map", "per neighbor");
+    out << line;
+    bool ok = true;
+    for (const MemoryBudget& budget : MEMORY_BUDGETS) {
+        double perAgent[3];
+        std::string scalar = budget.scalar;
+        if (scalar == "float") {
+            measureMemory<FloatTraits>(config, budget.verlet, perAgent);
+        }
+        else if (scalar == "double") {
+            measureMemory<DoubleTraits>(config, budget.verlet, perAgent);
+        }
+        else {
+            measureMemory<FixedTraits>(config, budget.verlet, perAgent);
+        }
+        const double limits[3] = { budget.boids, budget.voxelMap, budget.neighbors };
+        char columns[3][40];
+        for (int i = 0; i < 3; i++) {
+            bool over = perAgent[i] > limits[i];
+            ok = ok && !over;
+            std::snprintf(columns[i], sizeof(columns[i]), "%.1f (%.0f)%s", perAgent[i], limits[i], over ? " !" : "");
+        }
+        std::snprintf(line, sizeof(line), "%-8s %-7s %16s %16s %20s\n",
+                      budget.scalar, budget.verlet ? "verlet" : "grid", columns[0], columns[1], columns[2]);
+        out << line;
+    }
+    out << (ok ? "all storage modes within budget\n" : "over budget (marked !)\n");
+    hugePageMode() = mode;
+    return ok;
+}
+
+// Runs every case for the float, double and fixed point builds and prints one line per run;
+// false when a storage mode is over its bytes per boid budget
+inline bool runBenchmarks(const BenchmarkConfig& config, std::ostream& out) {
+    char line[200];
+    std::snprintf(line, sizeof(line), "%d agents, %d frames\n%-14s %-8s %6s %12s %14s\n",
+                  config.agents, config.frames, "case", "scalar", "simd", "ms/frame", "checksum");
+    out << line;
+    for (const BenchmarkCase& benchCase : BENCHMARK_CASES) {
+        BenchmarkResult results[3] = {
+            runBenchmarkCase<FloatTraits>(config, benchCase),
+            runBenchmarkCase<DoubleTraits>(config, benchCase),
+            runBenchmarkCase<FixedTraits>(config, benchCase),
+        };
+        const char* names[3] = { "float", "double", "fixed" };
+        const int widths[3] = { FloatTraits::SimdWidth, DoubleTraits::SimdWidth, FixedTraits::SimdWidth };
+        for (int i = 0; i < 3; i++) {
+            std::snprintf(line, sizeof(line), "%-14s %-8s %6d %12.3f %14.4f\n",
+                          benchCase.name, names[i], widths[i], results[i].msPerFrame, results[i].checksum);
+            out << line;
+        }
+        if (benchCase.verlet) {
+            const NeighborListStats& lists = results[0].lists;
+            double agents = config.agents > 0 ? double(config.agents) : 1.0;
+            std::snprintf(line, sizeof(line), "%-14s %.1f neighbors/agent, %.1f bytes/agent compressed, %.1f as indices (%.2fx), %lld rebuilds\n",
+                          "", double(lists.entries) / agents, double(lists.compressedBytes) / agents,
+                          double(lists.rawBytes) / agents, lists.ratio(), lists.rebuilds);
+            out << line;
+        }
+    }
+
+    std::snprintf(line, sizeof(line), "\ncustom rule cost per agent\n%-8s %14s %14s %11s\n",
+                  "scalar", "vm ns", "native ns", "ratio");
+    out << line;
+    runRuleBenchmark<FloatTraits>(config, "float", out);
+    runRuleBenchmark<DoubleTraits>(config, "double", out);
+    runRuleBenchmark<FixedTraits>(config, "fixed", out);
+
+    runStreamingBenchmark(config, out);
+    runChurnBenchmark(config, out);
+    runCommandBenchmark(config, out);
+    runCounterBenchmark(config, out);
+    return runMemoryBenchmark(config, out);
+}
+
+#endif
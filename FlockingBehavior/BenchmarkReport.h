@@ -0,0 +1,453 @@
+#ifndef CS561_BENCHMARK_REPORT_H
+#define CS561_BENCHMARK_REPORT_H
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+
+// Repeated benchmark runs written as JSON, and a comparison of two such files that says whether a
+// change is faster with some confidence instead of from a single noisy reading.
+//
+// Every scenario (a benchmark case with one scalar type, or one size of the sweep) is simulated
+// from the same seed for a number of repetitions; each repetition contributes one ms/frame sample
+// for the whole frame and for each flock phase.  The comparison reports per scenario and phase
+// the median of both files, the relative change of the medians with a bootstrap 95% confidence
+// interval, and the two sided p-value of a Mann-Whitney U test.  A change only counts when the
+// test is significant and the interval excludes zero.
+
+const int BENCHMARK_PHASE_COUNT = PERF_PHASE_COUNT + 1;
+
+inline const char* benchmarkPhaseName(int phase) {
+    return phase == 0 ? "frame" : perfPhaseName(static_cast<PerfPhase>(phase - 1));
+}
+
+// ms/frame of every repetition of one scenario
+struct BenchmarkSamples {
+    std::string scenario;
+    int agents = 0;
+    double checksum = 0;
+    std::vector<double> phases[BENCHMARK_PHASE_COUNT];
+};
+
+namespace bench_detail {
+    // The few JSON values the result files use
+    struct JsonValue {
+        enum Type { NUL, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+        double number = 0;
+        std::string text;
+        std::vector<JsonValue> items;
+        std::vector<std::pair<std::string, JsonValue>> members;
+
+        const JsonValue* find(const char* name) const {
+            for (auto& member : members) {
+                if (member.first == name) {
+                    return &member.second;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    class JsonReader {
+    public:
+        explicit JsonReader(const std::string& text) : text(text) {}
+
+        bool parse(JsonValue& value) {
+            return parseValue(value, 0) && (skip(), pos == text.size());
+        }
+
+    private:
+        const std::string& text;
+        size_t pos = 0;
+
+        void skip() {
+            while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) {
+                pos++;
+            }
+        }
+
+        bool literal(const char* word) {
+            size_t n = strlen(word);
+            if (text.compare(pos, n, word) != 0) {
+                return false;
+            }
+            pos += n;
+            return true;
+        }
+
+        bool parseString(std::string& out) {
+            if (pos >= text.size() || text[pos] != '"') {
+                return false;
+            }
+            pos++;
+            while (pos < text.size() && text[pos] != '"') {
+                char c = text[pos++];
+                if (c == '\\' && pos < text.size()) {
+                    char e = text[pos++];
+                    c = e == 'n' ? '\n' : e == 't' ? '\t' : e;
+                }
+                out += c;
+            }
+            if (pos >= text.size()) {
+                return false;
+            }
+            pos++;
+            return true;
+        }
+
+        bool parseValue(JsonValue& value, int depth) {
+            skip();
+            if (pos >= text.size() || depth > 32) {
+                return false;
+            }
+            char c = text[pos];
+            if (c == '{') {
+                value.type = JsonValue::OBJECT;
+                pos++;
+                skip();
+                if (pos < text.size() && text[pos] == '}') {
+                    pos++;
+                    return true;
+                }
+                for (;;) {
+                    skip();
+                    std::pair<std::string, JsonValue> member;
+                    if (!parseString(member.first)) {
+                        return false;
+                    }
+                    skip();
+                    if (pos >= text.size() || text[pos++] != ':' || !parseValue(member.second, depth + 1)) {
+                        return false;
+                    }
+                    value.members.push_back(std::move(member));
+                    skip();
+                    if (pos < text.size() && text[pos] == ',') {
+                        pos++;
+                        continue;
+                    }
+                    return pos < text.size() && text[pos++] == '}';
+                }
+            }
+            if (c == '[') {
+                value.type = JsonValue::ARRAY;
+                pos++;
+                skip();
+                if (pos < text.size() && text[pos] == ']') {
+                    pos++;
+                    return true;
+                }
+                for (;;) {
+                    value.items.emplace_back();
+                    if (!parseValue(value.items.back(), depth + 1)) {
+                        return false;
+                    }
+                    skip();
+                    if (pos < text.size() && text[pos] == ',') {
+                        pos++;
+                        continue;
+                    }
+                    return pos < text.size() && text[pos++] == ']';
+                }
+            }
+            if (c == '"') {
+                value.type = JsonValue::STRING;
+                return parseString(value.text);
+            }
+            if (literal("null")) {
+                return true;
+            }
+            const char* start = text.c_str() + pos;
+            char* end = nullptr;
+            value.number = strtod(start, &end);
+            if (end == start) {
+                return false;
+            }
+            value.type = JsonValue::NUMBER;
+            pos += end - start;
+            return true;
+        }
+    };
+
+    inline std::string quoted(const std::string& text) {
+        std::string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    inline double median(std::vector<double> values) {
+        if (values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        size_t half = values.size() / 2;
+        return values.size() % 2 == 1 ? values[half] : 0.5 * (values[half - 1] + values[half]);
+    }
+
+    // two sided p-value of the Mann-Whitney U test, normal approximation with tie and continuity
+    // correction; fine from about five samples per side
+    inline double mannWhitneyP(const std::vector<double>& a, const std::vector<double>& b) {
+        size_t n1 = a.size(), n2 = b.size(), n = n1 + n2;
+        if (n1 == 0 || n2 == 0) {
+            return 1.0;
+        }
+        std::vector<std::pair<double, int>> all;
+        for (double v : a) all.push_back({ v, 0 });
+        for (double v : b) all.push_back({ v, 1 });
+        std::sort(all.begin(), all.end());
+        double rankSumA = 0, ties = 0;
+        for (size_t i = 0; i < n;) {
+            size_t j = i;
+            while (j < n && all[j].first == all[i].first) {
+                j++;
+            }
+            double rank = 0.5 * double(i + 1 + j);      // average of ranks i + 1 .. j
+            double t = double(j - i);
+            ties += t * t * t - t;
+            for (size_t k = i; k < j; k++) {
+                if (all[k].second == 0) {
+                    rankSumA += rank;
+                }
+            }
+            i = j;
+        }
+        double u = rankSumA - double(n1) * double(n1 + 1) / 2.0;
+        double mean = double(n1) * double(n2) / 2.0;
+        double variance = double(n1) * double(n2) / 12.0 * (double(n + 1) - ties / (double(n) * double(n - 1)));
+        if (variance <= 0) {
+            return 1.0;
+        }
+        double z = std::max(0.0, std::fabs(u - mean) - 0.5) / std::sqrt(variance);
+        return std::erfc(z / std::sqrt(2.0));
+    }
+
+    // percentile bootstrap of the relative change of the medians, in percent
+    inline void bootstrapDelta(const std::vector<double>& a, const std::vector<double>& b, double& low, double& high) {
+        const int resamples = 2000;
+        std::mt19937 rng(12345);
+        std::vector<double> deltas, ra(a.size()), rb(b.size());
+        std::uniform_int_distribution<size_t> pickA(0, a.size() - 1), pickB(0, b.size() - 1);
+        deltas.reserve(resamples);
+        for (int r = 0; r < resamples; r++) {
+            for (double& v : ra) v = a[pickA(rng)];
+            for (double& v : rb) v = b[pickB(rng)];
+            double base = median(ra);
+            deltas.push_back(base > 0 ? (median(rb) / base - 1.0) * 100.0 : 0.0);
+        }
+        std::sort(deltas.begin(), deltas.end());
+        low = deltas[size_t(0.025 * (resamples - 1))];
+        high = deltas[size_t(0.975 * (resamples - 1))];
+    }
+}
+
+template <class Traits>
+BenchmarkSamples runBenchmarkSamples(const BenchmarkConfig& config, const BenchmarkCase& benchCase,
+                                     int repetitions, const std::string& scenario) {
+    // phase timings come from PerfCounters even when no hardware counter is opened
+    PerfCounters timers;
+    BenchmarkConfig timed = config;
+    timed.counters = &timers;
+    BenchmarkConfig warmup = timed;
+    warmup.frames = std::min(config.frames, 10);
+    runBenchmarkCase<Traits>(warmup, benchCase);
+
+    BenchmarkSamples samples;
+    samples.scenario = scenario;
+    samples.agents = config.agents;
+    double frames = config.frames > 0 ? double(config.frames) : 1.0;
+    for (int r = 0; r < repetitions; r++) {
+        BenchmarkResult result = runBenchmarkCase<Traits>(timed, benchCase);
+        samples.checksum = result.checksum;
+        samples.phases[0].push_back(result.msPerFrame);
+        for (int p = 0; p < PERF_PHASE_COUNT; p++) {
+            samples.phases[p + 1].push_back(result.phases[p].milliseconds / frames);
+        }
+    }
+    return samples;
+}
+
+// Runs every benchmark case for the three scalar types, then the float radius, k-nearest and
+// Verlet cases from an eighth to four times config.agents at constant density, and writes the
+// samples as JSON.  Progress goes to log; false, before anything runs, when a sweep case is
+// missing from BENCHMARK_CASES.
+inline bool runBenchmarkSuite(const BenchmarkConfig& config, int repetitions, std::ostream& json, std::ostream& log) {
+    static const char* const sweepNames[] = { "radius", "k-nearest(7)", "verlet" };
+    std::vector<const BenchmarkCase*> sweepCases;
+    for (const char* name : sweepNames) {
+        const BenchmarkCase* benchCase = findBenchmarkCase(name);
+        if (benchCase == nullptr) {
+            log << "no benchmark case \"" << name << "\" to sweep\n";
+            return false;
+        }
+        sweepCases.push_back(benchCase);
+    }
+
+    std::vector<BenchmarkSamples> all;
+    for (const BenchmarkCase& benchCase : BENCHMARK_CASES) {
+        std::string name = benchCase.name;
+        all.push_back(runBenchmarkSamples<FloatTraits>(config, benchCase, repetitions, name + "/float"));
+        all.push_back(runBenchmarkSamples<DoubleTraits>(config, benchCase, repetitions, name + "/double"));
+        all.push_back(runBenchmarkSamples<FixedTraits>(config, benchCase, repetitions, name + "/fixed"));
+        log << name << " done\n";
+    }
+
+    static const double scales[] = { 0.125, 0.25, 0.5, 1.0, 2.0, 4.0 };
+    for (const BenchmarkCase* sweepCase : sweepCases) {
+        const BenchmarkCase& benchCase = *sweepCase;
+        for (double scale : scales) {
+            BenchmarkConfig sized = config;
+            sized.agents = std::max(1, int(config.agents * scale));
+            sized.worldSize = config.worldSize * float(std::cbrt(scale));
+            std::string name = std::string("sweep ") + benchCase.name + "/" + std::to_string(sized.agents);
+            all.push_back(runBenchmarkSamples<FloatTraits>(sized, benchCase, repetitions, name));
+        }
+        log << "sweep " << benchCase.name << " done\n";
+    }
+
+    char number[64];
+    json << "{\n  \"format\": \"flocking-benchmark\",\n  \"version\": 1,\n";
+    json << "  \"agents\": " << config.agents << ",\n  \"frames\": " << config.frames
+         << ",\n  \"repetitions\": " << repetitions << ",\n  \"seed\": " << config.seed << ",\n";
+    json << "  \"results\": [\n";
+    for (size_t i = 0; i < all.size(); i++) {
+        const BenchmarkSamples& s = all[i];
+        std::snprintf(number, sizeof(number), "%.17g", s.checksum);
+        json << "    { \"scenario\": " << bench_detail::quoted(s.scenario) << ", \"agents\": " << s.agents
+             << ", \"checksum\": " << number << ",\n      \"ms_per_frame\": {";
+        for (int p = 0; p < BENCHMARK_PHASE_COUNT; p++) {
+            json << (p > 0 ? ",\n        " : " ") << "\"" << benchmarkPhaseName(p) << "\": [";
+            for (size_t r = 0; r < s.phases[p].size(); r++) {
+                std::snprintf(number, sizeof(number), "%s%.6f", r > 0 ? ", " : "", s.phases[p][r]);
+                json << number;
+            }
+            json << "]";
+        }
+        json << " } }" << (i + 1 < all.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+    return true;
+}
+
+// Reads a file written by runBenchmarkSuite
+inline bool readBenchmarkSamples(const char* path, std::vector<BenchmarkSamples>& out, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "cannot open";
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+    bench_detail::JsonValue root;
+    if (!bench_detail::JsonReader(text).parse(root) || root.type != bench_detail::JsonValue::OBJECT) {
+        error = "not valid JSON";
+        return false;
+    }
+    const bench_detail::JsonValue* format = root.find("format");
+    const bench_detail::JsonValue* results = root.find("results");
+    if (format == nullptr || format->text != "flocking-benchmark" || results == nullptr) {
+        error = "not a benchmark result file";
+        return false;
+    }
+    for (const bench_detail::JsonValue& item : results->items) {
+        const bench_detail::JsonValue* scenario = item.find("scenario");
+        const bench_detail::JsonValue* phases = item.find("ms_per_frame");
+        if (scenario == nullptr || phases == nullptr) {
+            continue;
+        }
+        BenchmarkSamples samples;
+        samples.scenario = scenario->text;
+        if (const bench_detail::JsonValue* agents = item.find("agents")) samples.agents = int(agents->number);
+        if (const bench_detail::JsonValue* checksum = item.find("checksum")) samples.checksum = checksum->number;
+        for (int p = 0; p < BENCHMARK_PHASE_COUNT; p++) {
+            if (const bench_detail::JsonValue* values = phases->find(benchmarkPhaseName(p))) {
+                for (const bench_detail::JsonValue& v : values->items) {
+                    samples.phases[p].push_back(v.number);
+                }
+            }
+        }
+        out.push_back(std::move(samples));
+    }
+    return true;
+}
+
+// Prints one line per scenario and phase present in both files.  Returns false when a file cannot
+// be read; significant slowdowns are counted in the summary line.
+inline bool compareBenchmarks(const char* basePath, const char* newPath, std::ostream& out, double alpha = 0.05) {
+    std::vector<BenchmarkSamples> base, next;
+    std::string error;
+    if (!readBenchmarkSamples(basePath, base, error)) {
+        out << basePath << ": " << error << "\n";
+        return false;
+    }
+    if (!readBenchmarkSamples(newPath, next, error)) {
+        out << newPath << ": " << error << "\n";
+        return false;
+    }
+
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-26s %-10s %10s %10s %8s %18s %7s\n",
+                  "scenario", "phase", "base ms", "new ms", "delta", "95% ci", "p");
+    out << line;
+    int faster = 0, slower = 0, same = 0;
+    for (const BenchmarkSamples& b : base) {
+        auto match = std::find_if(next.begin(), next.end(), [&](const BenchmarkSamples& s) { return s.scenario == b.scenario; });
+        if (match == next.end()) {
+            out << b.scenario << ": only in " << basePath << "\n";
+            continue;
+        }
+        for (int p = 0; p < BENCHMARK_PHASE_COUNT; p++) {
+            const std::vector<double>& a = b.phases[p];
+            const std::vector<double>& n = match->phases[p];
+            double medianA = bench_detail::median(a);
+            if (a.empty() || n.empty() || medianA <= 0) {
+                continue;
+            }
+            double medianN = bench_detail::median(n);
+            double delta = (medianN / medianA - 1.0) * 100.0;
+            double low, high;
+            bench_detail::bootstrapDelta(a, n, low, high);
+            double pValue = bench_detail::mannWhitneyP(a, n);
+            const char* verdict = "";
+            if (pValue < alpha && (low > 0 || high < 0)) {
+                verdict = delta < 0 ? "faster" : "slower";
+                (delta < 0 ? faster : slower)++;
+            }
+            else {
+                same++;
+            }
+            char interval[40];
+            std::snprintf(interval, sizeof(interval), "[%+.1f%%, %+.1f%%]", low, high);
+            std::snprintf(line, sizeof(line), "%-26s %-10s %10.3f %10.3f %+7.1f%% %18s %7.3f %s\n",
+                          p == 0 ? b.scenario.c_str() : "", benchmarkPhaseName(p), medianA, medianN, delta, interval, pValue, verdict);
+            out << line;
+        }
+        if (match->checksum != b.checksum) {
+            std::snprintf(line, sizeof(line), "%-26s checksum %.4f -> %.4f, the simulation itself changed\n",
+                          "", b.checksum, match->checksum);
+            out << line;
+        }
+    }
+    for (const BenchmarkSamples& n : next) {
+        if (std::none_of(base.begin(), base.end(), [&](const BenchmarkSamples& s) { return s.scenario == n.scenario; })) {
+            out << n.scenario << ": only in " << newPath << "\n";
+        }
+    }
+    std::snprintf(line, sizeof(line), "\n%d faster, %d slower, %d unchanged (p < %.2f and the interval excludes 0)\n",
+                  faster, slower, same, alpha);
+    out << line;
+    return true;
+}
+
+#endif
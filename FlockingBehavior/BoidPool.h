@@ -0,0 +1,264 @@
+#ifndef CS561_BOID_POOL_H
+#define CS561_BOID_POOL_H
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Flocker.h"
+
+// Slot allocator over an agent list for continuous spawning and despawning.  Despawning only
+// clears the agent's alive flag and pushes its slot on a free list; spawning pops a free slot, so
+// both are O(1) and the list does not reallocate under steady churn.  When too many slots are
+// free, update() compacts the list incrementally, moving a bounded number of agents from the tail
+// into holes each frame, so the flocker keeps iterating a dense array without a frame-time spike.
+// Compaction moves agents between slots; use Boid::id, not the slot, to follow an agent.
+//
+// Agents added, removed or moved by other code are picked up on the next call: the pool rebuilds
+// its free slots when the list changed size or storage, or when agentListGeneration() (Flocker.h)
+// was bumped, which code like WorldChunks does whenever it rewrites the list.
+
+struct BoidPoolStats {
+    int alive = 0;
+    int slots = 0;
+    long long spawned = 0;           // since start
+    long long despawned = 0;
+    int spawnedThisFrame = 0;
+    int despawnedThisFrame = 0;
+    int compactionMoves = 0;         // agents moved by the last update
+    long long reallocations = 0;     // times the agent list had to grow its storage
+};
+
+template <class Traits>
+class BoidPool {
+public:
+    typedef BasicBoid<Traits> Boid;
+    typedef BasicBoidList<Traits> BoidList;
+
+    // Spawns Rate agents per second uniformly inside a sphere
+    struct Emitter {
+        glm::vec3 Center = glm::vec3(0);
+        float Radius = 1.0f;
+        float Rate = 100.0f;
+        glm::vec3 Velocity = glm::vec3(1, 0, 0);
+        float VelocityJitter = 0.5f;
+        float pending = 0;          // fractional agents carried to the next frame
+    };
+
+    // Despawns every agent inside a sphere
+    struct Sink {
+        glm::vec3 Center = glm::vec3(0);
+        float Radius = 1.0f;
+    };
+
+    std::vector<Emitter> Emitters;
+    std::vector<Sink> Sinks;
+    float CompactionThreshold = 0.25f;     // start compacting when this share of the slots is free
+    int CompactionMovesPerFrame = 4096;
+
+    BoidPool() {}
+
+    explicit BoidPool(BoidList* entities) : agents(entities) {
+        resync();
+    }
+
+    void setAgents(BoidList* entities) {
+        agents = entities;
+        resync();
+    }
+
+    void reserve(size_t slots) {
+        checkExternalChanges();
+        agents->reserve(slots);
+        expectedData = agents->data();
+    }
+
+    // Puts an agent in a free slot (or at the end) and returns the slot
+    int spawn(const Boid& boid) {
+        checkExternalChanges();
+        BoidList& list = *agents;
+        stats.spawned++;
+        stats.spawnedThisFrame++;
+        aliveCount++;
+        agentListEdits()++;
+        while (!freeSlots.empty()) {
+            int slot = freeSlots.back();
+            freeSlots.pop_back();
+            // entries can be stale after compaction trimmed the tail or a slot was reused
+            if (slot < static_cast<int>(list.size()) && !list[slot].alive) {
+                list[slot] = boid;
+                list[slot].alive = true;
+                return slot;
+            }
+        }
+        if (list.size() == list.capacity()) {
+            stats.reallocations++;
+        }
+        list.push_back(boid);
+        list.back().alive = true;
+        expectedSize = list.size();
+        expectedData = list.data();
+        return static_cast<int>(list.size()) - 1;
+    }
+
+    void despawn(int slot) {
+        checkExternalChanges();
+        Boid& b = (*agents)[slot];
+        if (!b.alive) {
+            return;
+        }
+        b.alive = false;
+        freeSlots.push_back(slot);
+        aliveCount--;
+        agentListEdits()++;
+        stats.despawned++;
+        stats.despawnedThisFrame++;
+    }
+
+    // Despawns the agents whose ids are in sortedIds with one pass over the slots; returns how many
+    int despawnIds(const std::vector<uint32_t>& sortedIds) {
+        checkExternalChanges();
+        BoidList& list = *agents;
+        int count = 0;
+        for (int slot = 0; slot < static_cast<int>(list.size()); slot++) {
+            if (list[slot].alive && std::binary_search(sortedIds.begin(), sortedIds.end(), list[slot].id)) {
+                despawn(slot);
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // Grows the storage once so that the next count spawns do not reallocate
+    void reserveSpawns(int count) {
+        checkExternalChanges();
+        size_t growth = count > static_cast<int>(freeSlots.size()) ? size_t(count) - freeSlots.size() : 0;
+        if (agents->size() + growth > agents->capacity()) {
+            stats.reallocations++;
+            agents->reserve(agents->size() + growth);
+            expectedData = agents->data();
+        }
+    }
+
+    int alive() const {
+        return aliveCount;
+    }
+
+    // Runs emitters and sinks, then continues compaction; call between flock updates
+    void update(float dt) {
+        checkExternalChanges();
+        stats.spawnedThisFrame = 0;
+        stats.despawnedThisFrame = 0;
+        BoidList& list = *agents;
+
+        if (!Sinks.empty()) {
+            for (int slot = 0; slot < static_cast<int>(list.size()); slot++) {
+                if (!list[slot].alive) {
+                    continue;
+                }
+                glm::vec3 p = Traits::toVec3(list[slot].position);
+                for (const Sink& sink : Sinks) {
+                    if (glm::dot(p - sink.Center, p - sink.Center) <= sink.Radius * sink.Radius) {
+                        despawn(slot);
+                        break;
+                    }
+                }
+            }
+        }
+
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        for (Emitter& emitter : Emitters) {
+            emitter.pending += emitter.Rate * dt;
+            int count = static_cast<int>(emitter.pending);
+            emitter.pending -= float(count);
+            for (int i = 0; i < count; i++) {
+                glm::vec3 offset;
+                do {
+                    offset = glm::vec3(unit(eng), unit(eng), unit(eng));
+                } while (glm::dot(offset, offset) > 1.0f);
+                glm::vec3 jitter(unit(eng), unit(eng), unit(eng));
+                spawn(Boid(Traits::fromVec3(emitter.Center + offset * emitter.Radius),
+                           Traits::fromVec3(emitter.Velocity + jitter * emitter.VelocityJitter)));
+            }
+        }
+
+        stats.compactionMoves = 0;
+        int freeCount = static_cast<int>(list.size()) - aliveCount;
+        if (!compacting && freeCount > CompactionThreshold * float(list.size())) {
+            compacting = true;
+        }
+        if (compacting) {
+            compact(CompactionMovesPerFrame);
+            compacting = static_cast<int>(list.size()) > aliveCount;
+        }
+        stats.alive = aliveCount;
+        stats.slots = static_cast<int>(list.size());
+    }
+
+    const BoidPoolStats& getStats() const {
+        return stats;
+    }
+
+private:
+    BoidList* agents = nullptr;
+    std::vector<int> freeSlots;
+    int aliveCount = 0;
+    size_t expectedSize = 0;            // size, storage and generation of the list as last seen
+    const Boid* expectedData = nullptr;
+    uint64_t expectedGeneration = 0;
+    bool compacting = false;
+    BoidPoolStats stats;
+    std::mt19937 eng;
+
+    void checkExternalChanges() {
+        if (agents->size() != expectedSize || agents->data() != expectedData || agentListGeneration() != expectedGeneration) {
+            resync();
+        }
+    }
+
+    // rebuilds the free list and alive count from the alive flags
+    void resync() {
+        freeSlots.clear();
+        aliveCount = 0;
+        for (int slot = 0; slot < static_cast<int>(agents->size()); slot++) {
+            if ((*agents)[slot].alive) {
+                aliveCount++;
+            }
+            else {
+                freeSlots.push_back(slot);
+            }
+        }
+        expectedSize = agents->size();
+        expectedData = agents->data();
+        expectedGeneration = agentListGeneration();
+    }
+
+    void trimTail() {
+        BoidList& list = *agents;
+        while (!list.empty() && !list.back().alive) {
+            list.pop_back();
+        }
+        expectedSize = list.size();
+    }
+
+    // fills holes with agents from the tail, at most `budget` moves
+    void compact(int budget) {
+        BoidList& list = *agents;
+        trimTail();
+        while (stats.compactionMoves < budget && !freeSlots.empty()) {
+            int hole = freeSlots.back();
+            freeSlots.pop_back();
+            if (hole >= static_cast<int>(list.size()) || list[hole].alive) {
+                continue;
+            }
+            list[hole] = list.back();
+            list.pop_back();
+            stats.compactionMoves++;
+            agentListEdits()++;
+            trimTail();
+        }
+    }
+};
+
+#endif
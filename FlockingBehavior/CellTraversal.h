@@ -0,0 +1,75 @@
+#ifndef CS561_CELL_TRAVERSAL_H
+#define CS561_CELL_TRAVERSAL_H
+
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define FLOCK_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#else
+#define FLOCK_PREFETCH(address) __builtin_prefetch(address)
+#endif
+
+// bits per axis of a voxel coordinate in a Hilbert key (3 * 21 = 63 bits)
+const int HILBERT_BITS = 21;
+
+// Position of a 3D point on a Hilbert curve of 2^bits cells per axis (Skilling, "Programming the
+// Hilbert curve", 2004).  Consecutive keys are face-adjacent cells, so voxels visited in key order
+// share most of their 27-cell neighborhoods with the voxel visited just before.
+inline uint64_t hilbertIndex3D(uint32_t x, uint32_t y, uint32_t z, int bits = HILBERT_BITS) {
+    uint32_t X[3] = { x, y, z };
+    const uint32_t M = 1u << (bits - 1);
+
+    // inverse undo excess work
+    for (uint32_t Q = M; Q > 1; Q >>= 1) {
+        uint32_t P = Q - 1;
+        for (int i = 0; i < 3; i++) {
+            if (X[i] & Q) {
+                X[0] ^= P;
+            }
+            else {
+                uint32_t t = (X[0] ^ X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+
+    // gray encode
+    for (int i = 1; i < 3; i++) {
+        X[i] ^= X[i - 1];
+    }
+    uint32_t t = 0;
+    for (uint32_t Q = M; Q > 1; Q >>= 1) {
+        if (X[2] & Q) {
+            t ^= Q - 1;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        X[i] ^= t;
+    }
+
+    // interleave the transposed form into a single key, most significant bits first
+    uint64_t key = 0;
+    for (int b = bits - 1; b >= 0; b--) {
+        for (int i = 0; i < 3; i++) {
+            key = (key << 1) | ((X[i] >> b) & 1u);
+        }
+    }
+    return key;
+}
+
+// Hilbert key of a (signed) voxel coordinate; far away voxels wrap around, which only affects the
+// visiting order, never the result.
+inline uint64_t hilbertVoxelKey(int x, int y, int z) {
+    const uint32_t offset = 1u << (HILBERT_BITS - 1);
+    const uint32_t mask = (1u << HILBERT_BITS) - 1;
+    return hilbertIndex3D((uint32_t(x) + offset) & mask, (uint32_t(y) + offset) & mask, (uint32_t(z) + offset) & mask);
+}
+
+// index of the neighbor voxel at offset (x, y, z), each in [-1, 1], within a 27-cell neighborhood
+inline int neighborhoodIndex(int x, int y, int z) {
+    return (x + 1) * 9 + (y + 1) * 3 + (z + 1);
+}
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef CS561_COMMAND_QUEUE_H
+#define CS561_COMMAND_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include "BoidPool.h"
+
+// Edits of the running simulation from any thread (UI, scripts, network, emitters).  Producers
+// push whole batches of commands onto a lock-free stack; the simulation takes everything pushed
+// so far with one atomic exchange at the start of a frame and applies it in push order per
+// producer.  Neither side ever waits for the other.
+
+enum class FlockCommandType : uint8_t {
+    SPAWN,          // `count` agents inside a sphere (position, radius), moving at velocity +- jitter
+    DESPAWN,        // agents by Boid::id; unknown ids are ignored
+    MOVE_TARGET,    // first steering target to position
+    SET_OBSTACLE    // obstacle sphere to position, radius
+};
+
+struct FlockCommand {
+    FlockCommandType type = FlockCommandType::MOVE_TARGET;
+    glm::vec3 position = glm::vec3(0);
+    float radius = 1.0f;
+    int count = 0;
+    glm::vec3 velocity = glm::vec3(0);
+    float jitter = 0.0f;
+    std::vector<uint32_t> ids;
+
+    static FlockCommand spawn(int count, const glm::vec3& center, float radius, const glm::vec3& velocity, float jitter) {
+        FlockCommand c;
+        c.type = FlockCommandType::SPAWN;
+        c.count = count;
+        c.position = center;
+        c.radius = radius;
+        c.velocity = velocity;
+        c.jitter = jitter;
+        return c;
+    }
+
+    static FlockCommand despawn(std::vector<uint32_t> agentIds) {
+        FlockCommand c;
+        c.type = FlockCommandType::DESPAWN;
+        c.ids = std::move(agentIds);
+        return c;
+    }
+
+    static FlockCommand moveTarget(const glm::vec3& p) {
+        FlockCommand c;
+        c.type = FlockCommandType::MOVE_TARGET;
+        c.position = p;
+        return c;
+    }
+
+    static FlockCommand setObstacle(const glm::vec3& center, float radius) {
+        FlockCommand c;
+        c.type = FlockCommandType::SET_OBSTACLE;
+        c.position = center;
+        c.radius = radius;
+        return c;
+    }
+};
+
+typedef std::vector<FlockCommand> CommandBatch;
+
+struct CommandStats {
+    int batches = 0;                 // applied in the last frame
+    int commands = 0;
+    int spawned = 0;
+    int despawned = 0;
+    double applyMilliseconds = 0;
+    long long totalCommands = 0;     // since start
+};
+
+// Multi-producer single-consumer queue of command batches
+class CommandQueue {
+public:
+    CommandQueue() {}
+    CommandQueue(const CommandQueue&) = delete;
+    CommandQueue& operator=(const CommandQueue&) = delete;
+
+    ~CommandQueue() {
+        std::vector<CommandBatch> rest;
+        drain(rest);
+    }
+
+    // any thread; lock-free (one compare-and-swap, retried only when another push raced it)
+    void push(CommandBatch batch) {
+        Node* node = new Node{ std::move(batch), nullptr };
+        node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        queued.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // consumer only; appends every batch pushed so far, oldest first, and returns how many
+    size_t drain(std::vector<CommandBatch>& out) {
+        Node* list = head.exchange(nullptr, std::memory_order_acquire);
+        Node* reversed = nullptr;     // the stack holds the newest batch first
+        while (list != nullptr) {
+            Node* next = list->next;
+            list->next = reversed;
+            reversed = list;
+            list = next;
+        }
+        size_t count = 0;
+        while (reversed != nullptr) {
+            Node* next = reversed->next;
+            out.push_back(std::move(reversed->batch));
+            delete reversed;
+            reversed = next;
+            count++;
+        }
+        queued.fetch_sub(static_cast<long long>(count), std::memory_order_relaxed);
+        return count;
+    }
+
+    // batches pushed but not drained yet (approximate while producers run)
+    long long depth() const {
+        return queued.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Node {
+        CommandBatch batch;
+        Node* next;
+    };
+
+    std::atomic<Node*> head{ nullptr };
+    std::atomic<long long> queued{ 0 };
+};
+
+// Applies drained batches to the agents of a pool and to a parameter block (FlockParams), which
+// the caller then publishes.  Despawns of the whole frame are collected and resolved in one pass
+// over the slots, and storage for every spawn is reserved once.
+template <class Traits, class Params>
+CommandStats applyCommands(const std::vector<CommandBatch>& batches, BoidPool<Traits>& pool, Params& params,
+                           std::mt19937& rng, CommandStats stats = CommandStats()) {
+    typedef BasicBoid<Traits> Boid;
+    auto start = std::chrono::steady_clock::now();
+    stats.batches = static_cast<int>(batches.size());
+    stats.commands = stats.spawned = stats.despawned = 0;
+
+    std::vector<uint32_t> doomed;
+    int spawnTotal = 0;
+    for (const CommandBatch& batch : batches) {
+        for (const FlockCommand& c : batch) {
+            stats.commands++;
+            if (c.type == FlockCommandType::DESPAWN) {
+                doomed.insert(doomed.end(), c.ids.begin(), c.ids.end());
+            }
+            else if (c.type == FlockCommandType::SPAWN) {
+                spawnTotal += std::max(c.count, 0);
+            }
+        }
+    }
+    // despawns first, so the spawns of this frame can reuse the freed slots
+    if (!doomed.empty()) {
+        std::sort(doomed.begin(), doomed.end());
+        stats.despawned = pool.despawnIds(doomed);
+    }
+    pool.reserveSpawns(spawnTotal);
+
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    for (const CommandBatch& batch : batches) {
+        for (const FlockCommand& c : batch) {
+            switch (c.type) {
+            case FlockCommandType::SPAWN:
+                for (int i = 0; i < c.count; i++) {
+                    glm::vec3 offset;
+                    do {
+                        offset = glm::vec3(unit(rng), unit(rng), unit(rng));
+                    } while (glm::dot(offset, offset) > 1.0f);
+                    glm::vec3 jitter(unit(rng), unit(rng), unit(rng));
+                    pool.spawn(Boid(Traits::fromVec3(c.position + offset * c.radius),
+                                    Traits::fromVec3(c.velocity + jitter * c.jitter)));
+                }
+                stats.spawned += std::max(c.count, 0);
+                break;
+            case FlockCommandType::MOVE_TARGET:
+                if (params.SteeringTargets.empty()) {
+                    params.SteeringTargets.push_back(Traits::fromVec3(c.position));
+                }
+                params.SteeringTargets[0] = Traits::fromVec3(c.position);
+                break;
+            case FlockCommandType::SET_OBSTACLE:
+                params.CollisionCenter = Traits::fromVec3(c.position);
+                params.CollisionRadius = typename Traits::Scalar(c.radius);
+                break;
+            case FlockCommandType::DESPAWN:
+                break;
+            }
+        }
+    }
+    stats.totalCommands += stats.commands;
+    stats.applyMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+#endif
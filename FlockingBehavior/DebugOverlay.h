@@ -0,0 +1,112 @@
+#ifndef CS561_DEBUG_OVERLAY_H
+#define CS561_DEBUG_OVERLAY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "HugePages.h"
+
+// Instance buffers for the spatial index overlay: occupied voxels with the number of candidates
+// their agents test, the neighbor links of one selected agent and the obstacle avoidance rays.
+// With flock.Overlay set the flocker fills them while it runs the neighbor pass, so nothing is
+// searched again; OverlayRenderer.h uploads them as they are and draws each kind with one
+// instanced call.
+
+struct OverlayBox {
+    glm::vec3 lo, hi;           // world space extent of the voxel
+    float heat;                 // 0 for the coolest to 1 for the hottest voxel of the frame
+};
+
+// what the voxel color stands for; the measured costs need flock.HotCells (HotCells.h)
+enum class OverlayHeat {
+    CANDIDATES,     // agents in the 27 voxel neighborhood
+    PAIR_TESTS,     // candidates actually tested
+    TIME            // neighbor pass time
+};
+
+struct OverlayLine {
+    glm::vec3 from, to;
+    glm::vec3 color;
+};
+
+class DebugOverlay {
+public:
+    bool ShowVoxels = true;
+    bool ShowLinks = true;
+    bool ShowRays = true;
+    uint32_t SelectedId = 0;            // agent whose neighbor links are drawn, 0 for none
+    size_t MaxLines = 1 << 16;          // links and rays beyond this are dropped for the frame
+    OverlayHeat Heat = OverlayHeat::CANDIDATES;
+
+    // called by the flocker before the neighbor pass
+    void beginFrame() {
+        boxes.clear();
+        lines.clear();
+        mostCandidates = 0;
+        dropped = 0;
+    }
+
+    // `candidates` is what one agent of the voxel scans: the agents of its 27 voxel neighborhood
+    void voxel(const glm::vec3& lo, const glm::vec3& hi, int candidates) {
+        OverlayBox box;
+        box.lo = lo;
+        box.hi = hi;
+        box.heat = float(candidates);
+        boxes.push_back(box);
+        mostCandidates = std::max(mostCandidates, candidates);
+    }
+
+    void line(const glm::vec3& from, const glm::vec3& to, const glm::vec3& color) {
+        if (lines.size() >= MaxLines) {
+            dropped++;
+            return;
+        }
+        OverlayLine l;
+        l.from = from;
+        l.to = to;
+        l.color = color;
+        lines.push_back(l);
+    }
+
+    // replaces the candidate count of voxel k (in the order they were added) by a measured cost
+    void reheat(size_t k, float cost) {
+        boxes[k].heat = cost;
+    }
+
+    // after the neighbor pass; scales the heat to [0, 1]
+    void endFrame() {
+        float hottest = 0;
+        for (const OverlayBox& box : boxes) {
+            hottest = std::max(hottest, box.heat);
+        }
+        float scale = hottest > 0 ? 1.0f / hottest : 0.0f;
+        for (OverlayBox& box : boxes) {
+            box.heat *= scale;
+        }
+    }
+
+    const HugeVector<OverlayBox, MemoryTag::DEBUG>& voxels() const {
+        return boxes;
+    }
+
+    const HugeVector<OverlayLine, MemoryTag::DEBUG>& segments() const {
+        return lines;
+    }
+
+    int maxCandidates() const {
+        return mostCandidates;
+    }
+
+    // lines over MaxLines in the last frame
+    long long droppedLines() const {
+        return dropped;
+    }
+
+private:
+    HugeVector<OverlayBox, MemoryTag::DEBUG> boxes;
+    HugeVector<OverlayLine, MemoryTag::DEBUG> lines;
+    int mostCandidates = 0;
+    long long dropped = 0;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef CS561_FIXED_POINT_H
+#define CS561_FIXED_POINT_H
+
+#include <cstdint>
+#include <cmath>
+
+// Signed fixed point number with 16 fractional bits stored in 64 bits.  Every operation is plain
+// integer arithmetic, so results are bit identical across compilers, CPUs and SIMD paths.  Values
+// are meant to stay below about 2^31 in magnitude (products and squares of world coordinates).
+class Fixed {
+public:
+    static const int FRACTION_BITS = 16;
+    static const int64_t ONE = int64_t(1) << FRACTION_BITS;
+
+    int64_t raw;
+
+    Fixed() : raw(0) {}
+    Fixed(int v) : raw(int64_t(v) * ONE) {}
+    explicit Fixed(float v) : raw(int64_t(std::llround(double(v) * double(ONE)))) {}
+    explicit Fixed(double v) : raw(int64_t(std::llround(v * double(ONE)))) {}
+
+    static Fixed fromRaw(int64_t r) {
+        Fixed f;
+        f.raw = r;
+        return f;
+    }
+
+    explicit operator float() const { return float(double(raw) / double(ONE)); }
+    explicit operator double() const { return double(raw) / double(ONE); }
+    explicit operator int() const { return int(raw / ONE); }   // truncates toward zero like float -> int
+
+    Fixed operator-() const { return fromRaw(-raw); }
+    Fixed& operator+=(Fixed o) { raw += o.raw; return *this; }
+    Fixed& operator-=(Fixed o) { raw -= o.raw; return *this; }
+    Fixed& operator*=(Fixed o) { raw = multiplyRaw(raw, o.raw); return *this; }
+    Fixed& operator/=(Fixed o) { raw = divideRaw(raw, o.raw); return *this; }
+
+    // (a * b) >> FRACTION_BITS without a 128-bit intermediate, rounding toward -infinity
+    static int64_t multiplyRaw(int64_t a, int64_t b) {
+        int64_t high = a >> FRACTION_BITS;          // arithmetic shift: floor(a / ONE)
+        int64_t low = a & (ONE - 1);                 // a - high * ONE, in [0, ONE)
+        return high * b + ((low * b) >> FRACTION_BITS);
+    }
+
+    // (a << FRACTION_BITS) / b, rounding toward zero; division by zero saturates
+    static int64_t divideRaw(int64_t a, int64_t b) {
+        if (b == 0) {
+            return a >= 0 ? INT64_MAX : INT64_MIN;
+        }
+        return (a * ONE) / b;
+    }
+};
+
+inline Fixed operator+(Fixed a, Fixed b) { return Fixed::fromRaw(a.raw + b.raw); }
+inline Fixed operator-(Fixed a, Fixed b) { return Fixed::fromRaw(a.raw - b.raw); }
+inline Fixed operator*(Fixed a, Fixed b) { return Fixed::fromRaw(Fixed::multiplyRaw(a.raw, b.raw)); }
+inline Fixed operator/(Fixed a, Fixed b) { return Fixed::fromRaw(Fixed::divideRaw(a.raw, b.raw)); }
+inline bool operator==(Fixed a, Fixed b) { return a.raw == b.raw; }
+inline bool operator!=(Fixed a, Fixed b) { return a.raw != b.raw; }
+inline bool operator<(Fixed a, Fixed b) { return a.raw < b.raw; }
+inline bool operator>(Fixed a, Fixed b) { return a.raw > b.raw; }
+inline bool operator<=(Fixed a, Fixed b) { return a.raw <= b.raw; }
+inline bool operator>=(Fixed a, Fixed b) { return a.raw >= b.raw; }
+
+inline Fixed abs(Fixed a) { return a.raw < 0 ? -a : a; }
+
+// floor(sqrt(n)).  The hardware square root is only a first guess that is then corrected in
+// integer arithmetic, so the result is exact and the same everywhere.
+inline uint64_t integerSqrt(uint64_t n) {
+    uint64_t r = uint64_t(std::sqrt(double(n)));
+    while (r > 0 && (r > UINT32_MAX || r * r > n)) {
+        r--;
+    }
+    while (r < UINT32_MAX && (r + 1) * (r + 1) <= n) {
+        r++;
+    }
+    return r;
+}
+
+// sqrt(raw / ONE) * ONE = sqrt(raw * ONE); negative input returns 0
+inline Fixed sqrt(Fixed a) {
+    if (a.raw <= 0) {
+        return Fixed();
+    }
+    return Fixed::fromRaw(int64_t(integerSqrt(uint64_t(a.raw) << Fixed::FRACTION_BITS)));
+}
+
+const int64_t FIXED_PI_RAW = 205887;          // round(pi * 2^16)
+const int64_t FIXED_TWO_PI_RAW = 411775;
+const int64_t FIXED_HALF_PI_RAW = 102944;
+
+// cos by range reduction to [0, pi / 2] and a Taylor polynomial up to x^10, within 3 * 2^-16 of
+// the true value
+inline Fixed cos(Fixed x) {
+    int64_t r = x.raw % FIXED_TWO_PI_RAW;
+    r = r > FIXED_PI_RAW ? r - FIXED_TWO_PI_RAW : (r < -FIXED_PI_RAW ? r + FIXED_TWO_PI_RAW : r);
+    r = r < 0 ? -r : r;
+    bool negate = r > FIXED_HALF_PI_RAW;       // cos(pi - x) = -cos(x)
+    Fixed t = Fixed::fromRaw(negate ? FIXED_PI_RAW - r : r);
+    Fixed t2 = t * t;
+    Fixed c = Fixed(1) - t2 / Fixed(2) * (Fixed(1) - t2 / Fixed(12) * (Fixed(1) - t2 / Fixed(30) *
+              (Fixed(1) - t2 / Fixed(56) * (Fixed(1) - t2 / Fixed(90)))));
+    return negate ? -c : c;
+}
+
+inline Fixed sin(Fixed x) {
+    return cos(x - Fixed::fromRaw(FIXED_HALF_PI_RAW));
+}
+
+// Three component vector of Fixed, with the handful of glm operations the simulation uses
+struct FixedVec3 {
+    Fixed x, y, z;
+
+    FixedVec3() {}
+    explicit FixedVec3(Fixed s) : x(s), y(s), z(s) {}
+    FixedVec3(Fixed a, Fixed b, Fixed c) : x(a), y(b), z(c) {}
+
+    Fixed& operator[](int i) { return i == 0 ? x : (i == 1 ? y : z); }
+    const Fixed& operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+
+    FixedVec3& operator+=(const FixedVec3& o) { x += o.x; y += o.y; z += o.z; return *this; }
+    FixedVec3& operator-=(const FixedVec3& o) { x -= o.x; y -= o.y; z -= o.z; return *this; }
+    FixedVec3& operator*=(Fixed s) { x *= s; y *= s; z *= s; return *this; }
+    FixedVec3& operator/=(Fixed s) { x /= s; y /= s; z /= s; return *this; }
+};
+
+inline FixedVec3 operator+(const FixedVec3& a, const FixedVec3& b) { return FixedVec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline FixedVec3 operator-(const FixedVec3& a, const FixedVec3& b) { return FixedVec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline FixedVec3 operator-(const FixedVec3& a) { return FixedVec3(-a.x, -a.y, -a.z); }
+inline FixedVec3 operator*(const FixedVec3& a, Fixed s) { return FixedVec3(a.x * s, a.y * s, a.z * s); }
+inline FixedVec3 operator*(Fixed s, const FixedVec3& a) { return FixedVec3(s * a.x, s * a.y, s * a.z); }
+inline FixedVec3 operator/(const FixedVec3& a, Fixed s) { return FixedVec3(a.x / s, a.y / s, a.z / s); }
+inline bool operator==(const FixedVec3& a, const FixedVec3& b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+inline bool operator!=(const FixedVec3& a, const FixedVec3& b) { return !(a == b); }
+
+inline Fixed dot(const FixedVec3& a, const FixedVec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Fixed length2(const FixedVec3& a) { return dot(a, a); }
+inline Fixed length(const FixedVec3& a) { return sqrt(length2(a)); }
+
+inline FixedVec3 cross(const FixedVec3& a, const FixedVec3& b) {
+    return FixedVec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+inline FixedVec3 normalize(const FixedVec3& a) {
+    Fixed len = length(a);
+    return len == Fixed() ? a : a / len;
+}
+
+#endif
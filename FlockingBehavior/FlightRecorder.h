@@ -0,0 +1,586 @@
+#ifndef CS561_FLIGHT_RECORDER_H
+#define CS561_FLIGHT_RECORDER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "HugePages.h"
+
+// Always-on flight recorder for rare frame spikes.  Phases, counters and parameter changes go
+// into per-thread rings (no locks, no allocation, one store per event), overwriting the oldest
+// entries.  When a frame takes longer than FrameBudgetMs, the last WindowSeconds of every ring are
+// written as a Chrome trace (chrome://tracing, Perfetto) together with a checkpoint from which the
+// spike frame itself can be replayed and profiled offline (FlockingBehavior --replay <checkpoint>).
+//
+// The checkpoint is rolling.  With flock.Recorder set, the flocker hands its agents to
+// beforeUpdate() just before it steps them; the recorder copies them every CheckpointFrames
+// frames, and at once when the list was changed outside the flock update (spawning, despawning,
+// paging), and in between only logs each frame's parameters and frame time.  A dump writes the
+// copy and the log, so a replay steps the same agents with the same parameters and time steps
+// from at most CheckpointFrames frames before the spike through the spike frame.  The replay runs
+// the flock alone, so time spent outside the flock update (spawning, paging) only shows in the
+// trace, and its first frame starts with cold neighbor caches.  Files are written on a background
+// thread; the frame that detects the spike only copies the rings and the log.
+
+enum class FlightEventType : uint8_t {
+    PHASE,      // name, start, duration
+    COUNTER,    // name, value
+    PARAM,      // a parameter changed: name, new value
+    FRAME       // a whole frame: start, duration, value = frame number
+};
+
+struct FlightEvent {
+    uint64_t start;        // ns since the recorder was created
+    uint64_t duration;     // ns
+    double value;
+    const char* name;      // must outlive the recorder (string literals, parameter field names)
+    uint32_t thread;
+    FlightEventType type;
+};
+
+// Checkpoint fields of a parameter block (FlockParams, const or not).  Visitor gets
+// (const char* name, T& field) for numbers, booleans and enums.  The custom rule program and
+// the rule plugin settings are not part of a checkpoint.
+template <class Params, class Visitor>
+void visitCheckpointFields(Params& p, Visitor&& visit) {
+    visit("PerceptionRadius", p.PerceptionRadius);
+    visit("SeparationWeight", p.SeparationWeight);
+    visit("SeparationType", p.SeparationType);
+    visit("AlignmentWeight", p.AlignmentWeight);
+    visit("CohesionWeight", p.CohesionWeight);
+    visit("SteeringWeight", p.SteeringWeight);
+    visit("SteeringTargetType", p.SteeringTargetType);
+    visit("InteractionModel", p.InteractionModel);
+    visit("MaxNeighbors", p.MaxNeighbors);
+    visit("WarmStartNeighbors", p.WarmStartNeighbors);
+    visit("HilbertCellOrder", p.HilbertCellOrder);
+    visit("PrefetchCells", p.PrefetchCells);
+    visit("VerletNeighbors", p.VerletNeighbors);
+    visit("VerletSkin", p.VerletSkin);
+    visit("FOVAngleDeg", p.FOVAngleDeg);
+    visit("MaxAcceleration", p.MaxAcceleration);
+    visit("MaxVelocity", p.MaxVelocity);
+    visit("CollisionRadius", p.CollisionRadius);
+    visit("CollisionCenter.x", p.CollisionCenter.x);
+    visit("CollisionCenter.y", p.CollisionCenter.y);
+    visit("CollisionCenter.z", p.CollisionCenter.z);
+    visit("EnableBehaviorStates", p.EnableBehaviorStates);
+    visit("EnableCustomRule", p.EnableCustomRule);
+    visit("FleeDistance", p.StateTransitionSettings.FleeDistance);
+    visit("RestDistance", p.StateTransitionSettings.RestDistance);
+    visit("ForageDistance", p.StateTransitionSettings.ForageDistance);
+    visit("MinStateDuration", p.StateTransitionSettings.MinStateDuration);
+    static const char* const scales[][6] = {
+        { "Flocking.SeparationScale", "Flocking.AlignmentScale", "Flocking.CohesionScale", "Flocking.SteeringScale", "Flocking.FleeWeight", "Flocking.MaxVelocityScale" },
+        { "Fleeing.SeparationScale", "Fleeing.AlignmentScale", "Fleeing.CohesionScale", "Fleeing.SteeringScale", "Fleeing.FleeWeight", "Fleeing.MaxVelocityScale" },
+        { "Resting.SeparationScale", "Resting.AlignmentScale", "Resting.CohesionScale", "Resting.SteeringScale", "Resting.FleeWeight", "Resting.MaxVelocityScale" },
+        { "Foraging.SeparationScale", "Foraging.AlignmentScale", "Foraging.CohesionScale", "Foraging.SteeringScale", "Foraging.FleeWeight", "Foraging.MaxVelocityScale" },
+    };
+    for (size_t s = 0; s < p.StateRuleSet.size() && s < 4; s++) {
+        visit(scales[s][0], p.StateRuleSet[s].SeparationScale);
+        visit(scales[s][1], p.StateRuleSet[s].AlignmentScale);
+        visit(scales[s][2], p.StateRuleSet[s].CohesionScale);
+        visit(scales[s][3], p.StateRuleSet[s].SteeringScale);
+        visit(scales[s][4], p.StateRuleSet[s].FleeWeight);
+        visit(scales[s][5], p.StateRuleSet[s].MaxVelocityScale);
+    }
+}
+
+namespace flight_detail {
+
+template <class T>
+double toDouble(const T& v, std::true_type /*enum*/) {
+    return double(static_cast<int>(v));
+}
+
+template <class T>
+double toDouble(const T& v, std::false_type) {
+    return double(v);
+}
+
+template <class T>
+double toDouble(const T& v) {
+    return toDouble(v, std::is_enum<T>());
+}
+
+template <class T>
+void fromDouble(T& v, double d, std::true_type /*enum*/) {
+    v = static_cast<T>(static_cast<int>(d));
+}
+
+template <class T>
+void fromDouble(T& v, double d, std::false_type) {
+    v = T(d);
+}
+
+inline void fromDouble(bool& v, double d, std::false_type) {
+    v = d != 0;
+}
+
+template <class T>
+void fromDouble(T& v, double d) {
+    fromDouble(v, d, std::is_enum<T>());
+}
+
+const char CHECKPOINT_MAGIC[4] = { 'F', 'L', 'C', 'K' };
+const uint32_t CHECKPOINT_VERSION = 3;
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t agentCount;
+    uint32_t agentBytes;    // sizeof the agent record, to refuse checkpoints of another build
+    uint32_t fieldCount;
+    uint32_t frameCount;    // logged frames, the first one stepping the stored agents
+};
+
+} // namespace flight_detail
+
+// What the flock update of one frame was given
+struct CheckpointFrame {
+    uint32_t frame = 0;
+    float frameTime = 0;             // seconds the frame stepped the flock by
+    std::vector<double> fields;      // parameter values in the order of FlightCheckpoint::fieldNames
+    std::vector<float> targets;      // steering targets, x y z each
+};
+
+// Agents as they were just before the update of the first logged frame, and every frame from
+// there through the spike.  Agents are raw records (the build that replays must match the one
+// that recorded), parameters are stored by name so renamed or new fields keep their defaults.
+struct FlightCheckpoint {
+    std::shared_ptr<const HugeVector<uint8_t, MemoryTag::DEBUG>> agents;   // only when writing
+    uint32_t agentCount = 0;
+    uint32_t agentBytes = 0;
+    std::vector<std::string> fieldNames;
+    std::vector<CheckpointFrame> frames;
+};
+
+inline bool writeCheckpoint(const char* path, const FlightCheckpoint& checkpoint) {
+    using namespace flight_detail;
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    CheckpointHeader header;
+    memcpy(header.magic, CHECKPOINT_MAGIC, 4);
+    header.version = CHECKPOINT_VERSION;
+    header.agentCount = checkpoint.agentCount;
+    header.agentBytes = checkpoint.agentBytes;
+    header.fieldCount = static_cast<uint32_t>(checkpoint.fieldNames.size());
+    header.frameCount = static_cast<uint32_t>(checkpoint.frames.size());
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const std::string& name : checkpoint.fieldNames) {
+        uint8_t length = static_cast<uint8_t>(std::min<size_t>(name.size(), 255));
+        ok = ok && fwrite(&length, 1, 1, file) == 1 && fwrite(name.data(), 1, length, file) == length;
+    }
+    for (const CheckpointFrame& frame : checkpoint.frames) {
+        uint32_t targetCount = static_cast<uint32_t>(frame.targets.size() / 3);
+        ok = ok && frame.fields.size() == checkpoint.fieldNames.size()
+            && fwrite(&frame.frame, sizeof(frame.frame), 1, file) == 1
+            && fwrite(&frame.frameTime, sizeof(frame.frameTime), 1, file) == 1
+            && fwrite(&targetCount, sizeof(targetCount), 1, file) == 1
+            && (frame.fields.empty() || fwrite(frame.fields.data(), sizeof(double), frame.fields.size(), file) == frame.fields.size())
+            && (targetCount == 0 || fwrite(frame.targets.data(), sizeof(float), 3 * targetCount, file) == 3 * targetCount);
+    }
+    size_t bytes = size_t(checkpoint.agentCount) * checkpoint.agentBytes;
+    ok = ok && (bytes == 0 || (checkpoint.agents != nullptr && checkpoint.agents->size() == bytes
+                               && fwrite(checkpoint.agents->data(), 1, bytes, file) == bytes));
+    return fclose(file) == 0 && ok;
+}
+
+// Loads a checkpoint written by writeCheckpoint: the agents into agents, the log into checkpoint
+template <class BoidList>
+bool readCheckpoint(const char* path, BoidList& agents, FlightCheckpoint& checkpoint, std::string& error) {
+    using namespace flight_detail;
+    typedef typename BoidList::value_type Boid;
+    typedef typename Boid::Vec3 Vec3;
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        error = std::string("cannot open ") + path;
+        return false;
+    }
+    std::unique_ptr<FILE, int (*)(FILE*)> closer(file, fclose);
+    CheckpointHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, 4) != 0) {
+        error = "not a flock checkpoint";
+        return false;
+    }
+    if (header.version != CHECKPOINT_VERSION) {
+        error = "checkpoint version " + std::to_string(header.version) + ", expected " + std::to_string(CHECKPOINT_VERSION);
+        return false;
+    }
+    if (header.agentBytes != sizeof(Boid)) {
+        error = "checkpoint of a build with another agent layout";
+        return false;
+    }
+    checkpoint = FlightCheckpoint();
+    checkpoint.agentCount = header.agentCount;
+    checkpoint.agentBytes = header.agentBytes;
+    for (uint32_t f = 0; f < header.fieldCount; f++) {
+        uint8_t length = 0;
+        char name[256];
+        if (fread(&length, 1, 1, file) != 1 || fread(name, 1, length, file) != length) {
+            error = "truncated parameter names";
+            return false;
+        }
+        checkpoint.fieldNames.push_back(std::string(name, length));
+    }
+    for (uint32_t f = 0; f < header.frameCount; f++) {
+        CheckpointFrame frame;
+        uint32_t targetCount = 0;
+        frame.fields.resize(header.fieldCount);
+        bool ok = fread(&frame.frame, sizeof(frame.frame), 1, file) == 1 && fread(&frame.frameTime, sizeof(frame.frameTime), 1, file) == 1
+            && fread(&targetCount, sizeof(targetCount), 1, file) == 1 && targetCount < (1u << 20)
+            && (header.fieldCount == 0 || fread(frame.fields.data(), sizeof(double), header.fieldCount, file) == header.fieldCount);
+        if (ok) {
+            frame.targets.resize(3 * size_t(targetCount));
+            ok = targetCount == 0 || fread(frame.targets.data(), sizeof(float), frame.targets.size(), file) == frame.targets.size();
+        }
+        if (!ok) {
+            error = "truncated frame log";
+            return false;
+        }
+        checkpoint.frames.push_back(std::move(frame));
+    }
+    if (checkpoint.frames.empty()) {
+        error = "checkpoint without frames";
+        return false;
+    }
+    agents.resize(header.agentCount, Boid(Vec3(0), Vec3(0)));
+    if (header.agentCount > 0 && fread(agents.data(), sizeof(Boid), agents.size(), file) != agents.size()) {
+        error = "truncated agents";
+        return false;
+    }
+    return true;
+}
+
+// Sets the parameters a logged frame ran with; params keeps its values for fields the file lacks
+template <class Params>
+void applyCheckpointFrame(const FlightCheckpoint& checkpoint, const CheckpointFrame& frame, Params& params) {
+    for (size_t f = 0; f < checkpoint.fieldNames.size() && f < frame.fields.size(); f++) {
+        const char* name = checkpoint.fieldNames[f].c_str();
+        visitCheckpointFields(params, [&](const char* field, auto& target) {
+            if (strcmp(field, name) == 0) {
+                flight_detail::fromDouble(target, frame.fields[f]);
+            }
+        });
+    }
+    params.SteeringTargets.clear();
+    for (size_t t = 0; t + 2 < frame.targets.size(); t += 3) {
+        params.SteeringTargets.push_back(typename Params::Vec3(frame.targets[t], frame.targets[t + 1], frame.targets[t + 2]));
+    }
+}
+
+struct FlightRecorderStats {
+    int threads = 0;
+    long long events = 0;            // recorded since start, all threads
+    int spikes = 0;                  // frames over budget
+    int dumps = 0;                   // trace + checkpoint pairs written
+    double worstFrameMs = 0;
+    std::string lastDump;            // trace file of the last dump
+};
+
+class FlightRecorder {
+public:
+    double FrameBudgetMs = 50.0;     // frames slower than this are dumped
+    double WindowSeconds = 3.0;      // history in a dump
+    std::string DumpPrefix = "spike";   // files are <prefix>_<frame>.trace.json and .checkpoint
+    int MaxDumps = 8;                // 0 for no limit
+    bool DumpSpikes = true;          // off: events are still recorded, spikes are not written
+    int CheckpointFrames = 30;       // the agents are copied at least this often; a replay runs up to this many frames
+
+    static const size_t RING_SIZE = 1 << 15;    // events per thread
+
+    FlightRecorder() : id(nextRecorderId()), origin(std::chrono::steady_clock::now()) {}
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    ~FlightRecorder() {
+        if (writer.joinable()) {
+            writer.join();
+        }
+    }
+
+    uint64_t now() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count());
+    }
+
+    // any thread
+    void phase(const char* name, uint64_t start, uint64_t end) {
+        record(FlightEventType::PHASE, name, start, end - start, 0);
+    }
+
+    void counter(const char* name, double value) {
+        record(FlightEventType::COUNTER, name, now(), 0, value);
+    }
+
+    // Times a scope as one phase
+    class Scope {
+    public:
+        Scope(FlightRecorder* r, const char* n) : recorder(r), name(n), start(r != nullptr ? r->now() : 0) {}
+        ~Scope() {
+            if (recorder != nullptr) {
+                recorder->phase(name, start, recorder->now());
+            }
+        }
+    private:
+        FlightRecorder* recorder;
+        const char* name;
+        uint64_t start;
+    };
+
+    // Simulation thread, before anything of the frame runs: records which parameters changed since
+    // the last frame
+    template <class Params>
+    void beginFrame(uint32_t frame, const Params& params) {
+        frameNumber = frame;
+        frameStart = now();
+        size_t index = 0;
+        visitCheckpointFields(params, [&](const char* name, const auto& value) {
+            double v = flight_detail::toDouble(value);
+            if (index >= fieldValues.size()) {
+                fieldValues.push_back(v);
+            }
+            else if (fieldValues[index] != v) {
+                fieldValues[index] = v;
+                record(FlightEventType::PARAM, name, frameStart, 0, v);
+            }
+            index++;
+        });
+    }
+
+    // Simulation thread, called by the flocker just before it steps the agents: refreshes the
+    // rolling checkpoint when it is CheckpointFrames old or agentsChanged (the list was changed
+    // outside the flock update since the last one), then logs what this frame's update is given
+    template <class BoidList, class Params>
+    void beforeUpdate(const BoidList& agents, const Params& params, float frameTime, bool agentsChanged) {
+        typedef typename BoidList::value_type Boid;
+        if (fieldNames.empty()) {
+            visitCheckpointFields(params, [&](const char* name, const auto&) { fieldNames.push_back(name); });
+        }
+        if (agentCopy == nullptr || agentsChanged || loggedFrames >= size_t(std::max(CheckpointFrames, 1))) {
+            if (agentCopy == nullptr || agentCopy.use_count() > 1) {
+                agentCopy = std::make_shared<HugeVector<uint8_t, MemoryTag::DEBUG>>();   // the old one is being written
+            }
+            const uint8_t* records = reinterpret_cast<const uint8_t*>(agents.data());
+            agentCopy->assign(records, records + agents.size() * sizeof(Boid));
+            agentCount = static_cast<uint32_t>(agents.size());
+            agentBytes = static_cast<uint32_t>(sizeof(Boid));
+            loggedFrames = 0;
+        }
+        if (loggedFrames == log.size()) {
+            log.emplace_back();
+        }
+        CheckpointFrame& logged = log[loggedFrames++];
+        logged.frame = frameNumber;
+        logged.frameTime = frameTime;
+        logged.fields.clear();
+        visitCheckpointFields(params, [&](const char*, const auto& value) { logged.fields.push_back(flight_detail::toDouble(value)); });
+        logged.targets.clear();
+        for (const auto& target : params.SteeringTargets) {
+            logged.targets.push_back(float(target.x));
+            logged.targets.push_back(float(target.y));
+            logged.targets.push_back(float(target.z));
+        }
+    }
+
+    // Simulation thread, at the end of the frame: true when the frame was over budget and a dump
+    // of the trace and of the rolling checkpoint was started
+    bool endFrame() {
+        uint64_t end = now();
+        record(FlightEventType::FRAME, "frame", frameStart, end - frameStart, frameNumber);
+        double ms = double(end - frameStart) * 1e-6;
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.worstFrameMs = std::max(stats.worstFrameMs, ms);
+        if (!DumpSpikes || ms <= FrameBudgetMs) {
+            return false;
+        }
+        stats.spikes++;
+        if ((MaxDumps > 0 && stats.dumps >= MaxDumps) || writing.load()) {
+            return false;
+        }
+        stats.dumps++;
+        startDump(end);
+        return true;
+    }
+
+    FlightRecorderStats getStats() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        FlightRecorderStats s = stats;
+        std::lock_guard<std::mutex> ringLock(ringsMutex);
+        s.threads = static_cast<int>(rings.size());
+        for (const auto& ring : rings) {
+            s.events += static_cast<long long>(ring->head.load(std::memory_order_relaxed));
+        }
+        return s;
+    }
+
+private:
+    typedef HugeVector<FlightEvent, MemoryTag::DEBUG> Events;
+
+    struct Ring {
+        Events events = Events(RING_SIZE);
+        std::atomic<uint64_t> head{ 0 };
+        uint32_t thread = 0;
+        std::thread::id owner = std::this_thread::get_id();
+    };
+
+    // never reused, unlike the address of a destroyed recorder
+    static uint64_t nextRecorderId() {
+        static std::atomic<uint64_t> next(1);
+        return next++;
+    }
+
+    const uint64_t id;
+
+    std::chrono::steady_clock::time_point origin;
+    mutable std::mutex ringsMutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::vector<double> fieldValues;        // checkpoint fields of the last frame
+    std::vector<std::string> fieldNames;    // of the frame log, in visitCheckpointFields order
+    std::shared_ptr<HugeVector<uint8_t, MemoryTag::DEBUG>> agentCopy;   // raw agents of the rolling checkpoint
+    uint32_t agentCount = 0;
+    uint32_t agentBytes = 0;
+    std::vector<CheckpointFrame> log;       // frames since the copy; entries past loggedFrames are spare
+    size_t loggedFrames = 0;
+    uint32_t frameNumber = 0;
+    uint64_t frameStart = 0;
+    mutable std::mutex statsMutex;
+    FlightRecorderStats stats;
+    std::thread writer;
+    std::atomic<bool> writing{ false };
+
+    // The calling thread's ring; registered on first use.  The thread caches the ring of the last
+    // recorder it wrote to by recorder id, so switching recorders finds the thread's existing ring
+    // and a recorder allocated where a destroyed one was never gets the old ring.
+    Ring& threadRing() {
+        struct Cached {
+            uint64_t owner = 0;
+            Ring* ring = nullptr;
+        };
+        thread_local Cached cached;
+        if (cached.owner != id) {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            std::thread::id self = std::this_thread::get_id();
+            auto found = std::find_if(rings.begin(), rings.end(), [&](const std::unique_ptr<Ring>& r) { return r->owner == self; });
+            if (found == rings.end()) {
+                rings.emplace_back(new Ring());
+                rings.back()->thread = static_cast<uint32_t>(rings.size());
+                found = rings.end() - 1;
+            }
+            cached.owner = id;
+            cached.ring = found->get();
+        }
+        return *cached.ring;
+    }
+
+    void record(FlightEventType type, const char* name, uint64_t start, uint64_t duration, double value) {
+        Ring& ring = threadRing();
+        uint64_t h = ring.head.load(std::memory_order_relaxed);
+        FlightEvent& e = ring.events[h & (RING_SIZE - 1)];
+        e.start = start;
+        e.duration = duration;
+        e.value = value;
+        e.name = name;
+        e.thread = ring.thread;
+        e.type = type;
+        ring.head.store(h + 1, std::memory_order_release);
+    }
+
+    // Copies the rings (entries a writer may have overwritten meanwhile are dropped) and the frame
+    // log, shares the agent copy, then writes both files on the writer thread
+    void startDump(uint64_t end) {
+        uint64_t since = end > uint64_t(WindowSeconds * 1e9) ? end - uint64_t(WindowSeconds * 1e9) : 0;
+        std::shared_ptr<Events> copy = std::make_shared<Events>();
+        Events& events = *copy;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (const auto& ring : rings) {
+                uint64_t head = ring->head.load(std::memory_order_acquire);
+                uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+                size_t copied = events.size();
+                for (uint64_t i = first; i < head; i++) {
+                    events.push_back(ring->events[i & (RING_SIZE - 1)]);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint64_t after = ring->head.load(std::memory_order_relaxed);
+                uint64_t safe = after > RING_SIZE ? after - RING_SIZE : 0;
+                size_t overwritten = static_cast<size_t>(safe > first ? std::min(safe - first, head - first) : 0);
+                events.erase(events.begin() + copied, events.begin() + copied + overwritten);
+            }
+        }
+        events.erase(std::remove_if(events.begin(), events.end(),
+            [&](const FlightEvent& e) { return e.start + e.duration < since; }), events.end());
+
+        std::string base = DumpPrefix + "_" + std::to_string(frameNumber);
+        std::string trace = base + ".trace.json";
+        std::string checkpoint = agentCopy != nullptr ? base + ".checkpoint" : std::string();
+        stats.lastDump = trace;
+        if (writer.joinable()) {
+            writer.join();
+        }
+        writing = true;
+        std::shared_ptr<FlightCheckpoint> state = std::make_shared<FlightCheckpoint>();
+        state->agents = agentCopy;
+        state->agentCount = agentCount;
+        state->agentBytes = agentBytes;
+        state->fieldNames = fieldNames;
+        state->frames.assign(log.begin(), log.begin() + loggedFrames);
+        uint32_t number = frameNumber;
+        double budget = FrameBudgetMs;
+        writer = std::thread([this, copy, state, trace, checkpoint, number, budget]() {
+            writeTrace(trace.c_str(), *copy, number, budget, checkpoint);
+            if (!checkpoint.empty()) {
+                writeCheckpoint(checkpoint.c_str(), *state);
+            }
+            writing = false;
+        });
+    }
+
+    static void writeTrace(const char* path, const Events& events, uint32_t frame, double budget,
+                           const std::string& checkpoint) {
+        FILE* file = fopen(path, "w");
+        if (file == nullptr) {
+            return;
+        }
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"spikeFrame\":%u,\"budgetMs\":%g,\"checkpoint\":\"%s\"},\n\"traceEvents\":[\n",
+                frame, budget, checkpoint.c_str());
+        bool first = true;
+        for (const FlightEvent& e : events) {
+            double ts = double(e.start) * 1e-3;    // microseconds
+            fprintf(file, first ? " " : ",");
+            first = false;
+            switch (e.type) {
+            case FlightEventType::PHASE:
+                fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}\n",
+                        e.name, ts, double(e.duration) * 1e-3, e.thread);
+                break;
+            case FlightEventType::FRAME:
+                fprintf(file, "{\"name\":\"frame %.0f\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}\n",
+                        e.value, ts, double(e.duration) * 1e-3, e.thread);
+                break;
+            case FlightEventType::COUNTER:
+                fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"value\":%.9g}}\n",
+                        e.name, ts, e.value);
+                break;
+            case FlightEventType::PARAM:
+                fprintf(file, "{\"name\":\"%s = %.9g\",\"cat\":\"param\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}\n",
+                        e.name, e.value, ts, e.thread);
+                break;
+            }
+        }
+        fprintf(file, "]}\n");
+        fclose(file);
+    }
+};
+
+#endif
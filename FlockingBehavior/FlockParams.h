@@ -0,0 +1,162 @@
+#ifndef CS561_FLOCK_PARAMS_H
+#define CS561_FLOCK_PARAMS_H
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include "BehaviorStates.h"
+#include "VisualNeighbors.h"
+#include "RuleVM.h"
+
+enum class DistanceType {
+    LINEAR, INVERSE_LINEAR, QUADRATIC, INVERSE_QUADRATIC
+};
+
+// Every tunable of the flocker in one block.  The flocker never runs on a block that can still
+// change: writers (UI sliders, scripts) publish a new copy through a SnapshotCell and the flocker
+// takes the latest one once, at the start of a frame, so all agents and all worker threads of a
+// frame see the same values and the hot loop reads them without locks.
+template <class Traits, class... ExtraRules>
+struct FlockParams {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+
+    // Perception refers to the vision of each boid.  Only boids within this distance influence each other.
+    Scalar PerceptionRadius = Scalar(30);
+
+    // How much boids repel each other
+    Scalar SeparationWeight = Scalar(3.5);
+    DistanceType SeparationType = DistanceType::INVERSE_QUADRATIC;
+
+    Scalar AlignmentWeight = Scalar(0.1);
+    Scalar CohesionWeight = Scalar(1);
+
+    Scalar SteeringWeight = Scalar(4.0);
+    std::vector<Vec3> SteeringTargets;
+    DistanceType SteeringTargetType = DistanceType::LINEAR;
+
+    // interact with everyone in range, or only with the nearest agent seen in each direction
+    NeighborModel InteractionModel = NeighborModel::RADIUS;
+
+    // with the radius model, only interact with the k nearest agents in range (0 = no limit)
+    int MaxNeighbors = 0;
+
+    // seed each query with the agent's neighbors from the previous frame
+    bool WarmStartNeighbors = true;
+
+    // visit voxels along a Hilbert curve instead of hash order, prefetching the next voxel's buckets
+    bool HilbertCellOrder = true;
+    bool PrefetchCells = true;
+
+    // Verlet mode: cache every agent's candidates within PerceptionRadius + VerletSkin in
+    // compressed lists (see NeighborLists.h) and query only those until some agent has moved
+    // more than half the skin.  The grid then uses voxels of PerceptionRadius + VerletSkin.
+    bool VerletNeighbors = false;
+    Scalar VerletSkin = Scalar(2);
+
+    // field of view of our agent in degrees
+    Scalar FOVAngleDeg = Scalar(20);
+    Scalar MaxAcceleration = Scalar(5);
+    Scalar MaxVelocity = Scalar(5);
+
+    // sphere to avoid collision with
+    Scalar CollisionRadius = Scalar(1.0f);
+    Vec3 CollisionCenter;
+
+    // behavior state machine (flocking, fleeing, resting, foraging); off means everyone flocks
+    bool EnableBehaviorStates = false;
+    std::array<StateRules, BOID_STATE_COUNT> StateRuleSet = defaultStateRules();
+    StateTransitions StateTransitionSettings;
+
+    // extra force from a rule compiled at runtime (see RuleVM.h), added before the acceleration clamp
+    bool EnableCustomRule = false;
+    RuleProgram CustomRule;
+
+    // settings of the extra rule plugins; copied for every agent before its neighbors are fed in
+    std::tuple<ExtraRules...> ExtraRuleSet;
+};
+
+// Latest published copy of a value.  Writers publish a fresh immutable block with an atomic
+// pointer swap (writers are serialized among themselves); the one reader takes the newest block
+// with acquire() and may use it until its next acquire().  Replaced blocks are freed by later
+// writers once the reader no longer holds them (a single hazard pointer), so acquire() never
+// blocks and never allocates.
+template <class T>
+class SnapshotCell {
+public:
+    explicit SnapshotCell(const T& initial = T()) : latest(new T(initial)) {}
+
+    SnapshotCell(const SnapshotCell&) = delete;
+    SnapshotCell& operator=(const SnapshotCell&) = delete;
+
+    ~SnapshotCell() {
+        delete latest.load();
+        for (const T* block : retired) {
+            delete block;
+        }
+    }
+
+    void publish(const T& value) {
+        T* block = new T(value);
+        std::lock_guard<std::mutex> lock(writers);
+        swapIn(block);
+    }
+
+    // read-modify-write of the latest value, atomic with respect to other writers
+    template <class Edit>
+    void edit(Edit edit) {
+        std::lock_guard<std::mutex> lock(writers);
+        T* block = new T(*latest.load());
+        edit(*block);
+        swapIn(block);
+    }
+
+    T get() const {
+        std::lock_guard<std::mutex> lock(writers);
+        return *latest.load();
+    }
+
+    // Reader side: the newest block, valid until the next acquire()
+    const T* acquire() {
+        const T* block = latest.load();
+        for (;;) {
+            reading.store(block);
+            const T* check = latest.load();
+            if (check == block) {
+                return block;
+            }
+            block = check;
+        }
+    }
+
+    long long version() const {
+        return published.load();
+    }
+
+private:
+    std::atomic<const T*> latest;
+    std::atomic<const T*> reading{ nullptr };     // block the reader may be using
+    std::atomic<long long> published{ 0 };
+    mutable std::mutex writers;
+    std::vector<const T*> retired;                // replaced blocks, guarded by writers
+
+    void swapIn(T* block) {
+        retired.push_back(latest.exchange(block));
+        published++;
+        const T* inUse = reading.load();
+        size_t kept = 0;
+        for (const T* old : retired) {
+            if (old == inUse) {
+                retired[kept++] = old;
+            }
+            else {
+                delete old;
+            }
+        }
+        retired.resize(kept);
+    }
+};
+
+#endif
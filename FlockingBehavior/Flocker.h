@@ -4,19 +4,32 @@
 #include <vector>
 #include <unordered_map>
 #include <random>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
 #include <glm/glm.hpp>
 #include <glm/gtx/norm.hpp>
+#include "BehaviorStates.h"
+#include "VisualNeighbors.h"
+#include "CellTraversal.h"
+#include "HugePages.h"
+#include "RuleVM.h"
+#include "RulePlugins.h"
+#include "ProximityEvents.h"
+#include "NeighborLists.h"
+#include "PerfCounters.h"
+#include "ForceBreakdown.h"
+#include "DebugOverlay.h"
+#include "HotCells.h"
+#include "FlightRecorder.h"
+#include "FlockParams.h"
+#include "ScalarTraits.h"
 
-# define TWO_PI 6.28318530717958647692
-
-enum class DistanceType {
-    LINEAR, INVERSE_LINEAR, QUADRATIC, INVERSE_QUADRATIC
-};
-
-glm::vec3 clampLength(glm::vec3 v, float length) {
-    float len = glm::length(v);
-    if (len > length) {
-        return glm::normalize(v) * length;
+template <class Vec3, class Scalar>
+Vec3 clampLength(Vec3 v, Scalar maxLength) {
+    Scalar len = length(v);
+    if (len > maxLength) {
+        return normalize(v) * maxLength;
     }
     return v;
 }
@@ -32,33 +45,69 @@ inline double random_double(double min, double max) {
     return min + (max - min) * random_double();
 }
 
-glm::vec3 getRandomUniform(std::mt19937& engine) {
-    std::uniform_real_distribution<float> thetaRange(0.0f, TWO_PI);
-    std::uniform_real_distribution<float> oneRange(0, 1);
-    float theta = thetaRange(engine);
-    float r = sqrt(oneRange(engine));
-    float z = sqrt(1.0f - r * r) * (oneRange(engine) > 0.5f ? -1.0f : 1.0f);
-    return glm::vec3(r * cos(theta), r * sin(theta), z);
+// process wide agent identity, kept when an agent is copied or moved to another slot
+inline uint32_t nextBoidId() {
+    static std::atomic<uint32_t> next(1);
+    return next++;
 }
 
-struct Boid {
-    glm::vec3 position,
-              velocity,
-              acceleration,
-              motion_normal = glm::vec3(0, 0, 1); // normal to plane of motion
+template <class Traits>
+struct BasicBoid {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    Vec3 position,
+         velocity,
+         acceleration,
+         motion_normal = Vec3(0, 0, 1); // normal to plane of motion
     float size = 1.0f;
     bool avoidance = false;
-    explicit Boid(glm::vec3 pos, glm::vec3 vel) : position(pos), velocity(vel), acceleration(glm::vec3(0)) {}
+    BoidState state = BoidState::FLOCKING;
+    Scalar stateTime = Scalar(0);   // seconds spent in the current state
+    bool alive = true;        // false for free slots of a BoidPool; dead agents are skipped everywhere
+    uint32_t id = nextBoidId();
+    explicit BasicBoid(Vec3 pos, Vec3 vel) : position(pos), velocity(vel), acceleration(Vec3(0)) {}
 };
 
+typedef BasicBoid<FloatTraits> Boid;
 
+// Per frame counters of the neighbor queries
+struct NeighborStats {
+    int queries = 0;
+    long long candidates = 0;        // agents run through the full distance / field of view test
+    long long culled = 0;            // candidates rejected early by the k-nearest distance bound
+    long long skippedVoxels = 0;     // neighbor voxels skipped entirely by the k-nearest distance bound
+    long long warmCandidates = 0;    // last frame's neighbors tested before the grid scan
+    long long confirmed = 0;         // neighbors that were already neighbors last frame
+    long long discovered = 0;        // neighbors that are new this frame
+    double passMilliseconds = 0;     // neighbor queries plus rule evaluation for the whole flock
 
-struct NearbyBoid {
-    Boid* boid;
-    glm::vec3 direction;
-    float distance;
+    // share of this frame's neighbors that were already known from the previous frame
+    float hitRate() const {
+        long long found = confirmed + discovered;
+        return found > 0 ? float(confirmed) / float(found) : 0.0f;
+    }
 };
 
+// agent storage; large flocks are backed by huge pages where available
+template <class Traits>
+using BasicBoidList = HugeVector<BasicBoid<Traits>, MemoryTag::BOIDS>;
+
+typedef BasicBoidList<FloatTraits> BoidList;
+
+// Bumped by code that adds, removes or moves agents of a list it shares with a BoidPool (paging,
+// loading a checkpoint into a live list), so the pool rebuilds its free slots before the next use
+inline std::atomic<uint64_t>& agentListGeneration() {
+    static std::atomic<uint64_t> generation(0);
+    return generation;
+}
+
+// Bumped by code that spawns, despawns or moves agents in place between flock updates (BoidPool),
+// so the flocker can tell its flight recorder that the list changed outside the update
+inline std::atomic<uint64_t>& agentListEdits() {
+    static std::atomic<uint64_t> edits(0);
+    return edits;
+}
+
 struct Vec3Hasher {
     typedef std::size_t result_type;
 
@@ -70,78 +119,349 @@ struct Vec3Hasher {
     }
 };
 
-class Flocker {
+// The simulation core, for any scalar / vector type pair described by a traits class
+// (see ScalarTraits.h).  ExtraRules are rule plugins (see RulePlugins.h) fused into the neighbor
+// loop after the built-in rules.  Flocker is the float instantiation used by the viewer.
+template <class Traits, class... ExtraRules>
+class BasicFlocker {
 public:
-    // Perception refers to the vision of each boid.  Only boids within this distance influence each other.
-    float PerceptionRadius = 30;
-    
-    // How much boids repel each other
-    float SeparationWeight = 3.5;
-    DistanceType SeparationType = DistanceType::INVERSE_QUADRATIC;
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    typedef BasicBoid<Traits> Boid;
+    typedef BasicBoidList<Traits> BoidList;
 
-    float AlignmentWeight = 0.1;
-    float CohesionWeight = 1;
+    struct NearbyBoid {
+        Boid* boid;
+        Vec3 direction;
+        Scalar distance;
+    };
+    typedef HugeVector<NearbyBoid, MemoryTag::NEIGHBORS> NearbyList;
 
-    float SteeringWeight = 4.0;
-    std::vector<glm::vec3> SteeringTargets;
-    DistanceType SteeringTargetType = DistanceType::LINEAR;
+    typedef HugeVector<Boid*, MemoryTag::VOXEL_MAP> VoxelBucket;
+    typedef HugeVector<int, MemoryTag::NEIGHBORS> NeighborIdList;
 
-    // field of view of our agent in degrees
-    float FOVAngleDeg = 20;
-    float MaxAcceleration = 5;
-    float MaxVelocity = 5;
+    // An occupied voxel together with the buckets of its 27-voxel neighborhood, looked up once per
+    // voxel instead of once per agent
+    struct VoxelCell {
+        glm::vec3 voxelPos;
+        const VoxelBucket* members;
+        const VoxelBucket* neighbors[27];   // indexed by neighborhoodIndex(), nullptr for empty voxels
+    };
 
-    // sphere to avoid collision with
-    float CollisionRadius = 1.0f;
-    glm::vec3 CollisionCenter;
+    // all tunables, see FlockParams.h
+    typedef FlockParams<Traits, ExtraRules...> Params;
 
-    Flocker() {}
+    // neighbor and trigger enter / exit events (see ProximityEvents.h); not owned
+    ProximityTracker* Proximity = nullptr;
+    // hardware counters per phase (PerfCounters.h), opened on the thread that runs update()
+    PerfCounters* Counters = nullptr;
+    // always-on phase history and rolling checkpoint for spike dumps (FlightRecorder.h)
+    FlightRecorder* Recorder = nullptr;
+    // per agent rule contributions of the last update (ForceBreakdown.h); not owned
+    BasicForceBreakdown<Traits>* Forces = nullptr;
+    // voxels, neighbor links and avoidance rays for the debug overlay (DebugOverlay.h); not owned
+    DebugOverlay* Overlay = nullptr;
+    // pair tests and time per voxel of the neighbor pass (HotCells.h); not owned
+    HotCellProfile* HotCells = nullptr;
 
-    explicit Flocker(std::vector<Boid> *entities) : boids(entities) {
+    BasicFlocker() {
         std::random_device rd;
         eng = std::mt19937(rd());
+        params = paramCell.acquire();
+    }
+
+    explicit BasicFlocker(BoidList *entities) : BasicFlocker() {
+        boids = entities;
+    }
+
+    void setAgents(BoidList* entities) {
+        boids = entities;
+    }
+
+    // Publishes a new parameter block; callable from any thread, picked up by the next frame
+    void setParams(const Params& p) {
+        paramCell.publish(p);
+    }
+
+    // Copies the latest parameters, lets f change them and publishes the result, atomically with
+    // respect to other writers:  flock.editParams([](auto& p) { p.MaxNeighbors = 7; });
+    template <class Edit>
+    void editParams(Edit edit) {
+        paramCell.edit(edit);
+    }
+
+    // copy of the latest published parameters
+    Params getParams() const {
+        return paramCell.get();
+    }
+
+    // the snapshot the current frame runs with; read by rule plugins and worker threads
+    const Params& frameParams() const {
+        return *params;
+    }
+
+    // makes the random directions given to agents on top of each other reproducible
+    void seed(uint32_t value) {
+        eng.seed(value);
     }
 
-    void update(float dt) {
-        const float RESPONSE = 0.1f;
+    void update(float frameTime) {
+        const Scalar RESPONSE = Scalar(0.1f);
+        const Scalar dt = Scalar(frameTime);
 
-        FOVAngleDegCompareValue = cosf(TWO_PI * FOVAngleDeg / 360.0f);
-        updateAcceleration();
+        beginFrame();
+        if (Recorder != nullptr) {
+            Recorder->beforeUpdate(*boids, *params, frameTime, agentListChanged());
+        }
+        updateStates(dt);
+        computeAccelerations();
 
+        beginPhase(PerfPhase::INTEGRATE);
         for (auto &boid : *boids) {
-            glm::vec3 target = avoidanceDirection(boid);
-            if (glm::length(target) > 0.001f && boid.avoidance) {
-                boid.velocity += dt * (glm::length(boid.velocity) * target - boid.velocity) / RESPONSE;
+            if (!boid.alive) {
+                continue;
             }
-            boid.velocity = clampLength(boid.velocity + boid.acceleration * dt, MaxVelocity);
+            Vec3 target = avoidanceDirection(boid);
+            if (length(target) > Scalar(0.001f) && boid.avoidance) {
+                if (Overlay != nullptr && Overlay->ShowRays) {
+                    overlayAvoidance(boid, target);
+                }
+                if (FLOCK_FORCE_BREAKDOWN && Forces != nullptr) {
+                    Forces->at(ForceComponent::AVOIDANCE, &boid - boids->data()) = (length(boid.velocity) * target - boid.velocity) / RESPONSE;
+                }
+                boid.velocity += dt * (length(boid.velocity) * target - boid.velocity) / RESPONSE;
+            }
+            Scalar maxVelocity = params->MaxVelocity * Scalar(params->StateRuleSet[static_cast<int>(boid.state)].MaxVelocityScale);
+            boid.velocity = clampLength(boid.velocity + boid.acceleration * dt, maxVelocity);
             boid.position += boid.velocity * dt;
-            if (glm::length2(boid.position - CollisionCenter) < CollisionRadius * CollisionRadius) {
-                boid.velocity += 0.1f * boid.position - CollisionCenter;
+            if (length2(boid.position - params->CollisionCenter) < params->CollisionRadius * params->CollisionRadius) {
+                boid.velocity += Scalar(0.1f) * boid.position - params->CollisionCenter;
             }
         }
+        endPhase(PerfPhase::INTEGRATE);
+        updatedSize = boids->size();
+        updatedData = boids->data();
+        updatedGeneration = agentListGeneration();
+        updatedEdits = agentListEdits();
     }
 
     void updateAcceleration() {
-        if (PerceptionRadius == 0) {
-            PerceptionRadius = 1;
-        }
+        beginFrame();
+        computeAccelerations();
+    }
+
+    // Takes the latest parameter snapshot for the whole frame and derives the per frame values
+    void beginFrame() {
+        using std::abs;
+        params = paramCell.acquire();
+        perceptionRadius = params->PerceptionRadius == Scalar(0) ? Scalar(1) : params->PerceptionRadius;
+        voxelSize = params->VerletNeighbors ? abs(perceptionRadius) + abs(params->VerletSkin) : abs(perceptionRadius);
+        FOVAngleDegCompareValue = Traits::cosDegrees(params->FOVAngleDeg);
+    }
+
+    void computeAccelerations() {
+        beginPhase(PerfPhase::GRID);
         buildVoxelCache();
+        updateVerletLists();
+        endPhase(PerfPhase::GRID);
+        if (Proximity != nullptr) {
+            Proximity->beginFrame(*boids);
+            reportTriggers();
+        }
+        neighborStats = NeighborStats();
+        neighborIds.resize(boids->size());
+        seenStamps.resize(boids->size(), 0);
+        if (FLOCK_FORCE_BREAKDOWN && Forces != nullptr) {
+            Forces->reset(boids->size());
+        }
+        if (Overlay != nullptr) {
+            Overlay->beginFrame();
+            if (Overlay->ShowVoxels) {
+                overlayVoxels();
+            }
+        }
+        customRuleActive = params->EnableCustomRule && params->CustomRule.valid;
+        if (customRuleActive) {
+            ruleVM.bind(params->CustomRule);
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (HotCells != nullptr) {
+            HotCells->beginFrame(cells.size());
+            for (size_t k = 0; k < cells.size(); k++) {
+                HotCells->cell(k).voxel = cells[k].voxelPos;
+                HotCells->cell(k).occupancy = static_cast<int>(cells[k].members->size());
+            }
+            chargeHotCell(-1);
+        }
+        beginPhase(PerfPhase::NEIGHBORS);
+        // one contiguous batch per state, so the kernel runs with fixed rule weights per batch;
+        // inside a batch agents keep the voxel traversal order
+        stateBatches.build(*boids, traversal);
+        for (int s = 0; s < BOID_STATE_COUNT; s++) {
+            const StateRules& rules = params->StateRuleSet[s];
+            int lastCell = -1;
+            for (int i = stateBatches.begin(s); i < stateBatches.end(s); i++) {
+                int index = stateBatches.order[i];
+                int cell = cellOfBoid[index];
+                if (cell != lastCell) {
+                    if (HotCells != nullptr) {
+                        chargeHotCell(lastCell);
+                    }
+                    // warm the cache for the voxel that comes next while this one computes
+                    if (params->PrefetchCells && cell + 1 < static_cast<int>(cells.size())) {
+                        prefetchCell(cells[cell + 1]);
+                    }
+                    lastCell = cell;
+                }
+                updateBoid((*boids)[index], cells[cell], rules);
+            }
+            if (HotCells != nullptr) {
+                chargeHotCell(lastCell);
+            }
+        }
+        flushCustomRule();
+        if (HotCells != nullptr) {
+            HotCells->endFrame();
+        }
+        if (Overlay != nullptr) {
+            if (HotCells != nullptr && Overlay->ShowVoxels && Overlay->Heat != OverlayHeat::CANDIDATES) {
+                for (size_t k = 0; k < cells.size(); k++) {
+                    const CellCost& cost = HotCells->allCells()[k];
+                    Overlay->reheat(k, Overlay->Heat == OverlayHeat::TIME ? float(cost.microseconds) : float(cost.pairTests));
+                }
+            }
+            Overlay->endFrame();
+        }
+        endPhase(PerfPhase::NEIGHBORS);
+        if (Proximity != nullptr) {
+            Proximity->endFrame();
+        }
+        neighborStats.passMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    const NeighborStats& getNeighborStats() const {
+        return neighborStats;
+    }
+
+    const NeighborListStats& getNeighborListStats() const {
+        return verletStats;
+    }
+
+    // indices of the agents that were neighbors of agent `index` in the last update
+    const NeighborIdList& getNeighborIds(int index) const {
+        return neighborIds[index];
+    }
+
+    // Cheap batched transition pass: every agent re-evaluates its state from its distance to the
+    // obstacle and to the nearest steering target.
+    void updateStates(Scalar dt) {
+        if (!params->EnableBehaviorStates) {
+            for (auto& boid : *boids) {
+                boid.state = BoidState::FLOCKING;
+                boid.stateTime = 0;
+            }
+            return;
+        }
+        using std::sqrt;
         for (auto& boid : *boids) {
-            updateBoid(boid);
+            if (!boid.alive) {
+                continue;
+            }
+            Scalar obstacleDistance = length(boid.position - params->CollisionCenter) - params->CollisionRadius;
+            Scalar targetDistance2 = Scalar(-1);
+            for (auto& target : params->SteeringTargets) {
+                Scalar d2 = length2(boid.position - target);
+                targetDistance2 = (targetDistance2 < Scalar(0) || d2 < targetDistance2) ? d2 : targetDistance2;
+            }
+            Scalar targetDistance = targetDistance2 < Scalar(0) ? Scalar(-1) : Scalar(sqrt(targetDistance2));
+            BoidState next = nextBoidState(boid.state, boid.stateTime, obstacleDistance, targetDistance, params->StateTransitionSettings);
+            boid.stateTime = next == boid.state ? boid.stateTime + dt : Scalar(0);
+            boid.state = next;
         }
     }
 
+    int stateCount(BoidState state) const {
+        return stateBatches.count(state);
+    }
+
     void buildVoxelCache() {
         voxelCache.clear();
         voxelCache.reserve(boids->size());
         for (auto &b : *boids) {
-            voxelCache[getVoxelForBoid(b)].push_back(&b);
+            if (b.alive) {
+                voxelCache[getVoxelForBoid(b)].push_back(&b);
+            }
+        }
+        buildCellTraversal();
+    }
+
+    // Orders the occupied voxels (Hilbert curve or hash order), resolves each voxel's neighborhood
+    // and lists the agents voxel by voxel in that order.
+    void buildCellTraversal() {
+        HugeVector<KeyedVoxel, MemoryTag::VOXEL_MAP>& keyed = keyedVoxels;
+        keyed.clear();
+        for (const auto& entry : voxelCache) {
+            const glm::vec3& v = entry.first;
+            uint64_t key = params->HilbertCellOrder ? hilbertVoxelKey(int(v.x), int(v.y), int(v.z)) : 0;
+            keyed.push_back(KeyedVoxel(key, &entry));
+        }
+        if (params->HilbertCellOrder) {
+            std::sort(keyed.begin(), keyed.end(),
+                [](const KeyedVoxel& l, const KeyedVoxel& r) { return l.first < r.first; });
+        }
+
+        cells.resize(keyed.size());
+        cellOfBoid.resize(boids->size());
+        traversal.clear();
+        for (size_t k = 0; k < keyed.size(); k++) {
+            VoxelCell& cell = cells[k];
+            cell.voxelPos = keyed[k].second->first;
+            cell.members = &keyed[k].second->second;
+            for (int x = -1; x <= 1; x++) {
+                for (int y = -1; y <= 1; y++) {
+                    for (int z = -1; z <= 1; z++) {
+                        auto iter = voxelCache.find(cell.voxelPos + glm::vec3(x, y, z));
+                        cell.neighbors[neighborhoodIndex(x, y, z)] = iter != voxelCache.end() ? &iter->second : nullptr;
+                    }
+                }
+            }
+            for (Boid* member : *cell.members) {
+                int index = static_cast<int>(member - boids->data());
+                cellOfBoid[index] = static_cast<int>(k);
+                traversal.push_back(index);
+            }
+        }
+    }
+
+    // Calls visit(const VoxelBucket&) for every occupied voxel that overlaps the box [lo, hi], from
+    // the grid of the last update; agents may have moved since by one integration step
+    template <class Visit>
+    void forEachVoxelInBox(const glm::vec3& lo, const glm::vec3& hi, Visit visit) const {
+        float radius = float(voxelSize);
+        glm::ivec3 first(lo / radius);
+        glm::ivec3 last(hi / radius);
+        glm::ivec3 extent = last - first + 1;
+        if (double(extent.x) * extent.y * extent.z > double(cells.size())) {
+            for (const VoxelCell& cell : cells) {
+                visit(*cell.members);
+            }
+            return;
+        }
+        for (int x = first.x; x <= last.x; x++) {
+            for (int y = first.y; y <= last.y; y++) {
+                for (int z = first.z; z <= last.z; z++) {
+                    auto iter = voxelCache.find(glm::vec3(x, y, z));
+                    if (iter != voxelCache.end()) {
+                        visit(iter->second);
+                    }
+                }
+            }
         }
     }
 
     glm::vec3 getVoxelForBoid(const Boid &b) const {
-        float radius = std::abs(PerceptionRadius);
-        const glm::vec3 &p = b.position;
+        Scalar radius = voxelSize;
+        const Vec3 &p = b.position;
         glm::vec3 voxelPos;
         voxelPos.x = static_cast<int>(p.x / radius);
         voxelPos.y = static_cast<int>(p.y / radius);
@@ -150,188 +470,579 @@ public:
     }
 
 
+    // uniformly distributed direction inside the unit ball, for agents on top of each other
+    Vec3 randomDirection() {
+        return Traits::randomDirection(eng);
+    }
+
+    static Scalar transformDistance(Scalar distance, DistanceType type) {
+        if (type == DistanceType::LINEAR) {
+            return distance;
+        }
+        else if (type == DistanceType::INVERSE_LINEAR) {
+            return distance == Scalar(0) ? Scalar(0) : Scalar(1) / distance;
+        }
+        else if (type == DistanceType::QUADRATIC) {
+            return distance * distance;
+        }
+        else if (type == DistanceType::INVERSE_QUADRATIC) {
+            Scalar quad = distance * distance;
+            return quad == Scalar(0) ? Scalar(0) : Scalar(1) / quad;
+        }
+        else {
+            return distance; // this shouldn't really happen
+        }
+    }
+
 private:
-    std::vector<Boid> *boids;
-    std::unordered_map<glm::vec3, std::vector<Boid*>, Vec3Hasher> voxelCache;
+    BoidList *boids = nullptr;
+    SnapshotCell<Params> paramCell;
+    const Params* params = nullptr;               // this frame's snapshot, see beginFrame()
+    Scalar perceptionRadius = Scalar(30);         // PerceptionRadius of the snapshot, never zero
+    std::unordered_map<glm::vec3, VoxelBucket, Vec3Hasher, std::equal_to<glm::vec3>,
+                       HugePageAllocator<std::pair<const glm::vec3, VoxelBucket>, MemoryTag::VOXEL_MAP>> voxelCache;
     std::mt19937 eng;
-    float FOVAngleDegCompareValue = 0; // = cos(PI2 * FOVAngleDeg / 360)
+    Scalar FOVAngleDegCompareValue = Scalar(0); // = cos(PI2 * FOVAngleDeg / 360)
+    StateBatches stateBatches;
+    NeighborStats neighborStats;
+    NearbyList nearbyScratch;
+    HugeVector<NeighborIdList, MemoryTag::NEIGHBORS> neighborIds;   // per agent, neighbor indices of the last query
+    HugeVector<unsigned, MemoryTag::NEIGHBORS> seenStamps;          // per agent, id of the last query that marked it
+    unsigned queryStamp = 0;
+    typedef std::pair<uint64_t, const std::pair<const glm::vec3, VoxelBucket>*> KeyedVoxel;
+    HugeVector<KeyedVoxel, MemoryTag::VOXEL_MAP> keyedVoxels;  // occupied voxels with their traversal key
+    HugeVector<VoxelCell, MemoryTag::VOXEL_MAP> cells;      // occupied voxels in traversal order
+    HugeVector<int, MemoryTag::VOXEL_MAP> cellOfBoid;       // per agent, index of its voxel in cells
+    HugeVector<int, MemoryTag::VOXEL_MAP> traversal;        // agent indices, voxel by voxel in traversal order
+    bool customRuleActive = false;
+    RuleVM<Scalar> ruleVM;
+    int ruleLanes = 0;                            // agents queued for the custom rule
+    int ruleAgents[RULE_BATCH_SIZE];
+    Vec3 ruleAccelerations[RULE_BATCH_SIZE];      // their accelerations from the built-in rules
+    std::vector<uint32_t> proximityIds;           // sorted agent ids handed to the proximity tracker
+    Scalar voxelSize = Scalar(30);                // edge of a grid voxel
+    CompressedNeighborLists verletLists;          // per traversal rank, candidate ranks
+    HugeVector<int, MemoryTag::NEIGHBORS> verletOrder;        // traversal order when the lists were built (rank -> agent)
+    HugeVector<uint32_t, MemoryTag::NEIGHBORS> verletRank;    // agent -> rank
+    HugeVector<uint32_t, MemoryTag::NEIGHBORS> verletOwners;  // agent id per slot at build time, 0 for dead slots
+    HugeVector<Vec3, MemoryTag::NEIGHBORS> verletAnchors;     // positions at build time
+    Scalar verletRange = Scalar(0);               // PerceptionRadius + VerletSkin of the build
+    HugeVector<uint32_t, MemoryTag::NEIGHBORS> verletScratch; // decoded ranks of one query
+    NeighborListStats verletStats;
+    uint64_t phaseStarts[PERF_PHASE_COUNT] = {};  // Recorder time at beginPhase()
+    size_t updatedSize = 0;                       // the agent list as the last update left it
+    const Boid* updatedData = nullptr;
+    uint64_t updatedGeneration = 0;
+    uint64_t updatedEdits = 0;
+    std::chrono::steady_clock::time_point hotCellStart;     // last chargeHotCell()
+    long long hotCellTests = 0;
 
     struct NearbyBoidsInformation
     {
-        glm::vec3 separationSum;
-        glm::vec3 headingSum;
-        glm::vec3 positionSum;
+        Vec3 separationSum;
+        Vec3 headingSum;
+        Vec3 positionSum;
         int count;
     };
 
-    void updateBoid(Boid& b) {
-        glm::vec3 separationSum(0);
-        glm::vec3 headingSum(0);
-        glm::vec3 positionSum(0);
-        glm::vec3 pos = b.position;
+    void updateBoid(Boid& b, const VoxelCell& cell, const StateRules& rules) {
+        int index = static_cast<int>(&b - boids->data());
+        NearbyList& nearby = nearbyScratch;
+        if (params->VerletNeighbors) {
+            getCachedBoids(b, index, nearby);
+        }
+        else if (params->InteractionModel == NeighborModel::RADIUS && params->MaxNeighbors > 0) {
+            getNearestBoids(b, index, cell, nearby);
+        }
+        else {
+            getNearbyBoids(b, cell, nearby);
+        }
+        recordNeighbors(index, nearby);
+        if (Overlay != nullptr && Overlay->ShowLinks && b.id == Overlay->SelectedId) {
+            for (const NearbyBoid& nb : nearby) {
+                Overlay->line(Traits::toVec3(b.position), Traits::toVec3(nb.boid->position), glm::vec3(0, 0.5f, 1));
+            }
+        }
+        if (Proximity != nullptr && Proximity->TrackNeighbors) {
+            proximityIds.clear();
+            for (const NearbyBoid& nb : nearby) {
+                proximityIds.push_back(nb.boid->id);
+            }
+            std::sort(proximityIds.begin(), proximityIds.end());
+            Proximity->neighbors(index, proximityIds);
+        }
 
-        auto nearby = getNearbyBoids(b);
+        // built-in rules first, in the order of the original operator splitting (w1 * a1 + ... + w5 * a5)
+        auto fused = std::tuple_cat(std::make_tuple(SeparationRule<Traits>(), AlignmentRule<Traits>(), CohesionRule<Traits>(),
+                                                    SteeringRule<Traits>(), FleeRule<Traits>()),
+                                    params->ExtraRuleSet);
+        Vec3 acceleration = FLOCK_FORCE_BREAKDOWN && Forces != nullptr ? recordForces(fused, b, nearby, rules, index)
+                                                                        : applyRules(fused, *this, b, nearby, rules);
 
-        for (NearbyBoid& closeBoid : nearby) {
-            if (closeBoid.distance == 0) {
-                separationSum += getRandomUniform(eng) * 1000.0f;
+        if (customRuleActive) {
+            int lane = ruleLanes++;
+            ruleAgents[lane] = index;
+            ruleAccelerations[lane] = acceleration;
+            Vec3 steeringTarget = std::get<3>(fused).target;
+            ruleVM.setInput(RuleInput::NEIGHBORS, lane, Scalar(static_cast<int>(nearby.size())));
+            ruleVM.setInput(RuleInput::SPEED, lane, length(b.velocity));
+            ruleVM.setInput(RuleInput::TARGET_DISTANCE, lane, length(steeringTarget - b.position));
+            ruleVM.setInput(RuleInput::OBSTACLE_DISTANCE, lane, length(params->CollisionCenter - b.position) - params->CollisionRadius);
+            ruleVM.setInput(RuleInput::POSITION, lane, b.position);
+            ruleVM.setInput(RuleInput::VELOCITY, lane, b.velocity);
+            ruleVM.setInput(RuleInput::SEPARATION, lane, std::get<0>(fused).value);
+            ruleVM.setInput(RuleInput::ALIGNMENT, lane, std::get<1>(fused).value);
+            ruleVM.setInput(RuleInput::COHESION, lane, std::get<2>(fused).value);
+            ruleVM.setInput(RuleInput::TO_TARGET, lane, steeringTarget - b.position);
+            ruleVM.setInput(RuleInput::TO_OBSTACLE, lane, params->CollisionCenter - b.position);
+            if (ruleLanes == RULE_BATCH_SIZE) {
+                flushCustomRule();
             }
-            else {
-                float separationFactor = transformDistance(closeBoid.distance, SeparationType);
-                separationSum += -closeBoid.direction * separationFactor;  // moving away from neighbor boid
+            return;
+        }
+        b.acceleration = clampLength(acceleration, params->MaxAcceleration);
+        if (FLOCK_FORCE_BREAKDOWN && Forces != nullptr) {
+            Forces->at(ForceComponent::CLAMPED, index) = b.acceleration;
+        }
+    }
 
+    // applyRules with every contribution stored in Forces; extra rules are summed into EXTRA
+    template <class Tuple>
+    Vec3 recordForces(Tuple& fused, const Boid& b, const NearbyList& nearby, const StateRules& rules, int index) {
+        const int count = static_cast<int>(std::tuple_size<Tuple>::value);
+        Vec3 contributions[count];
+        Vec3 acceleration = applyRulesRecorded(fused, *this, b, nearby, rules, contributions);
+        for (int c = 0; c < count; c++) {
+            if (c < static_cast<int>(ForceComponent::EXTRA)) {
+                Forces->at(static_cast<ForceComponent>(c), index) = contributions[c];
+            }
+            else {
+                Forces->at(ForceComponent::EXTRA, index) += contributions[c];
             }
-            headingSum += closeBoid.boid->velocity;
-            positionSum += closeBoid.boid->position;
         }
+        Forces->at(ForceComponent::TOTAL, index) = acceleration;
+        return acceleration;
+    }
 
-        glm::vec3 steeringTarget = b.position;
-        float targetDistance = -1;
-        for (auto &target : SteeringTargets) {
-            float distance = transformDistance(glm::length(b.position - target), SteeringTargetType);
-            if (targetDistance < 0 || distance < targetDistance) {
-                steeringTarget = target;
-                targetDistance = distance;
+    // Charges the pair tests and time since the last call to voxel `cell` (nothing for -1)
+    void chargeHotCell(int cell) {
+        auto now = std::chrono::steady_clock::now();
+        long long tests = neighborStats.candidates + neighborStats.culled;
+        if (cell >= 0) {
+            HotCells->charge(cell, tests - hotCellTests, std::chrono::duration<double, std::micro>(now - hotCellStart).count());
+        }
+        hotCellTests = tests;
+        hotCellStart = now;
+    }
 
+    // Every occupied voxel with its true extent: voxel coordinates are truncated toward zero, so the
+    // voxel at 0 spans two voxel edges on that axis
+    void overlayVoxels() {
+        float edge = float(voxelSize);
+        for (const VoxelCell& cell : cells) {
+            glm::vec3 v = cell.voxelPos;
+            glm::vec3 lo, hi;
+            for (int axis = 0; axis < 3; axis++) {
+                lo[axis] = (v[axis] <= 0 ? v[axis] - 1 : v[axis]) * edge;
+                hi[axis] = (v[axis] >= 0 ? v[axis] + 1 : v[axis]) * edge;
+            }
+            int candidates = 0;
+            for (const VoxelBucket* bucket : cell.neighbors) {
+                candidates += bucket != nullptr ? static_cast<int>(bucket->size()) : 0;
             }
+            Overlay->voxel(lo, hi, candidates);
         }
+    }
 
-        // Separation: steer to avoid crowding local agents
-        glm::vec3 separation = nearby.size() > 0 ? separationSum / (float)nearby.size() : separationSum;
+    // the heading that hits the obstacle in red, the tangent the agent turns to in green
+    void overlayAvoidance(const Boid& boid, const Vec3& target) {
+        glm::vec3 p = Traits::toVec3(boid.position);
+        float reach = float(params->CollisionRadius) + 0.5f;
+        Overlay->line(p, p + reach * glm::normalize(Traits::toVec3(boid.velocity)), glm::vec3(1, 0, 0));
+        Overlay->line(p, p + reach * glm::normalize(Traits::toVec3(target)), glm::vec3(0, 0.7f, 0));
+    }
 
-        // Alignment: steer towards the average heading of local agents
-        glm::vec3 alignment = nearby.size() > 0 ? headingSum / (float)nearby.size() : headingSum;
+    // Runs the custom rule on the queued agents and finishes their accelerations
+    void flushCustomRule() {
+        if (ruleLanes == 0) {
+            return;
+        }
+        ruleVM.run();
+        for (int lane = 0; lane < ruleLanes; lane++) {
+            Boid& b = (*boids)[ruleAgents[lane]];
+            b.acceleration = clampLength(ruleAccelerations[lane] + ruleVM.template force<Vec3>(lane), params->MaxAcceleration);
+            if (FLOCK_FORCE_BREAKDOWN && Forces != nullptr) {
+                Forces->at(ForceComponent::EXTRA, ruleAgents[lane]) += ruleVM.template force<Vec3>(lane);
+                Forces->at(ForceComponent::TOTAL, ruleAgents[lane]) += ruleVM.template force<Vec3>(lane);
+                Forces->at(ForceComponent::CLAMPED, ruleAgents[lane]) = b.acceleration;
+            }
+        }
+        ruleLanes = 0;
+    }
 
-        // Cohesion: steer to move toward the average position of local agents
-        glm::vec3 avgPosition = nearby.size() > 0 ? positionSum / (float)nearby.size() : b.position;
-        glm::vec3 cohesion = avgPosition - b.position;
+    // result is a scratch buffer shared by all queries, so its capacity carries over between agents
+    void getNearbyBoids(const Boid& b, const VoxelCell& cell, NearbyList& result) {
+        result.clear();
+        neighborStats.queries++;
+        if (params->InteractionModel == NeighborModel::VISUAL) {
+            VisualBinMap<NearbyBoid, Scalar> bins;
+            gatherNearbyBoids(b, cell, bins);
+            bins.collect(result);
+            return;
+        }
+        gatherNearbyBoids(b, cell, result);
+    }
+
+    // Rebuilds the Verlet lists when the flock changed or moved too far since the last build
+    void updateVerletLists() {
+        verletStats.active = params->VerletNeighbors;
+        verletStats.rebuiltThisFrame = false;
+        if (!params->VerletNeighbors) {
+            return;
+        }
+        using std::abs;
+        Scalar range = abs(perceptionRadius) + abs(params->VerletSkin);
+        bool stale = range != verletRange || verletOwners.size() != boids->size();
+        Scalar limit2 = abs(params->VerletSkin) * abs(params->VerletSkin) / Scalar(4);
+        for (size_t i = 0; i < boids->size() && !stale; i++) {
+            const Boid& b = (*boids)[i];
+            stale = verletOwners[i] != (b.alive ? b.id : 0) || (b.alive && length2(b.position - verletAnchors[i]) > limit2);
+        }
+        if (!stale) {
+            return;
+        }
 
-        // Steering: steer towards the nearest world target location (like a moth to the light)
-        glm::vec3 steering(0);
-        // avoid division by zero
-        if (!glm::any(glm::equal(steeringTarget, b.position))) {
-            steering = glm::normalize(steeringTarget - b.position) * targetDistance;
+        size_t n = boids->size();
+        verletRange = range;
+        verletOrder.assign(traversal.begin(), traversal.end());
+        verletRank.assign(n, 0);
+        verletOwners.resize(n);
+        verletAnchors.resize(n);
+        for (size_t r = 0; r < verletOrder.size(); r++) {
+            verletRank[verletOrder[r]] = static_cast<uint32_t>(r);
+        }
+        for (size_t i = 0; i < n; i++) {
+            const Boid& b = (*boids)[i];
+            verletOwners[i] = b.alive ? b.id : 0;
+            verletAnchors[i] = b.position;
         }
+        // voxels are range wide, so the 27 voxel neighborhood holds every candidate
+        verletLists.clear();
+        Scalar range2 = range * range;
+        for (size_t r = 0; r < verletOrder.size(); r++) {
+            int index = verletOrder[r];
+            const Boid& b = (*boids)[index];
+            verletScratch.clear();
+            for (const VoxelBucket* bucket : cells[cellOfBoid[index]].neighbors) {
+                if (bucket == nullptr) {
+                    continue;
+                }
+                for (Boid* test : *bucket) {
+                    if (test != &b && length2(test->position - b.position) <= range2) {
+                        verletScratch.push_back(verletRank[test - boids->data()]);
+                    }
+                }
+            }
+            std::sort(verletScratch.begin(), verletScratch.end());
+            verletLists.append(static_cast<uint32_t>(r), verletScratch.data(), verletScratch.size());
+        }
+        verletStats.rebuilds++;
+        verletStats.rebuiltThisFrame = true;
+        verletStats.entries = verletLists.entryCount();
+        verletStats.compressedBytes = verletLists.compressedBytes();
+        verletStats.rawBytes = verletLists.rawBytes();
+    }
 
-        // calculate boid acceleration using operator splitting
-        glm::vec3 acceleration(0);
-        acceleration += separation * SeparationWeight;  // w1 * a1
-        acceleration += alignment * AlignmentWeight;    // w2 * a2
-        acceleration += cohesion * CohesionWeight;      // w3 * a3
-        acceleration += steering * SteeringWeight;      // w4 * a4
-        b.acceleration = clampLength(acceleration, MaxAcceleration);
+    // Neighbor query over the agent's cached list; the k nearest model keeps the k closest
+    void getCachedBoids(const Boid& b, int index, NearbyList& result) {
+        result.clear();
+        neighborStats.queries++;
+        uint32_t rank = verletRank[index];
+        verletScratch.resize(verletLists.count(rank));
+        size_t count = verletLists.decode(rank, rank, verletScratch.data());
+        if (params->InteractionModel == NeighborModel::VISUAL) {
+            VisualBinMap<NearbyBoid, Scalar> bins;
+            for (size_t i = 0; i < count; i++) {
+                NearbyBoid nb;
+                if (isNearby(b, &(*boids)[verletOrder[verletScratch[i]]], nb)) {
+                    addNearbyBoid(bins, nb);
+                }
+            }
+            bins.collect(result);
+            return;
+        }
+        for (size_t i = 0; i < count; i++) {
+            NearbyBoid nb;
+            if (isNearby(b, &(*boids)[verletOrder[verletScratch[i]]], nb)) {
+                result.push_back(nb);
+            }
+        }
+        if (params->MaxNeighbors > 0 && static_cast<int>(result.size()) > params->MaxNeighbors) {
+            std::nth_element(result.begin(), result.begin() + (params->MaxNeighbors - 1), result.end(), closerBoid);
+            result.resize(params->MaxNeighbors);
+        }
     }
 
-    std::vector<NearbyBoid> getNearbyBoids(const Boid& b) const {
-        std::vector<NearbyBoid> result;
-        result.reserve(boids->size());
+    // The k nearest agents in range.  Last frame's neighbors are tested first: once k of them are
+    // confirmed, the k-th distance bounds the search, so most of the 27 voxels and most grid
+    // candidates are rejected without running the full neighbor test.
+    void getNearestBoids(const Boid& b, int index, const VoxelCell& cell, NearbyList& heap) {
+        heap.clear();   // max-heap on distance, holds at most MaxNeighbors entries
+        Scalar bound = perceptionRadius;
+        queryStamp++;
+        neighborStats.queries++;
+
+        auto offer = [&](Boid* test) {
+            if (length2(test->position - b.position) > bound * bound) {
+                neighborStats.culled++;
+                return;
+            }
+            NearbyBoid nb;
+            if (!isNearby(b, test, nb)) {
+                return;
+            }
+            heap.push_back(nb);
+            std::push_heap(heap.begin(), heap.end(), closerBoid);
+            if (static_cast<int>(heap.size()) > params->MaxNeighbors) {
+                std::pop_heap(heap.begin(), heap.end(), closerBoid);
+                heap.pop_back();
+            }
+            if (static_cast<int>(heap.size()) == params->MaxNeighbors) {
+                bound = heap.front().distance;
+            }
+        };
+
+        if (params->WarmStartNeighbors) {
+            for (int id : neighborIds[index]) {
+                if (id >= static_cast<int>(boids->size()) || !(*boids)[id].alive) {
+                    continue;
+                }
+                seenStamps[id] = queryStamp;
+                neighborStats.warmCandidates++;
+                offer(&(*boids)[id]);
+            }
+        }
 
-        glm::vec3 voxelPos = getVoxelForBoid(b);
-        voxelPos.x -= 1;
-        voxelPos.y -= 1;
-        voxelPos.z -= 1;
-        for (int x = 0; x < 3; x++) {
-            for (int y = 0; y < 3; y++) {
-                for (int z = 0; z < 3; z++) {
-                    checkVoxelForBoids(b, result, voxelPos);
-                    voxelPos.z++;
+        // own voxel first, it usually tightens the bound the most
+        static const int order[3] = { 0, -1, 1 };
+        for (int x : order) {
+            for (int y : order) {
+                for (int z : order) {
+                    const VoxelBucket* bucket = cell.neighbors[neighborhoodIndex(x, y, z)];
+                    if (bucket == nullptr) {
+                        continue;
+                    }
+                    if (voxelDistance2(b.position, cell.voxelPos + glm::vec3(x, y, z)) > bound * bound) {
+                        neighborStats.skippedVoxels++;
+                        continue;
+                    }
+                    for (Boid* test : *bucket) {
+                        if (seenStamps[test - boids->data()] != queryStamp) {
+                            offer(test);
+                        }
+                    }
                 }
-                voxelPos.z -= 3;
-                voxelPos.y++;
             }
-            voxelPos.y -= 3;
-            voxelPos.x++;
         }
-        return result;
+    }
 
+    static bool closerBoid(const NearbyBoid& l, const NearbyBoid& r) {
+        return l.distance < r.distance;
     }
 
-    void checkVoxelForBoids(const Boid &b, std::vector<NearbyBoid> &result, const glm::vec3& voxelPos) const {
-        auto iter = voxelCache.find(voxelPos);
-        if (iter != voxelCache.end()) {
-            for (Boid *test : iter->second) {
-                const glm::vec3 &p1 = b.position;
-                const glm::vec3 &p2 = test->position;
-                glm::vec3 vec = p2 - p1;
-                float distance = glm::length(vec);
+    // squared distance from p to the box of the voxel; voxel coordinates truncate toward zero,
+    // so voxel 0 spans two cells and negative voxels extend toward -infinity
+    Scalar voxelDistance2(const Vec3& p, const glm::vec3& voxelPos) const {
+        Scalar radius = voxelSize;
+        Scalar d2 = Scalar(0);
+        for (int i = 0; i < 3; i++) {
+            float v = voxelPos[i];
+            Scalar lo = v > 0 ? Scalar(v) * radius : Scalar(v - 1) * radius;
+            Scalar hi = v < 0 ? Scalar(v) * radius : Scalar(v + 1) * radius;
+            Scalar d = p[i] < lo ? lo - p[i] : (p[i] > hi ? p[i] - hi : Scalar(0));
+            d2 += d * d;
+        }
+        return d2;
+    }
 
-                float compareValue = 0.0f;
-                float l1 = glm::length(vec);
-                float l2 = glm::length(b.velocity);
-                if (l1 != 0 && l2 != 0) {
-                    compareValue = glm::dot(-b.velocity, vec) / (l1 * l2);
-                }
+    // whether the agent list was resized, reallocated, rewritten or edited in place since the last
+    // update left it
+    bool agentListChanged() const {
+        return boids->size() != updatedSize || boids->data() != updatedData
+            || agentListGeneration() != updatedGeneration || agentListEdits() != updatedEdits;
+    }
 
-                if ((&b) != test && distance <= PerceptionRadius && (FOVAngleDegCompareValue > compareValue || glm::length(b.velocity) == 0)) {
-                    NearbyBoid nb;
-                    nb.boid = test;
-                    nb.distance = distance;
-                    nb.direction = vec;
-                    result.push_back(nb);
+    // starts the hardware counters and the recorder span of a phase
+    void beginPhase(PerfPhase phase) {
+        if (Counters != nullptr) {
+            Counters->begin(phase);
+        }
+        if (Recorder != nullptr) {
+            phaseStarts[static_cast<int>(phase)] = Recorder->now();
+        }
+    }
+
+    // stops them and records the span
+    void endPhase(PerfPhase phase) {
+        if (Counters != nullptr) {
+            Counters->end(phase, static_cast<int>(traversal.size()));
+        }
+        if (Recorder != nullptr) {
+            Recorder->phase(perfPhaseName(phase), phaseStarts[static_cast<int>(phase)], Recorder->now());
+        }
+    }
+
+    // Hands the members of every trigger sphere to the proximity tracker.  Only the voxels
+    // overlapping the sphere are visited, unless that is more voxels than are occupied.
+    void reportTriggers() {
+        for (size_t t = 0; t < Proximity->Triggers.size(); t++) {
+            const ProximityTrigger& trigger = Proximity->Triggers[t];
+            Vec3 center = Traits::fromVec3(trigger.Center);
+            Scalar r2 = Scalar(trigger.Radius) * Scalar(trigger.Radius);
+            proximityIds.clear();
+            forEachVoxelInBox(trigger.Center - trigger.Radius, trigger.Center + trigger.Radius, [&](const VoxelBucket& bucket) {
+                for (Boid* test : bucket) {
+                    if (length2(test->position - center) <= r2) {
+                        proximityIds.push_back(test->id);
+                    }
                 }
+            });
+            std::sort(proximityIds.begin(), proximityIds.end());
+            Proximity->triggerMembers(t, proximityIds);
+        }
+    }
+
+    // Stores the neighbor indices of an agent and counts how many were already known last frame
+    void recordNeighbors(int index, const NearbyList& nearby) {
+        NeighborIdList& ids = neighborIds[index];
+        if (!params->WarmStartNeighbors) {
+            ids.clear();
+            return;
+        }
+        queryStamp++;
+        for (int id : ids) {
+            if (id < static_cast<int>(seenStamps.size())) {
+                seenStamps[id] = queryStamp;
+            }
+        }
+        long long common = 0;
+        ids.clear();
+        for (const NearbyBoid& nb : nearby) {
+            int id = static_cast<int>(nb.boid - boids->data());
+            common += seenStamps[id] == queryStamp ? 1 : 0;
+            ids.push_back(id);
+        }
+        neighborStats.confirmed += common;
+        neighborStats.discovered += static_cast<long long>(ids.size()) - common;
+    }
+
+    template <class NearbySink>
+    void gatherNearbyBoids(const Boid& b, const VoxelCell& cell, NearbySink& result) {
+        for (const VoxelBucket* bucket : cell.neighbors) {
+            if (bucket != nullptr) {
+                checkVoxelForBoids(b, result, *bucket);
+            }
+        }
+    }
+
+    template <class NearbySink>
+    void checkVoxelForBoids(const Boid &b, NearbySink &result, const VoxelBucket& bucket) {
+        for (Boid *test : bucket) {
+            NearbyBoid nb;
+            if (isNearby(b, test, nb)) {
+                addNearbyBoid(result, nb);
             }
         }
     }
 
-    glm::vec3 avoidanceDirection(Boid& boid) const {
+    // Prefetches the bucket arrays of a voxel's neighborhood and the first agents they point to
+    static void prefetchCell(const VoxelCell& cell) {
+        for (const VoxelBucket* bucket : cell.neighbors) {
+            if (bucket != nullptr && !bucket->empty()) {
+                FLOCK_PREFETCH(bucket->data());
+                FLOCK_PREFETCH(&(*bucket)[0]->position);
+                FLOCK_PREFETCH(&bucket->back()->position);
+            }
+        }
+    }
+
+    // distance and field of view test of a candidate agent
+    bool isNearby(const Boid &b, Boid *test, NearbyBoid &nb) {
+        neighborStats.candidates++;
+        const Vec3 &p1 = b.position;
+        const Vec3 &p2 = test->position;
+        Vec3 vec = p2 - p1;
+        Scalar distance = length(vec);
+
+        Scalar compareValue = Scalar(0.0f);
+        Scalar l1 = distance;
+        Scalar l2 = length(b.velocity);
+        if (l1 != Scalar(0) && l2 != Scalar(0)) {
+            compareValue = dot(-b.velocity, vec) / (l1 * l2);
+        }
+
+        if ((&b) != test && distance <= perceptionRadius && (FOVAngleDegCompareValue > compareValue || length(b.velocity) == Scalar(0))) {
+            nb.boid = test;
+            nb.distance = distance;
+            nb.direction = vec;
+            return true;
+        }
+        return false;
+    }
+
+    static void addNearbyBoid(NearbyList& result, const NearbyBoid& nb) {
+        result.push_back(nb);
+    }
+
+    static void addNearbyBoid(VisualBinMap<NearbyBoid, Scalar>& bins, const NearbyBoid& nb) {
+        int bin = visualBinDirections<Scalar, Traits::SimdWidth>().binOf(nb.direction.x, nb.direction.y, nb.direction.z);
+        bins.insert(bin, nb, nb.distance);
+    }
+
+    Vec3 avoidanceDirection(Boid& boid) const {
+        using std::sqrt;
         
-        float R = CollisionRadius + 0.5f; // adding a little padding to collision radius
-        float r2 = R * R;
-        float a = glm::length2(boid.velocity);
-        float b = glm::dot(2.f * boid.velocity, boid.position - CollisionCenter);
-        float c = glm::length2(boid.position - CollisionCenter) - r2;
-        float delta = b*b - 4*a*c;
+        Scalar R = params->CollisionRadius + Scalar(0.5f); // adding a little padding to collision radius
+        Scalar r2 = R * R;
+        Scalar a = length2(boid.velocity);
+        Scalar b = dot(Scalar(2) * boid.velocity, boid.position - params->CollisionCenter);
+        Scalar c = length2(boid.position - params->CollisionCenter) - r2;
+        Scalar delta = b*b - Scalar(4)*a*c;
 
         // seeing check
-        if (!(delta >= 0 && b + sqrt(delta) <= 0)) {
+        if (!(delta >= Scalar(0) && b + sqrt(delta) <= Scalar(0))) {
             boid.avoidance = false;
             return boid.velocity;
         }
             
         // range check
-        if (-(b + sqrt(delta)) * glm::length(boid.velocity) / (2.f*a) >= R) {
+        if (-(b + sqrt(delta)) * length(boid.velocity) / (Scalar(2)*a) >= R) {
             boid.avoidance = false;
             return boid.velocity;
         }
         boid.avoidance = true;
 
-        float s = sqrt(r2 - pow(glm::dot(boid.motion_normal, CollisionCenter - boid.position), 2));
-        glm::vec3 C = CollisionCenter - glm::dot(boid.motion_normal, CollisionCenter - boid.position) * boid.motion_normal;
+        Scalar normalOffset = dot(boid.motion_normal, params->CollisionCenter - boid.position);
+        Scalar s = sqrt(r2 - normalOffset * normalOffset);
+        Vec3 C = params->CollisionCenter - normalOffset * boid.motion_normal;
 
-        float sign = glm::dot(boid.motion_normal, glm::cross(C - boid.position, boid.velocity)) > 0 ? 1.0 : -1.0;
+        Scalar sign = dot(boid.motion_normal, cross(C - boid.position, boid.velocity)) > Scalar(0) ? Scalar(1) : Scalar(-1);
 
-        float CPlength = glm::length(C - boid.position);
-        float sin_theta = s / CPlength;
-        float cos_theta = sqrt(1.f - sin_theta * sin_theta);
+        Scalar CPlength = length(C - boid.position);
+        Scalar sin_theta = s / CPlength;
+        Scalar cos_theta = sqrt(Scalar(1) - sin_theta * sin_theta);
 
-        glm::vec3 u = cos_theta * (C - boid.position) / CPlength
-            + sign * sin_theta * glm::cross(boid.motion_normal, C - boid.position) / CPlength;
+        Vec3 u = cos_theta * (C - boid.position) / CPlength
+            + sign * sin_theta * cross(boid.motion_normal, C - boid.position) / CPlength;
         
         return u;
     }
 
-
-
-    float transformDistance(float distance, DistanceType type) {
-        if (type == DistanceType::LINEAR) {
-            return distance;
-        }
-        else if (type == DistanceType::INVERSE_LINEAR) {
-            return distance == 0 ? 0 : 1 / distance;
-        }
-        else if (type == DistanceType::QUADRATIC) {
-            return std::pow(distance, 2);
-        }
-        else if (type == DistanceType::INVERSE_QUADRATIC) {
-            float quad = std::pow(distance, 2);
-            return quad == 0 ? 0 : 1 / quad;
-        }
-        else {
-            return distance; // this shouldn't really happen
-        }
-    }
-
 };
 
+typedef BasicFlocker<FloatTraits> Flocker;
+typedef BasicFlocker<DoubleTraits> DoubleFlocker;
+typedef BasicFlocker<FixedTraits> FixedFlocker;
+
 
 #endif
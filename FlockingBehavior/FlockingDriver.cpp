@@ -12,12 +12,24 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <cstring>
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "Flocker.h"
+#include "Benchmark.h"
+#include "BenchmarkReport.h"
+#include "WorldChunks.h"
+#include "BoidPool.h"
+#include "ProximityEvents.h"
+#include "CommandQueue.h"
+#include "Metrics.h"
+#include "StateStream.h"
+#include "FlightRecorder.h"
+#include "GpuTimers.h"
+#include "OverlayRenderer.h"
 #include "Geometry.h"
 #include "arcball_camera.h"
 
@@ -67,20 +79,59 @@ class Client {
     void mouseclick(int x, int y, bool left_button);
     void mousescroll(int yoffset);
     glm::vec3 unProject(const glm::vec3& pos, const glm::mat4& modelviewproj, const glm::vec4& viewport);
+    void printGpuProfile(ostream& out) const;
   private:
     SDL_Window *window;
     GLint program;
     GLuint vao,
            vbos[3];
+    size_t vbo_bytes[3];                            // accounted to MemoryTag::GL_BUFFERS
     glm::mat4 VP;
     bool cpu_load;
     Flocker flock;
-    std::vector<Boid> boids;
+    Flocker::Params params;     // edited by the UI, published to the flocker once per frame
+    BoidList boids;
     glm::vec3 cursor_pos;
     ArcballCamera camera;
     bool show_tooltips = false;
     int last_mouse_x, last_mouse_y;
     int separation_type;
+    char rule_text[1024];
+    WorldChunks<FloatTraits> world;
+    bool stream_world = false;
+    BoidPool<FloatTraits> pool;
+    bool churn = false;
+    ProximityTracker proximity;
+    bool track_proximity = false;
+    std::vector<ProximityEvent> proximity_events;   // drained this frame
+    std::vector<ProximityEvent> trigger_log;        // most recent trigger events, newest last
+    CommandQueue commands;                          // spawns and edits from any thread
+    std::vector<CommandBatch> command_batches;      // drained this frame
+    CommandStats command_stats;
+    std::mt19937 command_rng;
+    MetricsRegistry metrics_registry;
+    FlockMetrics metrics;
+    MetricsServer metrics_server;
+    bool serve_metrics = false;
+    StateStreamServer state_stream;                 // flock state for local viewers
+    bool stream_state = false;
+    uint32_t frame_count = 0;
+    PerfCounters perf_counters;                     // hardware counters per flock phase
+    FlightRecorder recorder;                        // always on, dumps frames over budget
+    bool count_phases = false;
+    double sim_time = 0;
+    GpuTimers gpu_timers;                           // GPU time of the render phases, read two frames late
+    PhaseMetric gpu_metrics[GPU_PHASE_COUNT];
+    uint32_t gpu_frame_seen = 0;                    // last GPU result published to the metrics
+    ForceBreakdown forces;                          // per agent rule contributions while recording
+    bool record_forces = false;
+    uint32_t picked_id = 0;                         // agent inspected in the Force Breakdown panel, 0 for none
+    std::string forces_status;
+    DebugOverlay overlay;                           // filled by the flocker while show_overlay is on
+    OverlayRenderer overlay_renderer;
+    bool show_overlay = false;
+    HotCellProfile hot_cells;                       // per voxel cost of the neighbor pass, while profile_cells is on or the overlay shows measured heat
+    bool profile_cells = false;
     
 };
 
@@ -140,7 +191,7 @@ glm::vec3 Client::unProject(const glm::vec3& pos, const glm::mat4& modelviewproj
 
 
 Client::Client(SDL_Window *w)
-    : window(w), cursor_pos(0), separation_type(3){
+    : window(w), cursor_pos(0), separation_type(3), metrics(metrics_registry), metrics_server(metrics_registry) {
 
     camera = ArcballCamera(glm::vec3(0, 0, 8), glm::vec3(0), glm::vec3(0, 1, 0));
     // shader program
@@ -174,6 +225,7 @@ Client::Client(SDL_Window *w)
     glBindBuffer(GL_ARRAY_BUFFER,vbos[0]);
     glm::vec3 verts[5] = { {1,1,1}, {-1,1,1}, {-1,-1,1}, {1,-1,1}, {0,0,-1} };
     glBufferData(GL_ARRAY_BUFFER,sizeof(verts),verts,GL_STATIC_DRAW);
+    vbo_bytes[0] = sizeof(verts);
     GLint loc = glGetAttribLocation(program,"position");
     glVertexAttribPointer(loc,3,GL_FLOAT,false,sizeof(glm::vec3),0);
     glEnableVertexAttribArray(loc);
@@ -183,6 +235,7 @@ Client::Client(SDL_Window *w)
     for (int i=0; i < 5; ++i)
     norms[i] = glm::normalize(norms[i]);
     glBufferData(GL_ARRAY_BUFFER,sizeof(norms),norms,GL_STATIC_DRAW);
+    vbo_bytes[1] = sizeof(norms);
     loc = glGetAttribLocation(program,"normal");
     glVertexAttribPointer(loc,3,GL_FLOAT,false,sizeof(glm::vec3),0);
     glEnableVertexAttribArray(loc);
@@ -190,7 +243,10 @@ Client::Client(SDL_Window *w)
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,vbos[2]);
     unsigned faces[6*3] = { 1,2,0, 2,3,0, 0,4,1, 1,4,2, 2,4,3, 0,3,4 };
     glBufferData(GL_ELEMENT_ARRAY_BUFFER,sizeof(faces),faces,GL_STATIC_DRAW);
+    vbo_bytes[2] = sizeof(faces);
     glBindVertexArray(0);
+    for (size_t bytes : vbo_bytes)
+      memoryAccount(MemoryTag::GL_BUFFERS).allocated(bytes);
 
     // misc
     glEnable(GL_DEPTH_TEST);
@@ -198,6 +254,10 @@ Client::Client(SDL_Window *w)
     glUseProgram(program);
     loc = glGetUniformLocation(program,"light_direction");
     glUniform3f(loc,0,0,1);
+    gpu_timers.init();
+    overlay_renderer.init();
+    for (int i = 0; i < GPU_PHASE_COUNT; i++)
+      gpu_metrics[i] = metrics_registry.phase((std::string("gpu_") + gpuPhaseName(static_cast<GpuPhase>(i))).c_str());
     cpu_load = false;
 
     // create our flock
@@ -206,12 +266,23 @@ Client::Client(SDL_Window *w)
     boids.push_back(Boid(glm::vec3(1, 1.5, 0), glm::vec3(0, 1, 0)));
     boids.push_back(Boid(glm::vec3(4, 4, 0), glm::vec3(1, 0, 0)));
     // add a steering target
-    flock = Flocker(&boids);
+    flock.setAgents(&boids);
     cursor_pos = glm::vec3(-0.18, -0.35, 0.2);
-    flock.SteeringTargets.push_back(cursor_pos);
+    params.SteeringTargets.push_back(cursor_pos);
     // add an obstacle sphere
-    flock.CollisionRadius = 2.0f;
-    flock.CollisionCenter = glm::vec3(-3, -3, 0);
+    params.CollisionRadius = 2.0f;
+    params.CollisionCenter = glm::vec3(-3, -3, 0);
+    // an example custom rule, off until enabled in the UI
+    strncpy(rule_text,
+        "# swirl around the steering target\n"
+        "param swirl = 2\n"
+        "let side = cross(vec(0, 0, 1), toTarget)\n"
+        "force = normalize(side) * swirl * step(neighbors, 8)\n", sizeof(rule_text) - 1);
+    rule_text[sizeof(rule_text) - 1] = '\0';
+    params.CustomRule = compileRule(rule_text);
+    world.setAgents(&boids);
+    pool.setAgents(&boids);
+    flock.Recorder = &recorder;
 
 }
 
@@ -222,15 +293,42 @@ Client::~Client(void) {
   glDeleteProgram(program);
   glDeleteVertexArrays(1,&vao);
   glDeleteBuffers(3,vbos);
+  gpu_timers.shutdown();
+  overlay_renderer.shutdown();
+  for (size_t bytes : vbo_bytes)
+    memoryAccount(MemoryTag::GL_BUFFERS).freed(bytes);
 }
 
 
 /////////////////////////////////////////////////////////////////
+// times a phase for both the metrics endpoint and the flight recorder; returns its end
+static uint64_t end_phase(FlightRecorder& recorder, PhaseMetric& metric, const char* name, uint64_t start) {
+  uint64_t end = recorder.now();
+  recorder.phase(name, start, end);
+  metric.record(double(end - start) * 1e-6);
+  return end;
+}
+
+
 void Client::draw(double dt) {
+  frame_count++;
+  recorder.beginFrame(frame_count, params);
+  uint64_t frame_start = recorder.now();
   glClearColor(1,1,1,1);
   glClearDepth(1);
   glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
+  // GPU results of an earlier frame, published once each
+  gpu_timers.beginFrame();
+  if (gpu_timers.lastResolvedFrame() != gpu_frame_seen) {
+      gpu_frame_seen = gpu_timers.lastResolvedFrame();
+      for (int i = 0; i < GPU_PHASE_COUNT; i++) {
+          const GpuPhaseTiming& timing = gpu_timers.phase(static_cast<GpuPhase>(i));
+          gpu_metrics[i].record(timing.gpuMilliseconds);
+          recorder.counter(gpuPhaseName(static_cast<GpuPhase>(i)), timing.gpuMilliseconds);
+      }
+  }
+
   glUseProgram(program);
   VP = glm::perspective(glm::radians(90.0f), float(window_w) / float(window_h), 0.1f, 150.0f)
       * camera.transform();
@@ -243,7 +341,21 @@ void Client::draw(double dt) {
 
   glBindVertexArray(vao);
 
+  // agents are tinted by behavior state when the state machine is running
+  const glm::vec3 state_colors[BOID_STATE_COUNT] = { {1,0,1}, {1,0.2f,0}, {0,0.6f,1}, {0.1f,0.7f,0.1f} };
+  GLint udiffuse_color = glGetUniformLocation(program, "diffuse_color");
+
+  uint64_t draw_start = recorder.now();
+  gpu_timers.begin(GpuPhase::BOIDS);
   for (Boid& boid : boids) {
+      if (!boid.alive)
+          continue;
+      if (params.EnableBehaviorStates) {
+          const glm::vec3& color = state_colors[static_cast<int>(boid.state)];
+          glUniform3f(udiffuse_color, color.x, color.y, color.z);
+      }
+      if (boid.id == picked_id)
+          glUniform3f(udiffuse_color, 1, 0.8f, 0);
       // orient mesh in direction of particle velocity,
       //   and parallel to plane of motion
       glm::vec3 w = -glm::normalize(boid.velocity),
@@ -256,7 +368,15 @@ void Client::draw(double dt) {
       glUniformMatrix4fv(umodel_matrix, 1, false, &M[0][0]);
       glUniformMatrix4fv(unormal_matrix, 1, false, &N[0][0]);
       glDrawElements(GL_TRIANGLES, 6 * 3, GL_UNSIGNED_INT, 0);
+      if (boid.id == picked_id && !params.EnableBehaviorStates)
+          glUniform3f(udiffuse_color, 1, 0, 1);
   }
+  gpu_timers.end(GpuPhase::BOIDS);
+  recorder.phase("draw boids", draw_start, recorder.now());
+
+  glUniform3f(udiffuse_color, 1, 0, 1);
+  draw_start = recorder.now();
+  gpu_timers.begin(GpuPhase::OBSTACLES);
 
   // draw world target cube
   glm::mat4 model = glm::mat4(1.0f);
@@ -268,15 +388,24 @@ void Client::draw(double dt) {
 
   // draw world collision sphere
   model = glm::mat4(1.0f);
-  model = glm::translate(model, flock.CollisionCenter);
-  model = glm::scale(model, glm::vec3(flock.CollisionRadius, flock.CollisionRadius, flock.CollisionRadius));
+  model = glm::translate(model, params.CollisionCenter);
+  model = glm::scale(model, glm::vec3(params.CollisionRadius, params.CollisionRadius, params.CollisionRadius));
   glUseProgram(program);
   glUniformMatrix4fv(umodel_matrix, 1, false, &model[0][0]);
   renderSphere();
-
+  gpu_timers.end(GpuPhase::OBSTACLES);
+  recorder.phase("draw obstacles", draw_start, recorder.now());
 
   glBindVertexArray(0);
 
+  if (show_overlay) {
+      draw_start = recorder.now();
+      gpu_timers.begin(GpuPhase::OVERLAY);
+      overlay_renderer.draw(overlay, VP);
+      gpu_timers.end(GpuPhase::OVERLAY);
+      recorder.phase("draw overlay", draw_start, recorder.now());
+  }
+
   // start the Dear ImGui frame
   ImGui_ImplOpenGL3_NewFrame();
   ImGui_ImplSDL2_NewFrame(window);
@@ -288,27 +417,27 @@ void Client::draw(double dt) {
       if (ImGui::CollapsingHeader("Agent Settings")) {
           ImGui::Checkbox("Show tooltips", &show_tooltips);
 
-          ImGui::SliderFloat("Perception radius", &flock.PerceptionRadius, 1.0f, 40.0f, "%.3f");
+          ImGui::SliderFloat("Perception radius", &params.PerceptionRadius, 1.0f, 40.0f, "%.3f");
           if (show_tooltips && ImGui::IsItemHovered())
               ImGui::SetTooltip("Perception refers to the vision of each boid.Only boids within this distance influence each other");
 
-          ImGui::SliderFloat("Separation weight", &flock.SeparationWeight, 0.1f, 5.0f, "%.3f");
+          ImGui::SliderFloat("Separation weight", &params.SeparationWeight, 0.1f, 5.0f, "%.3f");
           if (show_tooltips && ImGui::IsItemHovered())
               ImGui::SetTooltip("How much agents repel each other");
           const char* separationType[] = { "LINEAR", "INVERSE LINEAR", "QUADRATIC", "INVERSE QUADRATIC"};
           if (ImGui::Combo("Separation function", &separation_type, separationType, IM_ARRAYSIZE(separationType))) {
               switch (separation_type) {
               case 0:
-                  flock.SeparationType = DistanceType::LINEAR;
+                  params.SeparationType = DistanceType::LINEAR;
                   break;
               case 1:
-                  flock.SeparationType = DistanceType::INVERSE_LINEAR;
+                  params.SeparationType = DistanceType::INVERSE_LINEAR;
                   break;
               case 2:
-                  flock.SeparationType = DistanceType::QUADRATIC;
+                  params.SeparationType = DistanceType::QUADRATIC;
                   break;
               case 3:
-                  flock.SeparationType = DistanceType::INVERSE_QUADRATIC;
+                  params.SeparationType = DistanceType::INVERSE_QUADRATIC;
                   break;
               default:
                   break;
@@ -318,31 +447,394 @@ void Client::draw(double dt) {
               ImGui::SetTooltip("Function that controls the rate of separation between agents");
 
 
-          ImGui::SliderFloat("Alignment weight", &flock.AlignmentWeight, 0.1f, 5.0f, "%.3f");
+          ImGui::SliderFloat("Alignment weight", &params.AlignmentWeight, 0.1f, 5.0f, "%.3f");
           if (show_tooltips && ImGui::IsItemHovered())
               ImGui::SetTooltip("How much agent's velocity matches its neighboring agents");
 
-          ImGui::SliderFloat("Cohesion weight", &flock.CohesionWeight, 0.1f, 5.0f, "%.3f");
+          ImGui::SliderFloat("Cohesion weight", &params.CohesionWeight, 0.1f, 5.0f, "%.3f");
           if (show_tooltips && ImGui::IsItemHovered())
               ImGui::SetTooltip("How much agent should stay close to its neighboring agents");
 
-          ImGui::SliderFloat("Steering weight", &flock.SteeringWeight, 0.1f, 10.0f, "%.3f");
+          ImGui::SliderFloat("Steering weight", &params.SteeringWeight, 0.1f, 10.0f, "%.3f");
           if (show_tooltips && ImGui::IsItemHovered())
               ImGui::SetTooltip("How much agents should home in on a target location");
 
-          ImGui::SliderFloat("Max acceleration", &flock.MaxAcceleration, 1.0f, 10.0f, "%.3f");
-          ImGui::SliderFloat("Max velocity", &flock.MaxVelocity, 1.0f, 20.0f, "%.3f");
+          int neighbor_model = static_cast<int>(params.InteractionModel);
+          const char* neighborModel[] = { "RADIUS", "VISUAL" };
+          if (ImGui::Combo("Neighbor model", &neighbor_model, neighborModel, IM_ARRAYSIZE(neighborModel))) {
+              params.InteractionModel = static_cast<NeighborModel>(neighbor_model);
+          }
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("RADIUS: every agent in range. VISUAL: only the nearest agent seen in each of 20 view directions");
+
+          ImGui::SliderInt("Max neighbors", &params.MaxNeighbors, 0, 32);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("With the RADIUS model, only the k nearest agents in range interact (0 = no limit)");
+
+          ImGui::SliderFloat("Max acceleration", &params.MaxAcceleration, 1.0f, 10.0f, "%.3f");
+          ImGui::SliderFloat("Max velocity", &params.MaxVelocity, 1.0f, 20.0f, "%.3f");
+      }
+
+      if (ImGui::CollapsingHeader("Neighbor Queries")) {
+          ImGui::Checkbox("Warm start from last frame", &params.WarmStartNeighbors);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Seed each neighbor query with the agent's neighbors from the previous frame");
+          ImGui::Checkbox("Hilbert voxel order", &params.HilbertCellOrder);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Visit voxels along a Hilbert curve so consecutive voxels share most of their neighborhood");
+          ImGui::Checkbox("Prefetch next voxel", &params.PrefetchCells);
+          ImGui::Checkbox("Cached neighbor lists (Verlet)", &params.VerletNeighbors);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Query compressed per agent candidate lists, rebuilt once an agent moved more than half the skin");
+          if (params.VerletNeighbors) {
+              ImGui::SliderFloat("Verlet skin", &params.VerletSkin, 0.0f, 10.0f, "%.2f");
+              const NeighborListStats& list_stats = flock.getNeighborListStats();
+              ImGui::Text("Lists: %lld entries, %.2f MB compressed (%.2fx smaller), %lld rebuilds",
+                  list_stats.entries, list_stats.compressedBytes / (1024.0 * 1024.0), list_stats.ratio(), list_stats.rebuilds);
+          }
+
+          const NeighborStats& stats = flock.getNeighborStats();
+          ImGui::Text("Queries = %i, neighbor pass %.3f ms", stats.queries, stats.passMilliseconds);
+          ImGui::Text("Candidates tested = %lld, culled by k-th distance = %lld", stats.candidates, stats.culled);
+          ImGui::Text("Voxels skipped = %lld", stats.skippedVoxels);
+          ImGui::Text("Warm candidates = %lld", stats.warmCandidates);
+          ImGui::Text("Confirmed = %lld, discovered = %lld (hit rate %.1f%%)", stats.confirmed, stats.discovered, 100.0f * stats.hitRate());
+      }
+
+      if (ImGui::CollapsingHeader("Memory")) {
+          int page_mode = static_cast<int>(hugePageMode().load());
+          const char* pageModes[] = { "OFF", "TRANSPARENT", "EXPLICIT" };
+          if (ImGui::Combo("Huge pages", &page_mode, pageModes, IM_ARRAYSIZE(pageModes))) {
+              hugePageMode() = static_cast<HugePageMode>(page_mode);
+          }
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Backing of the large simulation arrays; applies to arrays allocated from now on");
+
+          const HugePageStats& pages = hugePageStats();
+          const float MB = 1.0f / (1024.0f * 1024.0f);
+          ImGui::Text("Explicit huge pages    = %.1f MB", pages.explicitBytes.load() * MB);
+          ImGui::Text("Transparent huge pages = %.1f MB", pages.transparentBytes.load() * MB);
+          ImGui::Text("Regular pages          = %.1f MB", pages.regularBytes.load() * MB);
+          ImGui::Text("Heap                   = %.1f MB", pages.heapBytes.load() * MB);
+          ImGui::Text("Huge page fallbacks    = %lld", pages.fallbacks.load());
+          long long thp = transparentHugePagesInUse();
+          if (thp >= 0)
+              ImGui::Text("Process AnonHugePages  = %.1f MB", thp * MB);
+
+          ImGui::Separator();
+          ImGui::Text("%-12s %10s %10s %10s", "subsystem", "live KB", "peak KB", "allocs");
+          for (int i = 0; i < MEMORY_TAG_COUNT; i++) {
+              const MemoryAccount& account = memoryAccount(static_cast<MemoryTag>(i));
+              ImGui::Text("%-12s %10.1f %10.1f %10lld", memoryTagName(static_cast<MemoryTag>(i)),
+                          account.liveBytes.load() / 1024.0f, account.peakBytes.load() / 1024.0f, account.allocations.load());
+          }
+          if (ImGui::Button("Reset peaks"))
+              resetMemoryPeaks();
+          int alive = pool.alive();
+          if (alive > 0)
+              ImGui::Text("Boids + voxel map + neighbors = %.0f bytes/agent",
+                          double(memoryAccount(MemoryTag::BOIDS).liveBytes.load() + memoryAccount(MemoryTag::VOXEL_MAP).liveBytes.load()
+                                 + memoryAccount(MemoryTag::NEIGHBORS).liveBytes.load()) / alive);
+      }
+
+      if (ImGui::CollapsingHeader("Behavior States")) {
+          ImGui::Checkbox("Enable behavior states", &params.EnableBehaviorStates);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Agents switch between flocking, fleeing, resting and foraging, each with its own rule weights");
+
+          StateTransitions& transitions = params.StateTransitionSettings;
+          ImGui::SliderFloat("Flee distance", &transitions.FleeDistance, 0.0f, 10.0f, "%.3f");
+          ImGui::SliderFloat("Rest distance", &transitions.RestDistance, 0.0f, 10.0f, "%.3f");
+          ImGui::SliderFloat("Forage distance", &transitions.ForageDistance, 1.0f, 40.0f, "%.3f");
+          ImGui::SliderFloat("Min state duration", &transitions.MinStateDuration, 0.0f, 5.0f, "%.3f");
+
+          ImGui::Text("Flocking (magenta) = %i", flock.stateCount(BoidState::FLOCKING));
+          ImGui::Text("Fleeing (orange)   = %i", flock.stateCount(BoidState::FLEEING));
+          ImGui::Text("Resting (blue)     = %i", flock.stateCount(BoidState::RESTING));
+          ImGui::Text("Foraging (green)   = %i", flock.stateCount(BoidState::FORAGING));
+      }
+
+      if (ImGui::CollapsingHeader("Custom Rule")) {
+          ImGui::Checkbox("Enable custom rule", &params.EnableCustomRule);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Adds the force computed by the rule below to every agent");
+          ImGui::InputTextMultiline("##rule", rule_text, sizeof(rule_text), ImVec2(-1.0f, ImGui::GetTextLineHeight() * 8));
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Inputs: neighbors, speed, targetDistance, obstacleDistance, position, velocity,\n"
+                                "separation, alignment, cohesion, toTarget, toObstacle");
+          if (ImGui::Button("Compile")) {
+              params.CustomRule = compileRule(rule_text);
+          }
+          ImGui::SameLine();
+          if (params.CustomRule.valid)
+              ImGui::Text("%i instructions, %i registers", static_cast<int>(params.CustomRule.code.size()), params.CustomRule.registerCount);
+          else
+              ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", params.CustomRule.error.c_str());
+          for (RuleParameter& parameter : params.CustomRule.parameters) {
+              ImGui::SliderFloat(parameter.name.c_str(), &parameter.value, -10.0f, 10.0f, "%.3f");
+          }
+      }
+
+      if (ImGui::CollapsingHeader("World Streaming")) {
+          ImGui::Checkbox("Page out distant chunks", &stream_world);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Agents in chunks far from the camera and the target are written to disk and read back when approached");
+          ImGui::SliderFloat("Chunk size", &world.ChunkSize, 4.0f, 128.0f, "%.1f");
+          ImGui::SliderFloat("Active radius", &world.ActiveRadius, 4.0f, 256.0f, "%.1f");
+          int max_resident = static_cast<int>(world.MaxResidentAgents);
+          if (ImGui::SliderInt("Max resident agents", &max_resident, 1, 1 << 22))
+              world.MaxResidentAgents = max_resident;
+
+          const ChunkStreamStats& chunk_stats = world.getStats();
+          ImGui::Text("Resident: %lld agents in %i chunks", chunk_stats.residentAgents, chunk_stats.residentChunks);
+          ImGui::Text("Paged out: %lld agents in %i chunks (%.1f MB)", chunk_stats.pagedOutAgents, chunk_stats.pagedOutChunks, chunk_stats.bytesOnDisk / (1024.0f * 1024.0f));
+          ImGui::Text("Pending jobs = %i, page outs = %lld, page ins = %lld", chunk_stats.pendingJobs, chunk_stats.pageOuts, chunk_stats.pageIns);
+          ImGui::Text("Failed writes = %lld, lost agents = %lld", chunk_stats.failedWrites, chunk_stats.lostAgents);
+          ImGui::Text("Residency pass %.3f ms", chunk_stats.planMilliseconds);
+      }
+
+      if (ImGui::CollapsingHeader("Debug Overlay")) {
+          ImGui::Checkbox("Show overlay", &show_overlay);
+          if (!overlay_renderer.available())
+              ImGui::Text("Needs OpenGL 3.3");
+          ImGui::Checkbox("Occupied voxels", &overlay.ShowVoxels);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Blue to red by the heat below");
+          const char* heat_names[] = { "Candidates", "Pair tests", "Time" };
+          int heat = static_cast<int>(overlay.Heat);
+          if (ImGui::Combo("Voxel heat", &heat, heat_names, IM_ARRAYSIZE(heat_names)))
+              overlay.Heat = static_cast<OverlayHeat>(heat);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Pair tests and time are measured by the hot cell profile, which turns on with them");
+          ImGui::Checkbox("Neighbor links of the picked agent", &overlay.ShowLinks);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Shift + right click an agent to pick it");
+          ImGui::Checkbox("Avoidance rays", &overlay.ShowRays);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Red: heading into the obstacle, green: the tangent the agent turns to");
+          if (show_overlay) {
+              ImGui::Text("Voxels = %i, most candidates = %i", int(overlay.voxels().size()), overlay.maxCandidates());
+              ImGui::Text("Lines = %i, dropped = %lld", int(overlay.segments().size()), overlay.droppedLines());
+          }
+      }
+
+      if (ImGui::CollapsingHeader("Hot Cells")) {
+          ImGui::Checkbox("Profile voxels", &profile_cells);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Pair tests and neighbor pass time per occupied voxel");
+          ImGui::SliderInt("Top voxels", &hot_cells.TopK, 1, 32);
+          if (profile_cells && hot_cells.profiledFrames() > 0) {
+              ImGui::Text("%i voxels, %lld pair tests, %.3f ms", int(hot_cells.allCells().size()), hot_cells.pairTests(),
+                          hot_cells.microseconds() * 1e-3);
+              ImGui::Text("Occupancy mean %.1f, max %i", hot_cells.meanOccupancy(), hot_cells.maxOccupancy());
+              ImGui::Text("Top %i: %.1f%% of the time (mean %.1f%%)", int(hot_cells.hottest().size()),
+                          100.0 * hot_cells.topShare(), 100.0 * hot_cells.meanTopShare());
+              ImGui::Columns(4, "hot cells");
+              ImGui::Text("voxel"); ImGui::NextColumn();
+              ImGui::Text("agents"); ImGui::NextColumn();
+              ImGui::Text("pair tests"); ImGui::NextColumn();
+              ImGui::Text("us"); ImGui::NextColumn();
+              for (const CellCost& cell : hot_cells.hottest()) {
+                  ImGui::Text("%i,%i,%i", int(cell.voxel.x), int(cell.voxel.y), int(cell.voxel.z)); ImGui::NextColumn();
+                  ImGui::Text("%i", cell.occupancy); ImGui::NextColumn();
+                  ImGui::Text("%lld", cell.pairTests); ImGui::NextColumn();
+                  ImGui::Text("%.1f", cell.microseconds); ImGui::NextColumn();
+              }
+              ImGui::Columns(1);
+          }
+      }
+
+      if (ImGui::CollapsingHeader("Force Breakdown")) {
+          ImGui::Checkbox("Record per agent forces", &record_forces);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Keeps every rule's contribution to the acceleration; costs nothing when off");
+          ImGui::Text("Shift + right click an agent to inspect it");
+          int slot = -1;
+          for (size_t i = 0; i < boids.size() && picked_id != 0; i++) {
+              if (boids[i].alive && boids[i].id == picked_id) {
+                  slot = int(i);
+                  break;
+              }
+          }
+          if (slot < 0) {
+              if (picked_id != 0)
+                  ImGui::Text("Agent %u is gone", picked_id);
+              else
+                  ImGui::Text("No agent picked");
+          }
+          else if (!record_forces || size_t(slot) >= forces.size()) {
+              ImGui::Text("Agent %u (start recording to see its forces)", picked_id);
+          }
+          else {
+              ImGui::Text("Agent %u, %i neighbors", picked_id,
+                          int(flock.getNeighborIds(slot).size()));
+              for (int c = 0; c < FORCE_COMPONENT_COUNT; c++) {
+                  const glm::vec3& v = forces.at(static_cast<ForceComponent>(c), slot);
+                  ImGui::Text("%-10s %8.3f  (%7.3f %7.3f %7.3f)", forceComponentName(static_cast<ForceComponent>(c)),
+                              glm::length(v), v.x, v.y, v.z);
+              }
+              ImGui::Text("Dominant: %s", forceComponentName(forces.dominant(slot)));
+          }
+          if (record_forces && ImGui::Button("Export CSV")) {
+              std::string path = "forces_" + std::to_string(frame_count) + ".csv";
+              std::string error;
+              forces_status = forces.writeCsv(path.c_str(), boids, error) ? "wrote " + path : error;
+          }
+          if (!forces_status.empty())
+              ImGui::Text("%s", forces_status.c_str());
+      }
+
+      if (ImGui::CollapsingHeader("Hardware Counters")) {
+          if (ImGui::Checkbox("Count per phase", &count_phases)) {
+              if (count_phases)
+                  perf_counters.open();
+              else
+                  perf_counters.close();
+              flock.Counters = count_phases ? &perf_counters : nullptr;
+          }
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Linux perf_event_open counters around the grid build, the neighbor pass and integration");
+          if (count_phases && !perf_counters.lastError().empty())
+              ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", perf_counters.lastError().c_str());
+          if (count_phases && perf_counters.available()) {
+              ImGui::Text("%-10s %8s %5s %8s %8s %8s %8s", "phase", "ms", "ipc", "L1d", "LLC", "branch", "dTLB");
+              for (int p = 0; p < PERF_PHASE_COUNT; p++) {
+                  const PhaseCounts& counts = perf_counters.phase(static_cast<PerfPhase>(p));
+                  ImGui::Text("%-10s %8.3f %5.2f %8.3f %8.3f %8.3f %8.3f", perfPhaseName(static_cast<PerfPhase>(p)),
+                      counts.milliseconds, counts.ipc(), counts.perAgent(PerfCounter::L1D_MISSES),
+                      counts.perAgent(PerfCounter::LLC_MISSES), counts.perAgent(PerfCounter::BRANCH_MISSES),
+                      counts.perAgent(PerfCounter::DTLB_MISSES));
+              }
+              ImGui::Text("misses per agent; unavailable counters read 0");
+          }
+      }
+
+      if (ImGui::CollapsingHeader("GPU Timing")) {
+          if (!gpu_timers.available()) {
+              ImGui::Text("Timer queries unavailable (needs GL 3.3 or ARB_timer_query)");
+          }
+          else {
+              double cpu_total = 0, gpu_total = 0;
+              ImGui::Text("%-10s %10s %10s", "phase", "cpu ms", "gpu ms");
+              for (int i = 0; i < GPU_PHASE_COUNT; i++) {
+                  const GpuPhaseTiming& timing = gpu_timers.phase(static_cast<GpuPhase>(i));
+                  ImGui::Text("%-10s %10.3f %10.3f", gpuPhaseName(static_cast<GpuPhase>(i)), timing.cpuMilliseconds, timing.gpuMilliseconds);
+                  cpu_total += timing.cpuMilliseconds;
+                  gpu_total += timing.gpuMilliseconds;
+              }
+              ImGui::Text("%-10s %10.3f %10.3f", "total", cpu_total, gpu_total);
+              if (show_tooltips && ImGui::IsItemHovered())
+                  ImGui::SetTooltip("cpu = time to submit the draws, gpu = time to execute them (frame %u)", gpu_timers.lastResolvedFrame());
+              ImGui::Text("%s", gpu_total > cpu_total ? "Rendering is GPU bound" : "Rendering is CPU bound (submission)");
+              ImGui::Text("Frames resolved = %lld, untimed while in flight = %lld", gpu_timers.resolvedFrames(), gpu_timers.lateFrames());
+          }
+      }
+
+      if (ImGui::CollapsingHeader("Flight Recorder")) {
+          ImGui::Checkbox("Dump frames over budget", &recorder.DumpSpikes);
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Writes spike_<frame>.trace.json (chrome://tracing) and spike_<frame>.checkpoint, which --replay steps through the spike frame");
+          float budget = float(recorder.FrameBudgetMs);
+          if (ImGui::SliderFloat("Frame budget (ms)", &budget, 5.0f, 500.0f, "%.1f"))
+              recorder.FrameBudgetMs = budget;
+          float window = float(recorder.WindowSeconds);
+          if (ImGui::SliderFloat("History (s)", &window, 0.5f, 10.0f, "%.1f"))
+              recorder.WindowSeconds = window;
+          FlightRecorderStats recorder_stats = recorder.getStats();
+          ImGui::Text("Threads = %i, events = %lld", recorder_stats.threads, recorder_stats.events);
+          ImGui::Text("Spikes = %i, dumps = %i, worst frame = %.1f ms", recorder_stats.spikes, recorder_stats.dumps, recorder_stats.worstFrameMs);
+          if (!recorder_stats.lastDump.empty())
+              ImGui::Text("Last dump: %s", recorder_stats.lastDump.c_str());
+      }
+
+      if (ImGui::CollapsingHeader("State Stream")) {
+          if (ImGui::Checkbox("Stream state on flock.sock", &stream_state)) {
+              if (stream_state)
+                  stream_state = state_stream.start("flock.sock");
+              else
+                  state_stream.stop();
+          }
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Viewers connect to the UNIX socket flock.sock and subscribe to a box or frustum of the world");
+          ImGui::SliderFloat("Shared interest grid", &state_stream.ShareGrid, 1.0f, 32.0f, "%.1f");
+          const StateStreamStats& stream_stats = state_stream.getStats();
+          ImGui::Text("Clients = %i sharing %i encoders", stream_stats.clients, stream_stats.groups);
+          ImGui::Text("Updates = %lld, encoded %.1f KB, sent %.1f KB", stream_stats.updates,
+              stream_stats.bytesEncoded / 1024.0f, stream_stats.bytesSent / 1024.0f);
+          ImGui::Text("Dropped slow clients = %lld", stream_stats.dropped);
+      }
+
+      if (ImGui::CollapsingHeader("Emitters & Sinks")) {
+          if (ImGui::Checkbox("Emit and absorb agents", &churn)) {
+              pool.Emitters.clear();
+              pool.Sinks.clear();
+              if (churn) {
+                  BoidPool<FloatTraits>::Emitter emitter;
+                  emitter.Center = glm::vec3(6, 6, 0);
+                  pool.Emitters.push_back(emitter);
+                  BoidPool<FloatTraits>::Sink sink;
+                  sink.Center = cursor_pos;
+                  pool.Sinks.push_back(sink);
+              }
+          }
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Agents stream out of a sphere at (6, 6, 0) and are removed when they reach the target");
+          if (!pool.Emitters.empty())
+              ImGui::SliderFloat("Spawn rate (agents/s)", &pool.Emitters[0].Rate, 0.0f, 5000.0f, "%.0f");
+          if (!pool.Sinks.empty())
+              ImGui::SliderFloat("Sink radius", &pool.Sinks[0].Radius, 0.1f, 10.0f, "%.2f");
+          ImGui::SliderFloat("Compaction threshold", &pool.CompactionThreshold, 0.0f, 1.0f, "%.2f");
+
+          const BoidPoolStats& pool_stats = pool.getStats();
+          ImGui::Text("Alive = %i in %i slots", pool_stats.alive, pool_stats.slots);
+          ImGui::Text("Spawned = %i, despawned = %i this frame", pool_stats.spawnedThisFrame, pool_stats.despawnedThisFrame);
+          ImGui::Text("Compaction moves = %i, reallocations = %lld", pool_stats.compactionMoves, pool_stats.reallocations);
+      }
+
+      if (ImGui::CollapsingHeader("Proximity Events")) {
+          if (ImGui::Checkbox("Report enter / exit events", &track_proximity)) {
+              flock.Proximity = track_proximity ? &proximity : nullptr;
+              proximity.Triggers.clear();
+              if (track_proximity) {
+                  ProximityTrigger player;
+                  player.Id = 1;
+                  player.Radius = 3.0f;
+                  proximity.Triggers.push_back(player);
+              }
+          }
+          if (show_tooltips && ImGui::IsItemHovered())
+              ImGui::SetTooltip("Neighbor changes and agents entering or leaving a trigger sphere that follows the target");
+          ImGui::Checkbox("Neighbor events", &proximity.TrackNeighbors);
+          if (!proximity.Triggers.empty())
+              ImGui::SliderFloat("Trigger radius", &proximity.Triggers[0].Radius, 0.1f, 20.0f, "%.2f");
+
+          const ProximityStats& proximity_stats = proximity.getStats();
+          ImGui::Text("Neighbor enters = %i, exits = %i", proximity_stats.neighborEnters, proximity_stats.neighborExits);
+          ImGui::Text("Trigger enters = %i, exits = %i", proximity_stats.triggerEnters, proximity_stats.triggerExits);
+          ImGui::Text("Dropped events = %lld", proximity_stats.dropped);
+          for (auto iter = trigger_log.rbegin(); iter != trigger_log.rend(); ++iter) {
+              ImGui::Text("frame %u: agent %u %s trigger %u", iter->frame, iter->agent,
+                  iter->type == ProximityEventType::TRIGGER_ENTER ? "entered" : "left", iter->observer);
+          }
       }
 
-      ImGui::Text("Agents in scene = %i", boids.size()); ImGui::SameLine(200);
+      ImGui::Text("Agents in scene = %i", pool.alive()); ImGui::SameLine(200);
       if (ImGui::Button("Add Agent"))
       {
-          // create a random agent
-          float random_x = cursor_pos.x + random_double(-2.0, 2.0);
-          float random_y = cursor_pos.y + random_double(-2.0, 2.0);
-          float random_z = cursor_pos.z + random_double(-2.0, 2.0);
-          boids.push_back(Boid(glm::vec3(random_x, random_y, random_z), 
-              glm::vec3(random_double(-1.0, 1.0), random_double(-1.0, 1.0), random_double(-1.0, 1.0))));
+          // create a random agent near the target
+          commands.push(CommandBatch{ FlockCommand::spawn(1, cursor_pos, 2.0f, glm::vec3(0), 1.0f) });
+      }
+      ImGui::Text("Commands last frame = %i (%i batches), queued = %lld", command_stats.commands, command_stats.batches, commands.depth());
+      ImGui::Text("Spawned = %i, despawned = %i, apply = %.3f ms", command_stats.spawned, command_stats.despawned, command_stats.applyMilliseconds);
+      if (ImGui::Checkbox("Serve metrics on 127.0.0.1:9464", &serve_metrics)) {
+          if (serve_metrics)
+              serve_metrics = metrics_server.start(9464);
+          else
+              metrics_server.stop();
+      }
+      if (metrics_server.running()) {
+          ImGui::SameLine();
+          ImGui::Text("(%lld scrapes)", metrics_server.scrapes());
       }
       ImGui::Text("World target position (%.3f, %.3f, %.3f)", cursor_pos.x, cursor_pos.y, cursor_pos.z);
       ImGui::Text("Camera position (%.3f, %.3f, %.3f)", camera.eye().x, camera.eye().y, camera.eye().z);
@@ -359,13 +851,87 @@ void Client::draw(double dt) {
   }
   // rendering
   ImGui::Render();
+  draw_start = recorder.now();
+  gpu_timers.begin(GpuPhase::IMGUI);
   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+  gpu_timers.end(GpuPhase::IMGUI);
+  gpu_timers.endFrame();
+  recorder.phase("draw imgui", draw_start, recorder.now());
+  end_phase(recorder, metrics.render, "render", frame_start);
 
   if (cpu_load)
     this_thread::sleep_for(chrono::milliseconds(100));
 
   // update our agent-based simulation
+  if (stream_world) {
+      world.Observers.assign(1, camera.eye());
+      world.Observers.push_back(cursor_pos);
+      world.update(dt);
+  }
+  uint64_t phase_start = recorder.now();
+  command_batches.clear();
+  commands.drain(command_batches);
+  command_stats = applyCommands(command_batches, pool, params, command_rng, command_stats);
+  phase_start = end_phase(recorder, metrics.commands, "commands", phase_start);
+  if (!pool.Sinks.empty())
+      pool.Sinks[0].Center = cursor_pos;
+  pool.update(dt);
+  phase_start = end_phase(recorder, metrics.pool, "pool", phase_start);
+  if (!proximity.Triggers.empty())
+      proximity.Triggers[0].Center = cursor_pos;
+  flock.setParams(params);
+  flock.Forces = record_forces ? &forces : nullptr;
+  flock.Overlay = show_overlay ? &overlay : nullptr;
+  bool profile = profile_cells || (show_overlay && overlay.Heat != OverlayHeat::CANDIDATES);
+  flock.HotCells = profile ? &hot_cells : nullptr;
+  overlay.SelectedId = picked_id;
   flock.update(dt);
+  end_phase(recorder, metrics.flock, "flock", phase_start);
+
+  proximity_events.clear();
+  while (proximity.drain(proximity_events) > 0) {}
+  for (const ProximityEvent& e : proximity_events) {
+      if (e.type == ProximityEventType::TRIGGER_ENTER || e.type == ProximityEventType::TRIGGER_EXIT) {
+          trigger_log.push_back(e);
+      }
+  }
+  if (trigger_log.size() > 8)
+      trigger_log.erase(trigger_log.begin(), trigger_log.end() - 8);
+
+  metrics.publishFlock(flock, pool.alive(), boids.size());
+  metrics.commandQueueDepth->set(double(commands.depth()));
+  metrics.commandsApplied->set(double(command_stats.totalCommands));
+  metrics.proximityQueueDepth->set(double(proximity.queued()));
+  metrics.proximityDropped->set(double(proximity.getStats().dropped));
+
+  sim_time += dt;
+  state_stream.publish(flock, frame_count, sim_time);
+  metrics.streamClients->set(state_stream.getStats().clients);
+  metrics.streamGroups->set(state_stream.getStats().groups);
+  metrics.streamBytes->set(double(state_stream.getStats().bytesSent));
+  recorder.counter("agents", pool.alive());
+  recorder.counter("neighbor candidates", double(flock.getNeighborStats().candidates));
+  recorder.counter("command queue", double(commands.depth()));
+  metrics.frame.record(double(recorder.now() - frame_start) * 1e-6);
+  recorder.endFrame();
+}
+
+
+// mean CPU submission and GPU execution time of every render phase since start
+void Client::printGpuProfile(ostream& out) const {
+  if (!gpu_timers.available()) {
+    out << "GL timer queries unavailable on " << glGetString(GL_RENDERER) << endl;
+    return;
+  }
+  char line[160];
+  snprintf(line, sizeof(line), "%s, %lld frames timed, %lld untimed while in flight\n%-10s %10s %10s\n",
+           glGetString(GL_RENDERER), gpu_timers.resolvedFrames(), gpu_timers.lateFrames(), "phase", "cpu ms", "gpu ms");
+  out << line;
+  for (int i = 0; i < GPU_PHASE_COUNT; i++) {
+    GpuPhaseTiming mean = gpu_timers.average(static_cast<GpuPhase>(i));
+    snprintf(line, sizeof(line), "%-10s %10.3f %10.3f\n", gpuPhaseName(static_cast<GpuPhase>(i)), mean.cpuMilliseconds, mean.gpuMilliseconds);
+    out << line;
+  }
 }
 
 
@@ -415,7 +981,23 @@ void Client::mousedrag(int x, int y, bool left_button) {
 void Client::mouseclick(int x, int y, bool left_button) {
 
     ImGuiIO& io = ImGui::GetIO();
-    if (!io.WantCaptureMouse && !left_button) {
+    if (!io.WantCaptureMouse && !left_button && (SDL_GetModState() & KMOD_SHIFT) != 0) {
+        // pick the agent closest to the ray through the cursor, for the Force Breakdown panel
+        glm::vec3 world_pos = unProject(glm::vec3(float(x), float(y), 0.0f), VP, glm::vec4(0, 0, window_w, window_h));
+        glm::vec3 pick_dir = glm::normalize(world_pos - camera.eye());
+        float best = 1.0f;      // at most this far from the ray
+        picked_id = 0;
+        for (const Boid& boid : boids) {
+            glm::vec3 to_boid = boid.position - camera.eye();
+            float along = glm::dot(to_boid, pick_dir);
+            float off_ray = glm::length(to_boid - along * pick_dir);
+            if (boid.alive && along > 0 && off_ray < best) {
+                best = off_ray;
+                picked_id = boid.id;
+            }
+        }
+    }
+    else if (!io.WantCaptureMouse && !left_button) {
         glm::vec3 near_plane = glm::vec3(float(x), float(y), 0.0f);
         glm::vec3 world_pos = unProject(near_plane, VP, glm::vec4(0, 0, window_w, window_h));
         // place the cursor point on a plane perpendicular to camera view and close to world origin
@@ -425,10 +1007,10 @@ void Client::mouseclick(int x, int y, bool left_button) {
         float t = glm::dot(wall_point - camera.eye(), planeN) / glm::dot(pick_dir, planeN);
         cursor_pos = camera.eye() + pick_dir * t;
 
-        if (flock.SteeringTargets.empty()) {
-            flock.SteeringTargets.push_back(cursor_pos);
+        if (params.SteeringTargets.empty()) {
+            params.SteeringTargets.push_back(cursor_pos);
         }
-        flock.SteeringTargets[0] = cursor_pos;
+        params.SteeringTargets[0] = cursor_pos;
     }
     last_mouse_x = x;
     last_mouse_y = y;
@@ -450,11 +1032,306 @@ void Client::mousescroll(int yoffset) {
 }
 
 
+/////////////////////////////////////////////////////////////////
+// simulation without a window, serving metrics on localhost; frames == 0 runs until killed
+/////////////////////////////////////////////////////////////////
+static int runHeadless(const BenchmarkConfig& config, int port, const char* stream_path) {
+  BoidList boids;
+  BoidPool<FloatTraits> pool(&boids);
+  Flocker flock;
+  Flocker::Params params;
+  CommandQueue commands;
+  std::vector<CommandBatch> batches;
+  CommandStats stats;
+  std::mt19937 rng(config.seed);
+  MetricsRegistry registry;
+  FlockMetrics metrics(registry);
+  MetricsServer server(registry);
+  if (!server.start(port)) {
+    cerr << "cannot listen on 127.0.0.1:" << port << endl;
+    return 1;
+  }
+  cout << "serving http://127.0.0.1:" << port << "/metrics" << endl;
+  StateStreamServer stream;
+  if (stream_path != nullptr) {
+    if (!stream.start(stream_path)) {
+      cerr << "cannot listen on " << stream_path << endl;
+      return 1;
+    }
+    cout << "streaming state on " << stream_path << endl;
+  }
+
+  FlightRecorder recorder;
+  flock.Recorder = &recorder;
+  HotCellProfile hot_cells;
+  flock.HotCells = &hot_cells;
+  flock.setAgents(&boids);
+  params.SteeringTargets.push_back(glm::vec3(0));
+  commands.push(CommandBatch{ FlockCommand::spawn(config.agents, glm::vec3(0), config.worldSize, glm::vec3(0), 1.0f) });
+  for (int frame = 0; config.frames == 0 || frame < config.frames; frame++) {
+    recorder.beginFrame(uint32_t(frame + 1), params);
+    uint64_t frame_start = recorder.now();
+    batches.clear();
+    commands.drain(batches);
+    stats = applyCommands(batches, pool, params, rng, stats);
+    uint64_t phase_start = end_phase(recorder, metrics.commands, "commands", frame_start);
+    pool.update(config.frameTime);
+    phase_start = end_phase(recorder, metrics.pool, "pool", phase_start);
+    flock.setParams(params);
+    flock.update(config.frameTime);
+    end_phase(recorder, metrics.flock, "flock", phase_start);
+    metrics.publishFlock(flock, pool.alive(), boids.size());
+    metrics.commandQueueDepth->set(double(commands.depth()));
+    metrics.commandsApplied->set(double(stats.totalCommands));
+    stream.publish(flock, uint32_t(frame + 1), (frame + 1) * double(config.frameTime));
+    metrics.streamClients->set(stream.getStats().clients);
+    metrics.streamGroups->set(stream.getStats().groups);
+    metrics.streamBytes->set(double(stream.getStats().bytesSent));
+    recorder.counter("agents", pool.alive());
+    recorder.counter("hot cell share", hot_cells.topShare());
+    metrics.frame.record(double(recorder.now() - frame_start) * 1e-6);
+    if (recorder.endFrame()) {
+      cout << "frame " << frame + 1 << " over budget, writing " << recorder.getStats().lastDump << endl;
+      hot_cells.print(cout);
+    }
+  }
+  cout << "frames = " << config.frames << ", scrapes = " << server.scrapes() << endl;
+  printMemoryAccounts(cout);
+  cout << endl;
+  hot_cells.print(cout);
+  return 0;
+}
+
+
+/////////////////////////////////////////////////////////////////
+// reruns a spike checkpoint with per phase timings (and hardware counters where available)
+/////////////////////////////////////////////////////////////////
+static int runReplay(const char* path, int frames, const char* forces_path) {
+  BoidList boids;
+  Flocker::Params params;
+  FlightCheckpoint checkpoint;
+  std::string error;
+  if (!readCheckpoint(path, boids, checkpoint, error)) {
+    cerr << path << ": " << error << endl;
+    return 1;
+  }
+  Flocker flock(&boids);
+  PerfCounters counters;
+  if (!counters.open())
+    cout << "hardware counters unavailable: " << counters.lastError() << endl;
+  flock.Counters = &counters;
+  ForceBreakdown forces;
+  if (forces_path != nullptr)
+    flock.Forces = &forces;
+  // the logged frames run from the checkpointed agents through the spike, then `frames` more
+  // with the parameters and time step of the spike frame
+  const std::vector<CheckpointFrame>& logged = checkpoint.frames;
+  cout << boids.size() << " agents before frame " << logged.front().frame << ", spike at frame " << logged.back().frame << endl;
+  char line[200];
+  snprintf(line, sizeof(line), "%8s %10s %10s %10s %10s %6s\n", "frame", "ms", "grid", "neighbors", "integrate", "ipc");
+  cout << line;
+  for (size_t f = 0; f < logged.size() + size_t(std::max(frames, 0)); f++) {
+    const CheckpointFrame& frame = logged[std::min(f, logged.size() - 1)];
+    applyCheckpointFrame(checkpoint, frame, params);
+    flock.setParams(params);
+    auto start = chrono::steady_clock::now();
+    flock.update(frame.frameTime);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    const PhaseCounts& neighbors = counters.phase(PerfPhase::NEIGHBORS);
+    uint32_t number = frame.frame + uint32_t(f + 1 > logged.size() ? f + 1 - logged.size() : 0);
+    snprintf(line, sizeof(line), "%8u %10.3f %10.3f %10.3f %10.3f %6.2f%s\n", number, ms,
+             counters.phase(PerfPhase::GRID).milliseconds, neighbors.milliseconds,
+             counters.phase(PerfPhase::INTEGRATE).milliseconds, neighbors.ipc(), f + 1 == logged.size() ? "  spike" : "");
+    cout << line;
+  }
+  if (forces_path != nullptr) {
+    std::string error;
+    if (!forces.writeCsv(forces_path, boids, error)) {
+      cerr << error << endl;
+      return 1;
+    }
+    cout << "forces of the last frame written to " << forces_path << endl;
+  }
+  return 0;
+}
+
+
+/////////////////////////////////////////////////////////////////
+// agents spread over the world cube as in the benchmarks, with a target and the obstacle
+/////////////////////////////////////////////////////////////////
+static void seedFlock(const BenchmarkConfig& config, BoidList& boids, Flocker& flock) {
+  std::mt19937 rng(config.seed);
+  std::uniform_real_distribution<float> range(-config.worldSize, config.worldSize);
+  for (int i = 0; i < config.agents; i++) {
+    glm::vec3 position(range(rng), range(rng), range(rng));
+    glm::vec3 velocity(range(rng), range(rng), range(rng));
+    boids.push_back(Boid(position, velocity * 0.05f));
+  }
+  flock.setAgents(&boids);
+  flock.editParams([](Flocker::Params& p) {
+    p.SteeringTargets.push_back(glm::vec3(0));
+    p.CollisionRadius = 2;
+    p.CollisionCenter = glm::vec3(-3, -3, 0);
+  });
+}
+
+
+/////////////////////////////////////////////////////////////////
+// seeded flock, with the forces of the last frame written as CSV
+/////////////////////////////////////////////////////////////////
+static int runForceExport(const BenchmarkConfig& config, const char* path) {
+  BoidList boids;
+  Flocker flock;
+  seedFlock(config, boids, flock);
+  ForceBreakdown forces;
+  flock.Forces = &forces;
+  for (int f = 0; f < config.frames; f++)
+    flock.update(config.frameTime);
+  std::string error;
+  if (!forces.writeCsv(path, boids, error)) {
+    cerr << error << endl;
+    return 1;
+  }
+  int dominant[FORCE_COMPONENT_COUNT] = {};
+  for (size_t i = 0; i < boids.size(); i++)
+    dominant[static_cast<int>(forces.dominant(i))]++;
+  cout << boids.size() << " agents written to " << path << ", dominant rule:";
+  for (int c = 0; c < FORCE_RULE_COUNT; c++)
+    cout << " " << forceComponentName(static_cast<ForceComponent>(c)) << " " << dominant[c];
+  cout << endl;
+  return 0;
+}
+
+
+/////////////////////////////////////////////////////////////////
+// seeded flock with the hot cell profile; a summary line every 10 frames and the report of the
+// last frame.  A radius other than 0 overrides the perception radius, which is the voxel edge.
+/////////////////////////////////////////////////////////////////
+static int runHotCells(const BenchmarkConfig& config, int top, float radius) {
+  BoidList boids;
+  Flocker flock;
+  seedFlock(config, boids, flock);
+  if (radius > 0)
+    flock.editParams([radius](Flocker::Params& p) { p.PerceptionRadius = radius; });
+  HotCellProfile hot_cells;
+  hot_cells.TopK = top;
+  flock.HotCells = &hot_cells;
+  char line[160];
+  for (int f = 0; f < config.frames; f++) {
+    flock.update(config.frameTime);
+    if ((f + 1) % 10 == 0) {
+      snprintf(line, sizeof(line), "frame %4i: %6zu voxels, %10lld pair tests, %8.3f ms, top %i %5.1f%%, occupancy max %i\n",
+               f + 1, hot_cells.allCells().size(), hot_cells.pairTests(), hot_cells.microseconds() * 1e-3, top,
+               100.0 * hot_cells.topShare(), hot_cells.maxOccupancy());
+      cout << line;
+    }
+  }
+  hot_cells.print(cout);
+  return 0;
+}
+
+
+// ImGui allocations, accounted to MemoryTag::IMGUI
+static void* imgui_alloc(size_t size, void*) {
+  return trackedMalloc(size, MemoryTag::IMGUI);
+}
+
+static void imgui_free(void* p, void*) {
+  trackedFree(p, MemoryTag::IMGUI);
+}
+
+
 /////////////////////////////////////////////////////////////////
 //
 /////////////////////////////////////////////////////////////////
 int main(int argc, char *argv[]) {
 
+  // headless timing of the float, double and fixed point builds:  --bench [agents] [frames]
+  if (argc > 1 && std::string(argv[1]) == "--bench") {
+    BenchmarkConfig config;
+    if (argc > 2) config.agents = atoi(argv[2]);
+    if (argc > 3) config.frames = atoi(argv[3]);
+    bool ok = runBenchmarks(config, cout);
+    return ok ? 0 : 1;
+  }
+
+  // repeated runs and a size sweep written as JSON:  --bench-json <file> [agents] [frames] [repetitions]
+  if (argc > 2 && std::string(argv[1]) == "--bench-json") {
+    BenchmarkConfig config;
+    if (argc > 3) config.agents = atoi(argv[3]);
+    if (argc > 4) config.frames = atoi(argv[4]);
+    std::ofstream json(argv[2]);
+    if (!json) {
+      cerr << argv[2] << ": cannot write" << endl;
+      return 1;
+    }
+    bool ok = runBenchmarkSuite(config, argc > 5 ? std::max(2, atoi(argv[5])) : 10, json, cout);
+    return ok ? 0 : 1;
+  }
+
+  // medians, confidence intervals and significance between two JSON runs:  --bench-compare <base> <new>
+  if (argc > 3 && std::string(argv[1]) == "--bench-compare") {
+    return compareBenchmarks(argv[2], argv[3], cout) ? 0 : 1;
+  }
+
+  // fixed point peers exchanging only their inputs:  --lockstep [agents] [frames] [peers]
+  if (argc > 1 && std::string(argv[1]) == "--lockstep") {
+    BenchmarkConfig config;
+    if (argc > 2) config.agents = atoi(argv[2]);
+    if (argc > 3) config.frames = atoi(argv[3]);
+    runLockstepCheck(config, argc > 4 ? atoi(argv[4]) : 2, cout);
+    return 0;
+  }
+
+  // simulation only, with the metrics endpoint and optionally the state stream:
+  //   --headless [agents] [frames] [port] [socket path]
+  if (argc > 1 && std::string(argv[1]) == "--headless") {
+    BenchmarkConfig config;
+    config.frames = 0;
+    if (argc > 2) config.agents = atoi(argv[2]);
+    if (argc > 3) config.frames = atoi(argv[3]);
+    return runHeadless(config, argc > 4 ? atoi(argv[4]) : 9464, argc > 5 ? argv[5] : nullptr);
+  }
+
+  // reruns a spike checkpoint of the flight recorder through the spike frame and [frames] more,
+  // optionally writing the per agent forces of the last frame:  --replay <checkpoint> [frames] [forces.csv]
+  if (argc > 2 && std::string(argv[1]) == "--replay") {
+    return runReplay(argv[2], argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? argv[4] : nullptr);
+  }
+
+  // per agent rule contributions after a seeded run:  --forces <csv> [agents] [frames]
+  if (argc > 2 && std::string(argv[1]) == "--forces") {
+    BenchmarkConfig config;
+    if (argc > 3) config.agents = atoi(argv[3]);
+    if (argc > 4) config.frames = atoi(argv[4]);
+    return runForceExport(config, argv[2]);
+  }
+
+  // per voxel cost of the neighbor pass:  --hot-cells [agents] [frames] [top] [radius]
+  if (argc > 1 && std::string(argv[1]) == "--hot-cells") {
+    BenchmarkConfig config;
+    if (argc > 2) config.agents = atoi(argv[2]);
+    if (argc > 3) config.frames = atoi(argv[3]);
+    return runHotCells(config, argc > 4 ? max(1, atoi(argv[4])) : 10, argc > 5 ? float(atof(argv[5])) : 0.0f);
+  }
+
+  // peak bytes per agent of every storage mode against its budget:  --memory [agents] [frames]
+  if (argc > 1 && std::string(argv[1]) == "--memory") {
+    BenchmarkConfig config;
+    if (argc > 2) config.agents = atoi(argv[2]);
+    if (argc > 3) config.frames = atoi(argv[3]);
+    bool ok = runMemoryBenchmark(config, cout);
+    cout << endl;
+    printMemoryAccounts(cout);
+    return ok ? 0 : 1;
+  }
+
+  // draws this many frames, then prints the GPU timings and exits:  --gpu-profile [frames]
+  int profile_frames = 0;
+  if (argc > 1 && std::string(argv[1]) == "--gpu-profile") {
+    profile_frames = argc > 2 ? max(1, atoi(argv[2])) : 300;
+  }
+
   // SDL: initialize and create a window
   SDL_Init(SDL_INIT_VIDEO);
   const char *title = "CS 561 Project 1 [Agent-based simulation]";
@@ -474,6 +1351,7 @@ int main(int argc, char *argv[]) {
 
   // Setup Dear ImGui context
   IMGUI_CHECKVERSION();
+  ImGui::SetAllocatorFunctions(imgui_alloc, imgui_free, nullptr);
   ImGui::CreateContext();
   ImGuiIO& io = ImGui::GetIO(); (void)io;
 
@@ -539,6 +1417,10 @@ int main(int argc, char *argv[]) {
     ticks_last = ticks;
     client->draw(dt);
     SDL_GL_SwapWindow(window);
+    if (profile_frames > 0 && --profile_frames == 0) {
+      client->printGpuProfile(cout);
+      done = true;
+    }
   }
 
   ImGui_ImplOpenGL3_Shutdown();
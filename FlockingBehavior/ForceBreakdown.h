@@ -0,0 +1,132 @@
+#ifndef CS561_FORCE_BREAKDOWN_H
+#define CS561_FORCE_BREAKDOWN_H
+
+#include <cstdio>
+#include <string>
+#include "HugePages.h"
+#include "ScalarTraits.h"
+
+// Per agent contributions of every steering rule to the acceleration, for finding out which rule
+// dominated when an agent misbehaves.  updateBoid only keeps the clamped sum; with
+// flock.Forces set to a ForceBreakdown the flocker also writes every weighted rule result, the
+// obstacle avoidance response and the totals into one array per component, indexed by agent slot.
+//
+// Without flock.Forces the flocker skips all of it with one branch per agent.  Building with
+// FLOCK_FORCE_BREAKDOWN defined to 0 removes even that.
+
+#ifndef FLOCK_FORCE_BREAKDOWN
+#define FLOCK_FORCE_BREAKDOWN 1
+#endif
+
+enum class ForceComponent {
+    SEPARATION,
+    ALIGNMENT,
+    COHESION,
+    STEERING,
+    FLEE,
+    EXTRA,          // extra rule plugins and the custom rule
+    AVOIDANCE,      // obstacle avoidance, as the acceleration it applies to the velocity
+    TOTAL,          // sum of the rules before clamping to MaxAcceleration
+    CLAMPED         // the acceleration the agent integrates
+};
+const int FORCE_COMPONENT_COUNT = 9;
+const int FORCE_RULE_COUNT = 7;     // the components up to AVOIDANCE
+
+inline const char* forceComponentName(ForceComponent component) {
+    static const char* names[FORCE_COMPONENT_COUNT] = {
+        "separation", "alignment", "cohesion", "steering", "flee", "extra", "avoidance", "total", "clamped"
+    };
+    return names[static_cast<int>(component)];
+}
+
+template <class Traits>
+class BasicForceBreakdown {
+public:
+    typedef typename Traits::Vec3 Vec3;
+
+    // one zeroed entry per agent slot; called by the flocker every frame
+    void reset(size_t agents) {
+        for (auto& component : components) {
+            component.assign(agents, Vec3(0));
+        }
+        frame++;
+    }
+
+    size_t size() const {
+        return components[0].size();
+    }
+
+    // frames recorded so far
+    unsigned frames() const {
+        return frame;
+    }
+
+    Vec3& at(ForceComponent component, size_t index) {
+        return components[static_cast<int>(component)][index];
+    }
+
+    const Vec3& at(ForceComponent component, size_t index) const {
+        return components[static_cast<int>(component)][index];
+    }
+
+    const HugeVector<Vec3, MemoryTag::DEBUG>& component(ForceComponent c) const {
+        return components[static_cast<int>(c)];
+    }
+
+    // the rule or avoidance with the largest contribution to agent `index`
+    ForceComponent dominant(size_t index) const {
+        int best = 0;
+        float bestLength = -1.0f;
+        for (int c = 0; c < FORCE_RULE_COUNT; c++) {
+            glm::vec3 v = Traits::toVec3(components[c][index]);
+            float l = glm::dot(v, v);
+            if (l > bestLength) {
+                best = c;
+                bestLength = l;
+            }
+        }
+        return static_cast<ForceComponent>(best);
+    }
+
+    // One row per live agent: id, position, then x, y, z of every component and the dominant rule
+    template <class BoidList>
+    bool writeCsv(const char* path, const BoidList& boids, std::string& error) const {
+        FILE* file = fopen(path, "w");
+        if (file == nullptr) {
+            error = std::string(path) + ": cannot write";
+            return false;
+        }
+        fprintf(file, "frame,id,x,y,z");
+        for (int c = 0; c < FORCE_COMPONENT_COUNT; c++) {
+            const char* name = forceComponentName(static_cast<ForceComponent>(c));
+            fprintf(file, ",%s_x,%s_y,%s_z", name, name, name);
+        }
+        fprintf(file, ",dominant\n");
+        for (size_t i = 0; i < boids.size() && i < size(); i++) {
+            if (!boids[i].alive) {
+                continue;
+            }
+            glm::vec3 p = Traits::toVec3(boids[i].position);
+            fprintf(file, "%u,%u,%g,%g,%g", frame, boids[i].id, p.x, p.y, p.z);
+            for (int c = 0; c < FORCE_COMPONENT_COUNT; c++) {
+                glm::vec3 v = Traits::toVec3(components[c][i]);
+                fprintf(file, ",%g,%g,%g", v.x, v.y, v.z);
+            }
+            fprintf(file, ",%s\n", forceComponentName(dominant(i)));
+        }
+        bool ok = ferror(file) == 0;
+        fclose(file);
+        if (!ok) {
+            error = std::string(path) + ": write failed";
+        }
+        return ok;
+    }
+
+private:
+    HugeVector<Vec3, MemoryTag::DEBUG> components[FORCE_COMPONENT_COUNT];
+    unsigned frame = 0;
+};
+
+typedef BasicForceBreakdown<FloatTraits> ForceBreakdown;
+
+#endif
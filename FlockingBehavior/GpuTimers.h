@@ -0,0 +1,200 @@
+#ifndef CS561_GPU_TIMERS_H
+#define CS561_GPU_TIMERS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// GPU execution time of the render phases from pairs of GL_TIMESTAMP queries, next to the CPU time
+// it took to submit them.  CPU timers around draw calls only measure submission; comparing the two
+// tells whether rendering is CPU or GPU bound.
+//
+// Query results arrive a few frames late.  Each frame's queries go into one of LATENCY sets and a
+// set is only read when it comes around again; if the GPU has not finished it by then, that frame
+// is left untimed rather than waiting (no pipeline stalls).  Needs GL 3.3 or ARB_timer_query, which
+// Mesa's llvmpipe provides, so the timings can be checked without a GPU:
+//   xvfb-run env LIBGL_ALWAYS_SOFTWARE=1 FlockingBehavior --gpu-profile 300
+//
+// The GL declarations come from the including file (GLEW in the driver).
+
+enum class GpuPhase {
+    BOIDS,          // one draw per agent
+    OBSTACLES,      // target cube and collision sphere
+    OVERLAY,        // voxel, neighbor link and avoidance ray overlay
+    IMGUI           // control panel
+};
+const int GPU_PHASE_COUNT = 4;
+
+inline const char* gpuPhaseName(GpuPhase phase) {
+    static const char* names[GPU_PHASE_COUNT] = { "boids", "obstacles", "overlay", "imgui" };
+    return names[static_cast<int>(phase)];
+}
+
+struct GpuPhaseTiming {
+    double gpuMilliseconds = 0;     // execution on the GPU
+    double cpuMilliseconds = 0;     // submission on the CPU, same frame
+};
+
+class GpuTimers {
+public:
+    static const int LATENCY = 2;   // query sets in flight
+
+    GpuTimers() {}
+    GpuTimers(const GpuTimers&) = delete;
+    GpuTimers& operator=(const GpuTimers&) = delete;
+
+    // With the context current; false (and every call a no-op) without timer query support
+    bool init() {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool supported = major > 3 || (major == 3 && minor >= 3);
+        GLint extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+        for (GLint i = 0; i < extensions && !supported; i++) {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, GLuint(i)));
+            supported = name != nullptr && strcmp(name, "GL_ARB_timer_query") == 0;
+        }
+        GLint bits = 0;
+        if (supported) {
+            glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+        }
+        if (!supported || bits == 0) {
+            return false;
+        }
+        glGenQueries(LATENCY * GPU_PHASE_COUNT * 2, &queries[0][0][0]);
+        ready = true;
+        return true;
+    }
+
+    void shutdown() {
+        if (ready) {
+            glDeleteQueries(LATENCY * GPU_PHASE_COUNT * 2, &queries[0][0][0]);
+        }
+        ready = false;
+    }
+
+    bool available() const {
+        return ready;
+    }
+
+    // Reads the set this frame will reuse, if the GPU is done with it
+    void beginFrame() {
+        timing = false;
+        if (!ready) {
+            return;
+        }
+        Set& set = sets[slot];
+        if (set.pending) {
+            GLint done = 1;
+            if (set.lastIssued >= 0) {
+                glGetQueryObjectiv(queries[slot][set.lastIssued][1], GL_QUERY_RESULT_AVAILABLE, &done);
+            }
+            if (!done) {
+                late++;
+                return;
+            }
+            for (int p = 0; p < GPU_PHASE_COUNT; p++) {
+                GLuint64 start = 0, end = 0;
+                if (set.issued[p]) {
+                    glGetQueryObjectui64v(queries[slot][p][0], GL_QUERY_RESULT, &start);
+                    glGetQueryObjectui64v(queries[slot][p][1], GL_QUERY_RESULT, &end);
+                }
+                last[p].gpuMilliseconds = end > start ? double(end - start) * 1e-6 : 0.0;
+                last[p].cpuMilliseconds = set.cpuMilliseconds[p];
+                totals[p].gpuMilliseconds += last[p].gpuMilliseconds;
+                totals[p].cpuMilliseconds += last[p].cpuMilliseconds;
+            }
+            lastFrame = set.frame;
+            resolved++;
+            set.pending = false;
+        }
+        set = Set();
+        set.frame = ++frames;
+        timing = true;
+    }
+
+    void begin(GpuPhase phase) {
+        if (!timing) {
+            return;
+        }
+        int p = static_cast<int>(phase);
+        glQueryCounter(queries[slot][p][0], GL_TIMESTAMP);
+        starts[p] = std::chrono::steady_clock::now();
+    }
+
+    void end(GpuPhase phase) {
+        if (!timing) {
+            return;
+        }
+        int p = static_cast<int>(phase);
+        glQueryCounter(queries[slot][p][1], GL_TIMESTAMP);
+        Set& set = sets[slot];
+        set.cpuMilliseconds[p] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - starts[p]).count();
+        set.issued[p] = true;
+        set.lastIssued = p;
+    }
+
+    // after the last phase of the frame
+    void endFrame() {
+        if (!timing) {
+            return;
+        }
+        sets[slot].pending = true;
+        slot = (slot + 1) % LATENCY;
+        timing = false;
+    }
+
+    // the most recent frame whose results are in
+    const GpuPhaseTiming& phase(GpuPhase p) const {
+        return last[static_cast<int>(p)];
+    }
+
+    // mean over every resolved frame
+    GpuPhaseTiming average(GpuPhase p) const {
+        GpuPhaseTiming mean;
+        if (resolved > 0) {
+            mean.gpuMilliseconds = totals[static_cast<int>(p)].gpuMilliseconds / double(resolved);
+            mean.cpuMilliseconds = totals[static_cast<int>(p)].cpuMilliseconds / double(resolved);
+        }
+        return mean;
+    }
+
+    uint32_t lastResolvedFrame() const {
+        return lastFrame;
+    }
+
+    long long resolvedFrames() const {
+        return resolved;
+    }
+
+    // frames left untimed because their set was still in flight
+    long long lateFrames() const {
+        return late;
+    }
+
+private:
+    struct Set {
+        uint32_t frame = 0;
+        bool pending = false;
+        bool issued[GPU_PHASE_COUNT] = {};
+        int lastIssued = -1;            // phase whose end timestamp is polled for the whole set
+        double cpuMilliseconds[GPU_PHASE_COUNT] = {};
+    };
+
+    GLuint queries[LATENCY][GPU_PHASE_COUNT][2] = {};     // start and end timestamp
+    Set sets[LATENCY];
+    int slot = 0;
+    bool ready = false;
+    bool timing = false;                // queries are being issued this frame
+    uint32_t frames = 0;
+    uint32_t lastFrame = 0;
+    long long resolved = 0;
+    long long late = 0;
+    std::chrono::steady_clock::time_point starts[GPU_PHASE_COUNT];
+    GpuPhaseTiming last[GPU_PHASE_COUNT];
+    GpuPhaseTiming totals[GPU_PHASE_COUNT];
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef CS561_HOT_CELLS_H
+#define CS561_HOT_CELLS_H
+
+#include <algorithm>
+#include <cstdio>
+#include <ostream>
+#include <glm/glm.hpp>
+#include "HugePages.h"
+
+// Where the neighbor pass spends its time, voxel by voxel.  With flock.HotCells set the flocker
+// charges every occupied voxel with the pair tests (candidates reaching the distance test, early
+// k-nearest rejects included) and the time of its agents' queries and rules.  Time is read once
+// per run of agents in the same voxel, not per agent, so profiling costs two clock reads per
+// occupied voxel and state.
+//
+// After each frame the TopK most expensive voxels are kept with their occupancy.  A few voxels with
+// most of the time and far more agents than the mean point at clumping; many voxels with one or
+// two agents and few pair tests point at voxels smaller than they need to be.
+
+struct CellCost {
+    glm::vec3 voxel = glm::vec3(0);     // voxel coordinates
+    int occupancy = 0;                  // agents in the voxel
+    long long pairTests = 0;
+    double microseconds = 0;
+};
+
+class HotCellProfile {
+public:
+    int TopK = 10;
+
+    // called by the flocker before the neighbor pass, with the occupied voxels of the frame
+    void beginFrame(size_t cellCount) {
+        cells.assign(cellCount, CellCost());
+    }
+
+    CellCost& cell(size_t k) {
+        return cells[k];
+    }
+
+    void charge(size_t k, long long pairTests, double microseconds) {
+        cells[k].pairTests += pairTests;
+        cells[k].microseconds += microseconds;
+    }
+
+    // after the neighbor pass; ranks the voxels and keeps the TopK
+    void endFrame() {
+        totalTests = 0;
+        totalMicroseconds = 0;
+        agents = 0;
+        mostOccupied = 0;
+        for (const CellCost& c : cells) {
+            totalTests += c.pairTests;
+            totalMicroseconds += c.microseconds;
+            agents += c.occupancy;
+            mostOccupied = std::max(mostOccupied, c.occupancy);
+        }
+        size_t k = std::min(cells.size(), size_t(std::max(TopK, 0)));
+        hot.assign(cells.begin(), cells.end());
+        std::partial_sort(hot.begin(), hot.begin() + k, hot.end(),
+            [](const CellCost& l, const CellCost& r) { return l.microseconds > r.microseconds; });
+        hot.resize(k);
+        double hotMicroseconds = 0;
+        for (const CellCost& c : hot) {
+            hotMicroseconds += c.microseconds;
+        }
+        share = totalMicroseconds > 0 ? hotMicroseconds / totalMicroseconds : 0.0;
+        shareSum += share;
+        frames++;
+    }
+
+    // this frame's voxels in traversal order, as charged
+    const HugeVector<CellCost, MemoryTag::DEBUG>& allCells() const {
+        return cells;
+    }
+
+    // the TopK voxels of the last frame, most expensive first
+    const HugeVector<CellCost, MemoryTag::DEBUG>& hottest() const {
+        return hot;
+    }
+
+    long long pairTests() const {
+        return totalTests;
+    }
+
+    double microseconds() const {
+        return totalMicroseconds;
+    }
+
+    // share of the neighbor pass spent in the TopK voxels, last frame and mean over all frames
+    double topShare() const {
+        return share;
+    }
+
+    double meanTopShare() const {
+        return frames > 0 ? shareSum / double(frames) : 0.0;
+    }
+
+    double meanOccupancy() const {
+        return cells.empty() ? 0.0 : double(agents) / double(cells.size());
+    }
+
+    int maxOccupancy() const {
+        return mostOccupied;
+    }
+
+    long long profiledFrames() const {
+        return frames;
+    }
+
+    // summary and one line per hot voxel of the last frame
+    void print(std::ostream& out) const {
+        char line[200];
+        std::snprintf(line, sizeof(line), "%zu occupied voxels, %lld pair tests, %.3f ms; occupancy mean %.1f, max %i\n",
+                      cells.size(), totalTests, totalMicroseconds * 1e-3, meanOccupancy(), mostOccupied);
+        out << line;
+        std::snprintf(line, sizeof(line), "top %zu voxels: %.1f%% of the time (mean %.1f%% over %lld frames)\n",
+                      hot.size(), 100.0 * share, 100.0 * meanTopShare(), frames);
+        out << line;
+        std::snprintf(line, sizeof(line), "%18s %10s %12s %10s %7s\n", "voxel", "agents", "pair tests", "us", "time");
+        out << line;
+        for (const CellCost& c : hot) {
+            char voxel[48];
+            std::snprintf(voxel, sizeof(voxel), "%i,%i,%i", int(c.voxel.x), int(c.voxel.y), int(c.voxel.z));
+            std::snprintf(line, sizeof(line), "%18s %10i %12lld %10.1f %6.1f%%\n", voxel, c.occupancy, c.pairTests,
+                          c.microseconds, totalMicroseconds > 0 ? 100.0 * c.microseconds / totalMicroseconds : 0.0);
+            out << line;
+        }
+    }
+
+private:
+    HugeVector<CellCost, MemoryTag::DEBUG> cells;
+    HugeVector<CellCost, MemoryTag::DEBUG> hot;
+    long long totalTests = 0;
+    double totalMicroseconds = 0;
+    long long agents = 0;
+    int mostOccupied = 0;
+    double share = 0;
+    double shareSum = 0;
+    long long frames = 0;
+};
+
+#endif
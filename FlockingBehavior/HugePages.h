@@ -0,0 +1,255 @@
+#ifndef CS561_HUGE_PAGES_H
+#define CS561_HUGE_PAGES_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "MemoryAccounting.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// How the simulation's large arrays are backed
+enum class HugePageMode {
+    OFF,                // regular heap allocations
+    TRANSPARENT_HUGE,   // page aligned mappings advised for transparent huge pages (Linux); not
+                        // TRANSPARENT, which wingdi.h defines as a macro
+    EXPLICIT            // reserved huge pages (hugetlbfs / Windows large pages), then transparent, then regular
+};
+
+// Blocks smaller than this always come from operator new
+const size_t HUGE_PAGE_THRESHOLD = 1 << 20;
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+// Live bytes by backing, for the memory stats panel
+struct HugePageStats {
+    std::atomic<long long> explicitBytes{ 0 };     // hugetlbfs / large page mappings
+    std::atomic<long long> transparentBytes{ 0 };  // mappings advised for transparent huge pages
+    std::atomic<long long> regularBytes{ 0 };      // page mappings without huge pages (fallback or OFF)
+    std::atomic<long long> heapBytes{ 0 };         // blocks from operator new
+    std::atomic<long long> fallbacks{ 0 };         // huge page requests that had to fall back
+};
+
+inline HugePageStats& hugePageStats() {
+    static HugePageStats stats;
+    return stats;
+}
+
+inline std::atomic<HugePageMode>& hugePageMode() {
+    static std::atomic<HugePageMode> mode(HugePageMode::TRANSPARENT_HUGE);
+    return mode;
+}
+
+namespace hugepages_detail {
+
+enum class Backing { HEAP, REGULAR, TRANSPARENT_HUGE, EXPLICIT };
+
+struct Mapping {
+    Backing backing;
+    size_t bytes;
+};
+
+// mapped blocks and how they were obtained (only large blocks end up here, so a map is fine)
+inline std::map<void*, Mapping>& mappings() {
+    static std::map<void*, Mapping> blocks;
+    return blocks;
+}
+
+inline std::mutex& mappingsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+inline std::atomic<long long>& counterFor(Backing backing) {
+    HugePageStats& stats = hugePageStats();
+    switch (backing) {
+    case Backing::EXPLICIT: return stats.explicitBytes;
+    case Backing::TRANSPARENT_HUGE: return stats.transparentBytes;
+    case Backing::REGULAR: return stats.regularBytes;
+    default: return stats.heapBytes;
+    }
+}
+
+inline void* mapPages(size_t bytes, HugePageMode mode, Backing& backing) {
+#if defined(_WIN32)
+    if (mode == HugePageMode::EXPLICIT) {
+        SIZE_T large = GetLargePageMinimum();
+        if (large > 0 && bytes % large == 0) {
+            void* p = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (p != nullptr) {
+                backing = Backing::EXPLICIT;
+                return p;
+            }
+        }
+        hugePageStats().fallbacks++;
+    }
+    void* p = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    backing = Backing::REGULAR;
+    return p;
+#else
+#if defined(MAP_HUGETLB)
+    if (mode == HugePageMode::EXPLICIT) {
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            backing = Backing::EXPLICIT;
+            return p;
+        }
+        hugePageStats().fallbacks++;
+    }
+#endif
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    backing = Backing::REGULAR;
+#if defined(MADV_HUGEPAGE)
+    if (mode != HugePageMode::OFF) {
+        if (madvise(p, bytes, MADV_HUGEPAGE) == 0) {
+            backing = Backing::TRANSPARENT_HUGE;
+        }
+        else {
+            hugePageStats().fallbacks++;
+        }
+    }
+#endif
+    return p;
+#endif
+}
+
+inline void unmapPages(void* p, size_t bytes) {
+#if defined(_WIN32)
+    (void)bytes;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, bytes);
+#endif
+}
+
+} // namespace hugepages_detail
+
+// Allocates a block for the simulation's large arrays.  Large blocks are rounded up to whole huge
+// pages and mapped according to hugePageMode(), falling back to regular pages when huge pages are
+// unavailable.  The block is accounted to tag (MemoryAccounting.h).
+inline void* hugePageAllocate(size_t bytes, MemoryTag tag = MemoryTag::OTHER) {
+    using namespace hugepages_detail;
+    HugePageMode mode = hugePageMode();
+    if (bytes < HUGE_PAGE_THRESHOLD || mode == HugePageMode::OFF) {
+        void* p = ::operator new(bytes);
+        hugePageStats().heapBytes += static_cast<long long>(bytes);
+        memoryAccount(tag).allocated(bytes);
+        return p;
+    }
+    size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    Backing backing = Backing::REGULAR;
+    void* p = mapPages(rounded, mode, backing);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    counterFor(backing) += static_cast<long long>(rounded);
+    memoryAccount(tag).allocated(rounded);
+    std::lock_guard<std::mutex> lock(mappingsMutex());
+    Mapping mapping = { backing, rounded };
+    mappings()[p] = mapping;
+    return p;
+}
+
+inline void hugePageFree(void* p, size_t bytes, MemoryTag tag = MemoryTag::OTHER) {
+    using namespace hugepages_detail;
+    if (p == nullptr) {
+        return;
+    }
+    // small blocks always come from operator new; only blocks this large can be mappings
+    if (bytes < HUGE_PAGE_THRESHOLD) {
+        hugePageStats().heapBytes -= static_cast<long long>(bytes);
+        memoryAccount(tag).freed(bytes);
+        ::operator delete(p);
+        return;
+    }
+    Mapping mapping = { Backing::HEAP, bytes };
+    {
+        std::lock_guard<std::mutex> lock(mappingsMutex());
+        auto iter = mappings().find(p);
+        if (iter != mappings().end()) {
+            mapping = iter->second;
+            mappings().erase(iter);
+        }
+    }
+    counterFor(mapping.backing) -= static_cast<long long>(mapping.bytes);
+    memoryAccount(tag).freed(mapping.bytes);
+    if (mapping.backing == Backing::HEAP) {
+        ::operator delete(p);
+    }
+    else {
+        unmapPages(p, mapping.bytes);
+    }
+}
+
+// Bytes of the process actually backed by transparent huge pages (Linux), -1 when unknown
+inline long long transparentHugePagesInUse() {
+#if defined(__linux__)
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+    if (file == nullptr) {
+        return -1;
+    }
+    char line[256];
+    long long kb = -1;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        if (strncmp(line, "AnonHugePages:", 14) == 0) {
+            kb = atoll(line + 14);
+            break;
+        }
+    }
+    fclose(file);
+    return kb < 0 ? -1 : kb * 1024;
+#else
+    return -1;
+#endif
+}
+
+template <class T, MemoryTag Tag = MemoryTag::OTHER>
+struct HugePageAllocator {
+    typedef T value_type;
+
+    template <class U>
+    struct rebind {
+        typedef HugePageAllocator<U, Tag> other;
+    };
+
+    HugePageAllocator() noexcept {}
+    template <class U>
+    HugePageAllocator(const HugePageAllocator<U, Tag>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(hugePageAllocate(n * sizeof(T), Tag));
+    }
+
+    void deallocate(T* p, size_t n) {
+        hugePageFree(p, n * sizeof(T), Tag);
+    }
+};
+
+template <class T, class U, MemoryTag Tag>
+bool operator==(const HugePageAllocator<T, Tag>&, const HugePageAllocator<U, Tag>&) { return true; }
+
+template <class T, class U, MemoryTag Tag>
+bool operator!=(const HugePageAllocator<T, Tag>&, const HugePageAllocator<U, Tag>&) { return false; }
+
+template <class T, MemoryTag Tag = MemoryTag::OTHER>
+using HugeVector = std::vector<T, HugePageAllocator<T, Tag>>;
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef CS561_LOCKSTEP_H
+#define CS561_LOCKSTEP_H
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Flocker.h"
+
+// Lockstep runs of the fixed point flock.  Every instance simulates the same seeded scenario with
+// FixedFlocker, whose arithmetic, square roots, cosine and random directions are integer only, so
+// identical inputs give identical bits on every machine.  Instances therefore only exchange their
+// inputs: an input added on frame f is applied everywhere on frame f + InputDelay, once the
+// packets of every peer for that frame have arrived.  Packets also carry the sender's state hash
+// of an earlier frame, which the receiver compares with its own to detect a desync.
+//
+// Transport is left to the caller: sendInputs() returns a packet for every other peer and
+// receive() takes the packets of the others, in any order.
+
+// FNV-1a over the simulation state of every agent
+template <class BoidList>
+uint64_t flockStateHash(const BoidList& boids) {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    for (const auto& b : boids) {
+        mix(&b.alive, sizeof(b.alive));
+        if (!b.alive) {
+            continue;
+        }
+        mix(&b.id, sizeof(b.id));
+        mix(&b.position, sizeof(b.position));
+        mix(&b.velocity, sizeof(b.velocity));
+        mix(&b.acceleration, sizeof(b.acceleration));
+        mix(&b.state, sizeof(b.state));
+        mix(&b.stateTime, sizeof(b.stateTime));
+    }
+    return hash;
+}
+
+enum class LockstepInputType : uint8_t {
+    MOVE_TARGET,      // values: x, y, z
+    MOVE_OBSTACLE,    // values: x, y, z, radius
+    SPAWN,            // values: x, y, z, count (plain integer)
+    SET_WEIGHT        // values: rule (0 separation, 1 alignment, 2 cohesion, 3 steering), weight
+};
+
+// One input; values are raw Fixed numbers unless noted, so they travel without rounding
+struct LockstepInput {
+    LockstepInputType type = LockstepInputType::MOVE_TARGET;
+    int64_t values[4] = { 0, 0, 0, 0 };
+
+    static LockstepInput moveTarget(const glm::vec3& p) {
+        return make(LockstepInputType::MOVE_TARGET, p, 0);
+    }
+
+    static LockstepInput moveObstacle(const glm::vec3& center, float radius) {
+        return make(LockstepInputType::MOVE_OBSTACLE, center, Fixed(radius).raw);
+    }
+
+    static LockstepInput spawn(const glm::vec3& center, int count) {
+        return make(LockstepInputType::SPAWN, center, count);
+    }
+
+    static LockstepInput setWeight(int rule, float weight) {
+        LockstepInput input;
+        input.type = LockstepInputType::SET_WEIGHT;
+        input.values[0] = rule;
+        input.values[1] = Fixed(weight).raw;
+        return input;
+    }
+
+private:
+    static LockstepInput make(LockstepInputType type, const glm::vec3& p, int64_t last) {
+        LockstepInput input;
+        input.type = type;
+        input.values[0] = Fixed(p.x).raw;
+        input.values[1] = Fixed(p.y).raw;
+        input.values[2] = Fixed(p.z).raw;
+        input.values[3] = last;
+        return input;
+    }
+};
+
+class LockstepSession {
+public:
+    typedef FixedTraits::Vec3 Vec3;
+    typedef BasicBoid<FixedTraits> Boid;
+
+    int InputDelay = 2;                   // frames between adding an input and applying it
+    float FrameTime = 1.0f / 60.0f;
+
+    // every peer must be created with the same peers, seed, agents and worldSize
+    LockstepSession(int peers, int localPeer, uint32_t seed, int agents, float worldSize)
+        : peerCount(peers), local(localPeer), flock(&boids) {
+        // raw engine bits only: the distributions of the standard library differ between vendors.
+        // One draw per statement, since compilers evaluate constructor arguments in different orders.
+        std::mt19937 rng(seed);
+        int64_t span = Fixed(2.0f * worldSize).raw;
+        auto coordinate = [&]() { return Fixed::fromRaw(int64_t(rng() % uint32_t(span)) - span / 2); };
+        auto randomVec3 = [&]() {
+            Fixed x = coordinate();
+            Fixed y = coordinate();
+            Fixed z = coordinate();
+            return Vec3(x, y, z);
+        };
+        boids.reserve(agents);
+        for (int i = 0; i < agents; i++) {
+            Vec3 position = randomVec3();
+            Vec3 velocity = randomVec3();
+            boids.push_back(Boid(position, velocity * Fixed(0.05f)));
+            boids.back().id = static_cast<uint32_t>(i + 1);
+        }
+        nextId = static_cast<uint32_t>(agents + 1);
+        flock.seed(seed);
+        params.HilbertCellOrder = true;      // hash order depends on the standard library
+        params.SteeringTargets.push_back(Vec3(Fixed(0)));
+        params.CollisionRadius = Fixed(2);
+        params.CollisionCenter = FixedTraits::fromVec3(glm::vec3(-3, -3, 0));
+        flock.setParams(params);
+    }
+
+    // the flocker points into this session's agent list
+    LockstepSession(const LockstepSession&) = delete;
+    LockstepSession& operator=(const LockstepSession&) = delete;
+
+    // Queues a local input for the next packet
+    void addInput(const LockstepInput& input) {
+        localInputs.push_back(input);
+    }
+
+    // Closes the local inputs of frame() + InputDelay and returns the packet for the other peers;
+    // empty once the packet of that frame was already sent
+    std::vector<uint8_t> sendInputs() {
+        std::vector<uint8_t> packet;
+        uint32_t target = frameNumber + static_cast<uint32_t>(InputDelay);
+        if (sentThrough != NONE && sentThrough >= target) {
+            return packet;
+        }
+        uint32_t frame = sentThrough == NONE ? static_cast<uint32_t>(InputDelay) : sentThrough + 1;
+        sentThrough = frame;
+        FrameInputs& inputs = frameInputs(frame);
+        inputs.received[local] = true;
+        inputs.byPeer[local] = localInputs;
+
+        uint32_t hashFrame = frameNumber > 0 ? frameNumber - 1 : NONE;
+        put(packet, frame, 4);
+        put(packet, static_cast<uint64_t>(local), 2);
+        put(packet, static_cast<uint64_t>(localInputs.size()), 2);
+        put(packet, hashFrame, 4);
+        put(packet, frameNumber > 0 ? hashes.rbegin()->second : 0, 8);
+        for (const LockstepInput& input : localInputs) {
+            put(packet, static_cast<uint64_t>(input.type), 1);
+            for (int64_t v : input.values) {
+                put(packet, static_cast<uint64_t>(v), 8);
+            }
+        }
+        localInputs.clear();
+        return packet;
+    }
+
+    // Takes a packet of another peer; false if it is malformed
+    bool receive(const uint8_t* data, size_t size) {
+        const size_t HEADER = 20, INPUT = 33;
+        if (size < HEADER) {
+            return false;
+        }
+        uint32_t frame = static_cast<uint32_t>(get(data, 4));
+        int peer = static_cast<int>(get(data + 4, 2));
+        size_t count = static_cast<size_t>(get(data + 6, 2));
+        uint32_t hashFrame = static_cast<uint32_t>(get(data + 8, 4));
+        uint64_t hash = get(data + 12, 8);
+        if (peer < 0 || peer >= peerCount || peer == local || size != HEADER + count * INPUT || frame < frameNumber) {
+            return false;
+        }
+        FrameInputs& inputs = frameInputs(frame);
+        inputs.received[peer] = true;
+        inputs.byPeer[peer].resize(count);
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t* record = data + HEADER + i * INPUT;
+            LockstepInput& input = inputs.byPeer[peer][i];
+            input.type = static_cast<LockstepInputType>(record[0]);
+            for (int v = 0; v < 4; v++) {
+                input.values[v] = static_cast<int64_t>(get(record + 1 + v * 8, 8));
+            }
+        }
+        if (hashFrame != NONE) {
+            checkHash(hashFrame, hash);
+        }
+        return true;
+    }
+
+    // true once every peer's inputs for the next frame are known
+    bool canStep() const {
+        if (frameNumber < static_cast<uint32_t>(InputDelay)) {
+            return true;
+        }
+        auto iter = pending.find(frameNumber);
+        if (iter == pending.end()) {
+            return false;
+        }
+        for (bool received : iter->second.received) {
+            if (!received) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Applies the frame's inputs, peer by peer in a fixed order, then simulates the frame
+    void step() {
+        auto iter = pending.find(frameNumber);
+        if (iter != pending.end()) {
+            for (const std::vector<LockstepInput>& inputs : iter->second.byPeer) {
+                for (const LockstepInput& input : inputs) {
+                    apply(input);
+                    inputsApplied++;
+                }
+            }
+            pending.erase(iter);
+            flock.setParams(params);
+        }
+        flock.update(FrameTime);
+        uint64_t hash = flockStateHash(boids);
+        hashes[frameNumber] = hash;
+        while (hashes.size() > 1024) {
+            hashes.erase(hashes.begin());
+        }
+        auto remote = remoteHashes.find(frameNumber);
+        if (remote != remoteHashes.end()) {
+            checkHash(frameNumber, remote->second);
+            remoteHashes.erase(remote);
+        }
+        frameNumber++;
+    }
+
+    // frames simulated so far
+    uint32_t frame() const {
+        return frameNumber;
+    }
+
+    uint64_t hash() const {
+        return hashes.empty() ? flockStateHash(boids) : hashes.rbegin()->second;
+    }
+
+    // first frame whose hash differed from a peer's, -1 while in sync
+    long long desyncFrame() const {
+        return firstDesync;
+    }
+
+    long long appliedInputs() const {
+        return inputsApplied;
+    }
+
+    const BasicBoidList<FixedTraits>& agents() const {
+        return boids;
+    }
+
+private:
+    static const uint32_t NONE = 0xffffffffu;
+
+    struct FrameInputs {
+        std::vector<bool> received;
+        std::vector<std::vector<LockstepInput>> byPeer;
+    };
+
+    int peerCount;
+    int local;
+    BasicBoidList<FixedTraits> boids;
+    FixedFlocker flock;
+    FixedFlocker::Params params;          // changed by inputs, published before each frame
+    uint32_t frameNumber = 0;
+    uint32_t sentThrough = NONE;          // last frame whose local packet was sent
+    uint32_t nextId = 1;
+    std::vector<LockstepInput> localInputs;
+    std::map<uint32_t, FrameInputs> pending;
+    std::map<uint32_t, uint64_t> hashes;          // own hash per simulated frame (recent frames)
+    std::map<uint32_t, uint64_t> remoteHashes;    // peer hashes of frames not simulated here yet
+    long long firstDesync = -1;
+    long long inputsApplied = 0;
+
+    FrameInputs& frameInputs(uint32_t frame) {
+        FrameInputs& inputs = pending[frame];
+        inputs.received.resize(peerCount, false);
+        inputs.byPeer.resize(peerCount);
+        return inputs;
+    }
+
+    void checkHash(uint32_t frame, uint64_t remote) {
+        auto own = hashes.find(frame);
+        if (own == hashes.end()) {
+            if (frame >= frameNumber) {
+                remoteHashes[frame] = remote;
+            }
+            return;
+        }
+        if (own->second != remote && (firstDesync < 0 || frame < firstDesync)) {
+            firstDesync = frame;
+        }
+    }
+
+    void apply(const LockstepInput& input) {
+        const int64_t* v = input.values;
+        Vec3 p(Fixed::fromRaw(v[0]), Fixed::fromRaw(v[1]), Fixed::fromRaw(v[2]));
+        switch (input.type) {
+        case LockstepInputType::MOVE_TARGET:
+            params.SteeringTargets.assign(1, p);
+            break;
+        case LockstepInputType::MOVE_OBSTACLE:
+            params.CollisionCenter = p;
+            params.CollisionRadius = Fixed::fromRaw(v[3]);
+            break;
+        case LockstepInputType::SPAWN:
+            for (int64_t i = 0; i < v[3] && i < 10000; i++) {
+                Vec3 offset = flock.randomDirection();
+                Vec3 velocity = flock.randomDirection();
+                boids.push_back(Boid(p + offset, velocity));
+                boids.back().id = nextId++;
+            }
+            break;
+        case LockstepInputType::SET_WEIGHT: {
+            Fixed weight = Fixed::fromRaw(v[1]);
+            Fixed* weights[4] = { &params.SeparationWeight, &params.AlignmentWeight, &params.CohesionWeight, &params.SteeringWeight };
+            if (v[0] >= 0 && v[0] < 4) {
+                *weights[v[0]] = weight;
+            }
+            break;
+        }
+        }
+    }
+
+    // little endian, independent of the host
+    static void put(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    static uint64_t get(const uint8_t* in, int bytes) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value |= uint64_t(in[i]) << (8 * i);
+        }
+        return value;
+    }
+};
+
+#endif
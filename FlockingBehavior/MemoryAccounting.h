@@ -0,0 +1,102 @@
+#ifndef CS561_MEMORY_ACCOUNTING_H
+#define CS561_MEMORY_ACCOUNTING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <ostream>
+
+// Memory footprint by subsystem: live bytes, peak bytes and allocation counts.  The simulation's
+// containers get their subsystem from the HugePageAllocator tag (HugePages.h), the driver accounts
+// its GL buffers and hands trackedMalloc / trackedFree to ImGui.
+
+enum class MemoryTag {
+    BOIDS,          // agent storage
+    VOXEL_MAP,      // voxel hash map, per voxel buckets and the cell traversal order
+    NEIGHBORS,      // neighbor scratch, recorded neighbor ids and Verlet lists
+    BEHAVIOR,       // behavior state machine scratch
+    GL_BUFFERS,     // buffer objects created by the driver
+    IMGUI,          // ImGui context, fonts and draw lists
+    DEBUG,          // opt-in debug buffers (force breakdown)
+    OTHER           // untagged HugePageAllocator containers
+};
+const int MEMORY_TAG_COUNT = 8;
+
+inline const char* memoryTagName(MemoryTag tag) {
+    static const char* names[MEMORY_TAG_COUNT] = { "boids", "voxel map", "neighbors", "behavior", "gl buffers", "imgui", "debug", "other" };
+    return names[static_cast<int>(tag)];
+}
+
+struct MemoryAccount {
+    std::atomic<long long> liveBytes{ 0 };
+    std::atomic<long long> peakBytes{ 0 };     // highest liveBytes since start or resetPeak()
+    std::atomic<long long> allocations{ 0 };
+    std::atomic<long long> frees{ 0 };
+
+    void allocated(size_t bytes) {
+        long long live = liveBytes += static_cast<long long>(bytes);
+        long long peak = peakBytes.load(std::memory_order_relaxed);
+        while (live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void freed(size_t bytes) {
+        liveBytes -= static_cast<long long>(bytes);
+        frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void resetPeak() {
+        peakBytes = liveBytes.load();
+    }
+};
+
+inline MemoryAccount& memoryAccount(MemoryTag tag) {
+    static MemoryAccount accounts[MEMORY_TAG_COUNT];
+    return accounts[static_cast<int>(tag)];
+}
+
+inline void resetMemoryPeaks() {
+    for (int i = 0; i < MEMORY_TAG_COUNT; i++) {
+        memoryAccount(static_cast<MemoryTag>(i)).resetPeak();
+    }
+}
+
+// one line per subsystem: live and peak bytes, allocations and frees
+inline void printMemoryAccounts(std::ostream& out) {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-12s %12s %12s %12s %12s\n", "subsystem", "live KB", "peak KB", "allocs", "frees");
+    out << line;
+    for (int i = 0; i < MEMORY_TAG_COUNT; i++) {
+        const MemoryAccount& account = memoryAccount(static_cast<MemoryTag>(i));
+        std::snprintf(line, sizeof(line), "%-12s %12.1f %12.1f %12lld %12lld\n", memoryTagName(static_cast<MemoryTag>(i)),
+                      account.liveBytes.load() / 1024.0, account.peakBytes.load() / 1024.0,
+                      account.allocations.load(), account.frees.load());
+        out << line;
+    }
+}
+
+// malloc with the size kept in front of the block, for allocators that free without a size
+inline void* trackedMalloc(size_t bytes, MemoryTag tag) {
+    const size_t header = alignof(std::max_align_t);
+    char* block = static_cast<char*>(std::malloc(bytes + header));
+    if (block == nullptr) {
+        return nullptr;
+    }
+    *reinterpret_cast<size_t*>(block) = bytes;
+    memoryAccount(tag).allocated(bytes);
+    return block + header;
+}
+
+inline void trackedFree(void* p, MemoryTag tag) {
+    if (p == nullptr) {
+        return;
+    }
+    char* block = static_cast<char*>(p) - alignof(std::max_align_t);
+    memoryAccount(tag).freed(*reinterpret_cast<size_t*>(block));
+    std::free(block);
+}
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef CS561_METRICS_H
+#define CS561_METRICS_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HugePages.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Counters for the ops dashboards, served in the Prometheus text format over HTTP on localhost.
+// The simulation and render code only store into atomics; a scrape runs on the server's own
+// thread and reads them, so it never waits for a frame and a frame never waits for it.
+//
+//   curl http://127.0.0.1:9464/metrics
+
+enum class MetricType {
+    GAUGE, COUNTER
+};
+
+class Metric {
+public:
+    void set(double v) {
+        value.store(v, std::memory_order_relaxed);
+    }
+
+    void add(double v) {
+        double old = value.load(std::memory_order_relaxed);
+        while (!value.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {
+        }
+    }
+
+    double get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class MetricsRegistry;
+    std::string name;
+    std::string labels;     // e.g. phase="neighbors", without braces
+    std::string help;
+    MetricType type = MetricType::GAUGE;
+    std::atomic<double> value{ 0 };
+};
+
+// Time spent in one part of a frame: running sum and count, plus the last value
+struct PhaseMetric {
+    Metric* sum = nullptr;
+    Metric* count = nullptr;
+    Metric* last = nullptr;
+
+    void record(double milliseconds) {
+        sum->add(milliseconds * 0.001);
+        count->add(1);
+        last->set(milliseconds * 0.001);
+    }
+};
+
+// Fixed set of metrics.  Registering is meant for start up but is safe while scrapes run: a slot
+// is filled in completely before the count that makes it visible is published.
+class MetricsRegistry {
+public:
+    static const int CAPACITY = 128;
+
+    MetricsRegistry() {}
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    // one thread at a time; returns nullptr when the registry is full
+    Metric* add(const char* name, MetricType type, const char* help, const std::string& labels = std::string()) {
+        int n = count.load(std::memory_order_relaxed);
+        if (n == CAPACITY) {
+            return nullptr;
+        }
+        Metric& m = metrics[n];
+        m.name = name;
+        m.type = type;
+        m.help = help;
+        m.labels = labels;
+        count.store(n + 1, std::memory_order_release);
+        return &m;
+    }
+
+    PhaseMetric phase(const char* phaseName) {
+        std::string labels = std::string("phase=\"") + phaseName + "\"";
+        PhaseMetric p;
+        p.sum = add("flock_phase_seconds_sum", MetricType::COUNTER, "Time spent per frame phase", labels);
+        p.count = add("flock_phase_seconds_count", MetricType::COUNTER, "Frames timed per phase", labels);
+        p.last = add("flock_phase_last_seconds", MetricType::GAUGE, "Time of the phase in the last frame", labels);
+        return p;
+    }
+
+    // Prometheus text exposition format 0.0.4: the samples of a name grouped under one HELP and TYPE
+    std::string render() const {
+        int n = count.load(std::memory_order_acquire);
+        std::string text;
+        std::vector<bool> written(n, false);
+        char number[64];
+        for (int first = 0; first < n; first++) {
+            if (written[first]) {
+                continue;
+            }
+            const Metric& family = metrics[first];
+            text += "# HELP " + family.name + " " + family.help + "\n";
+            text += "# TYPE " + family.name + (family.type == MetricType::COUNTER ? " counter\n" : " gauge\n");
+            for (int i = first; i < n; i++) {
+                const Metric& m = metrics[i];
+                if (written[i] || m.name != family.name) {
+                    continue;
+                }
+                written[i] = true;
+                std::snprintf(number, sizeof(number), "%.9g", m.get());
+                text += m.name;
+                if (!m.labels.empty()) {
+                    text += "{" + m.labels + "}";
+                }
+                text += " ";
+                text += number;
+                text += "\n";
+            }
+        }
+        return text;
+    }
+
+private:
+    Metric metrics[CAPACITY];
+    std::atomic<int> count{ 0 };
+};
+
+// The counters this program publishes: frame phases, agents, neighbor search, memory and queues
+struct FlockMetrics {
+    PhaseMetric frame, commands, pool, flock, neighbors, render;
+    Metric* frames;
+    Metric* agents;
+    Metric* slots;
+    Metric* neighborQueries;
+    Metric* neighborCandidates;
+    Metric* neighborHitRate;
+    Metric* verletRebuilds;
+    Metric* verletBytes;
+    Metric* heapBytes;
+    Metric* hugePageBytes;
+    Metric* commandQueueDepth;
+    Metric* commandsApplied;
+    Metric* proximityQueueDepth;
+    Metric* proximityDropped;
+    Metric* streamClients;
+    Metric* streamGroups;
+    Metric* streamBytes;
+    Metric* subsystemBytes[MEMORY_TAG_COUNT];
+    Metric* subsystemPeakBytes[MEMORY_TAG_COUNT];
+    Metric* subsystemAllocations[MEMORY_TAG_COUNT];
+
+    explicit FlockMetrics(MetricsRegistry& r) {
+        frame = r.phase("frame");
+        commands = r.phase("commands");
+        pool = r.phase("pool");
+        flock = r.phase("flock");
+        neighbors = r.phase("neighbors");
+        render = r.phase("render");
+        frames = r.add("flock_frames_total", MetricType::COUNTER, "Simulated frames");
+        agents = r.add("flock_agents", MetricType::GAUGE, "Live agents");
+        slots = r.add("flock_agent_slots", MetricType::GAUGE, "Agent slots, live and free");
+        neighborQueries = r.add("flock_neighbor_queries", MetricType::GAUGE, "Neighbor queries in the last frame");
+        neighborCandidates = r.add("flock_neighbor_candidates", MetricType::GAUGE, "Agents given the full neighbor test in the last frame");
+        neighborHitRate = r.add("flock_neighbor_hit_ratio", MetricType::GAUGE, "Share of neighbors already known from the frame before");
+        verletRebuilds = r.add("flock_verlet_rebuilds_total", MetricType::COUNTER, "Verlet neighbor list rebuilds");
+        verletBytes = r.add("flock_verlet_list_bytes", MetricType::GAUGE, "Compressed Verlet neighbor list size");
+        heapBytes = r.add("flock_memory_bytes", MetricType::GAUGE, "Live simulation arrays by backing", "backing=\"heap\"");
+        hugePageBytes = r.add("flock_memory_bytes", MetricType::GAUGE, "Live simulation arrays by backing", "backing=\"pages\"");
+        commandQueueDepth = r.add("flock_command_queue_depth", MetricType::GAUGE, "Command batches waiting for the next frame");
+        commandsApplied = r.add("flock_commands_total", MetricType::COUNTER, "Commands applied");
+        proximityQueueDepth = r.add("flock_proximity_queue_depth", MetricType::GAUGE, "Proximity events waiting for the consumer");
+        proximityDropped = r.add("flock_proximity_dropped_total", MetricType::COUNTER, "Proximity events lost to a full queue");
+        streamClients = r.add("flock_stream_clients", MetricType::GAUGE, "State stream subscribers");
+        streamGroups = r.add("flock_stream_groups", MetricType::GAUGE, "State stream encoders shared by the subscribers");
+        streamBytes = r.add("flock_stream_bytes_sent_total", MetricType::COUNTER, "State stream bytes written");
+        for (int i = 0; i < MEMORY_TAG_COUNT; i++) {
+            std::string labels = std::string("subsystem=\"") + memoryTagName(static_cast<MemoryTag>(i)) + "\"";
+            subsystemBytes[i] = r.add("flock_subsystem_bytes", MetricType::GAUGE, "Live bytes by subsystem", labels);
+            subsystemPeakBytes[i] = r.add("flock_subsystem_peak_bytes", MetricType::GAUGE, "Peak live bytes by subsystem", labels);
+            subsystemAllocations[i] = r.add("flock_subsystem_allocations_total", MetricType::COUNTER, "Allocations by subsystem", labels);
+        }
+    }
+
+    // end of a simulated frame
+    template <class Flock>
+    void publishFlock(const Flock& flock, int alive, size_t slotCount) {
+        const auto& neighborStats = flock.getNeighborStats();
+        const auto& listStats = flock.getNeighborListStats();
+        frames->add(1);
+        agents->set(alive);
+        slots->set(double(slotCount));
+        neighborQueries->set(neighborStats.queries);
+        neighborCandidates->set(double(neighborStats.candidates));
+        neighborHitRate->set(neighborStats.hitRate());
+        verletRebuilds->set(double(listStats.rebuilds));
+        verletBytes->set(double(listStats.active ? listStats.compressedBytes : 0));
+        neighbors.record(neighborStats.passMilliseconds);
+        HugePageStats& memory = hugePageStats();
+        heapBytes->set(double(memory.heapBytes.load()));
+        hugePageBytes->set(double(memory.explicitBytes.load() + memory.transparentBytes.load() + memory.regularBytes.load()));
+        for (int i = 0; i < MEMORY_TAG_COUNT; i++) {
+            const MemoryAccount& account = memoryAccount(static_cast<MemoryTag>(i));
+            subsystemBytes[i]->set(double(account.liveBytes.load()));
+            subsystemPeakBytes[i]->set(double(account.peakBytes.load()));
+            subsystemAllocations[i]->set(double(account.allocations.load()));
+        }
+    }
+};
+
+// Minimal HTTP/1.0 server for GET /metrics on 127.0.0.1, on its own thread
+class MetricsServer {
+public:
+    explicit MetricsServer(const MetricsRegistry& r) : registry(r) {}
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    ~MetricsServer() {
+        stop();
+    }
+
+    // false when the port cannot be bound
+    bool start(int port) {
+        if (running()) {
+            return true;
+        }
+#if defined(_WIN32)
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+            return false;
+        }
+#endif
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener == INVALID) {
+            return false;
+        }
+        int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof(yes));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<unsigned short>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+            closeSocket(listener);
+            listener = INVALID;
+            return false;
+        }
+        boundPort = port;
+        stopping = false;
+        thread = std::thread([this]() { serve(); });
+        return true;
+    }
+
+    void stop() {
+        if (!running()) {
+            return;
+        }
+        stopping = true;
+        thread.join();
+        closeSocket(listener);
+        listener = INVALID;
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+    }
+
+    bool running() const {
+        return thread.joinable();
+    }
+
+    int port() const {
+        return boundPort;
+    }
+
+    long long scrapes() const {
+        return scrapeCount.load(std::memory_order_relaxed);
+    }
+
+private:
+#if defined(_WIN32)
+    typedef SOCKET Socket;
+    static const Socket INVALID = INVALID_SOCKET;
+    static const int SEND_FLAGS = 0;
+    static void closeSocket(Socket s) { closesocket(s); }
+#else
+    typedef int Socket;
+    static const Socket INVALID = -1;
+    static const int SEND_FLAGS = MSG_NOSIGNAL;     // a client hanging up must not kill the process
+    static void closeSocket(Socket s) { close(s); }
+#endif
+
+    const MetricsRegistry& registry;
+    Socket listener = INVALID;
+    int boundPort = 0;
+    std::thread thread;
+    std::atomic<bool> stopping{ false };
+    std::atomic<long long> scrapeCount{ 0 };
+
+    // wakes up every 200 ms to notice stop()
+    void serve() {
+        while (!stopping) {
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(listener, &readable);
+            timeval timeout = { 0, 200000 };
+            if (select(static_cast<int>(listener) + 1, &readable, nullptr, nullptr, &timeout) <= 0) {
+                continue;
+            }
+            Socket client = accept(listener, nullptr, nullptr);
+            if (client == INVALID) {
+                continue;
+            }
+            answer(client);
+            closeSocket(client);
+        }
+    }
+
+    void answer(Socket client) {
+        // the request line is all that matters; give up on clients that send nothing for a second
+        char request[1024];
+        size_t length = 0;
+        while (length < sizeof(request) - 1) {
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(client, &readable);
+            timeval timeout = { 1, 0 };
+            if (select(static_cast<int>(client) + 1, &readable, nullptr, nullptr, &timeout) <= 0) {
+                return;
+            }
+            int n = recv(client, request + length, static_cast<int>(sizeof(request) - 1 - length), 0);
+            if (n <= 0) {
+                break;
+            }
+            length += static_cast<size_t>(n);
+            request[length] = 0;
+            if (strstr(request, "\r\n\r\n") != nullptr || strstr(request, "\n\n") != nullptr) {
+                break;
+            }
+        }
+        request[length] = 0;
+        std::string body;
+        std::string status;
+        if (strncmp(request, "GET /metrics", 12) == 0 && (request[12] == ' ' || request[12] == '?')) {
+            body = registry.render();
+            status = "200 OK";
+            scrapeCount++;
+        }
+        else {
+            body = "not found, try /metrics\n";
+            status = "404 Not Found";
+        }
+        std::string response = "HTTP/1.0 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            int n = send(client, response.data() + sent, static_cast<int>(response.size() - sent), SEND_FLAGS);
+            if (n <= 0) {
+                break;
+            }
+            sent += static_cast<size_t>(n);
+        }
+    }
+};
+
+#endif
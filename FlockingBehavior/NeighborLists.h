@@ -0,0 +1,126 @@
+#ifndef CS561_NEIGHBOR_LISTS_H
+#define CS561_NEIGHBOR_LISTS_H
+
+#include <cstdint>
+#include <vector>
+#include "HugePages.h"
+
+// Neighbor lists stored as variable-byte deltas.  Lists hold ranks in the voxel traversal order
+// (Hilbert curve), so the neighbors of an agent have ranks close to its own and to each other:
+// the first entry is stored as a zigzag delta from the agent's own rank, every further entry as
+// the gap to the previous one.  Most gaps fit in one byte, against four for a 32-bit index.
+//
+// Lists are appended in order once per rebuild and decoded on every query into a scratch array
+// that the rule kernels then read.
+
+struct NeighborListStats {
+    bool active = false;
+    long long rebuilds = 0;          // since start
+    bool rebuiltThisFrame = false;
+    long long entries = 0;           // neighbors stored over all lists
+    size_t compressedBytes = 0;      // list bytes plus per list offsets
+    size_t rawBytes = 0;             // the same lists as 32-bit indices
+
+    float ratio() const {
+        return compressedBytes > 0 ? float(rawBytes) / float(compressedBytes) : 0.0f;
+    }
+};
+
+class CompressedNeighborLists {
+public:
+    void clear() {
+        bytes.clear();
+        offsets.assign(1, 0);
+        entries = 0;
+    }
+
+    // Appends the next list; ranks must be ascending
+    void append(uint32_t selfRank, const uint32_t* ranks, size_t count) {
+        putVarint(static_cast<uint32_t>(count));
+        uint32_t previous = selfRank;
+        for (size_t i = 0; i < count; i++) {
+            if (i == 0) {
+                // zigzag on unsigned values, shifting a negative int32_t is not portable
+                uint32_t delta = ranks[0] - selfRank;
+                putVarint((delta << 1) ^ (0u - (delta >> 31)));
+            }
+            else {
+                putVarint(ranks[i] - previous);
+            }
+            previous = ranks[i];
+        }
+        offsets.push_back(static_cast<uint32_t>(bytes.size()));
+        entries += static_cast<long long>(count);
+    }
+
+    size_t size() const {
+        return offsets.size() - 1;
+    }
+
+    // Decodes list `list` (appended with selfRank) into out, which must hold count(list)
+    // entries; returns the number of ranks
+    size_t decode(size_t list, uint32_t selfRank, uint32_t* out) const {
+        const uint8_t* p = bytes.data() + offsets[list];
+        uint32_t count = getVarint(p);
+        if (count == 0) {
+            return 0;
+        }
+        uint32_t zigzag = getVarint(p);
+        uint32_t rank = selfRank + ((zigzag >> 1) ^ (0u - (zigzag & 1)));
+        out[0] = rank;
+        for (uint32_t i = 1; i < count; i++) {
+            rank += getVarint(p);
+            out[i] = rank;
+        }
+        return count;
+    }
+
+    // length of list `list` without decoding it
+    size_t count(size_t list) const {
+        const uint8_t* p = bytes.data() + offsets[list];
+        return getVarint(p);
+    }
+
+    long long entryCount() const {
+        return entries;
+    }
+
+    size_t compressedBytes() const {
+        return bytes.size() + offsets.size() * sizeof(uint32_t);
+    }
+
+    size_t rawBytes() const {
+        return static_cast<size_t>(entries) * sizeof(uint32_t) + offsets.size() * sizeof(uint32_t);
+    }
+
+private:
+    HugeVector<uint8_t, MemoryTag::NEIGHBORS> bytes;
+    HugeVector<uint32_t, MemoryTag::NEIGHBORS> offsets = HugeVector<uint32_t, MemoryTag::NEIGHBORS>(1, 0);   // list i is bytes [offsets[i], offsets[i + 1])
+    long long entries = 0;
+
+    void putVarint(uint32_t v) {
+        while (v >= 0x80) {
+            bytes.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(v));
+    }
+
+    // one byte values, by far the most common, take a single predictable branch
+    static uint32_t getVarint(const uint8_t*& p) {
+        uint32_t v = *p++;
+        if (v < 0x80) {
+            return v;
+        }
+        v &= 0x7f;
+        for (int shift = 7; ; shift += 7) {
+            uint32_t b = *p++;
+            v |= (b & 0x7f) << shift;
+            if (b < 0x80) {
+                return v;
+            }
+        }
+    }
+};
+
+#endif
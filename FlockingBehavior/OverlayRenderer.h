@@ -0,0 +1,224 @@
+#ifndef CS561_OVERLAY_RENDERER_H
+#define CS561_OVERLAY_RENDERER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include "DebugOverlay.h"
+#include "MemoryAccounting.h"
+
+// Draws a DebugOverlay with two instanced calls: a unit cube of 12 edges placed and tinted per
+// voxel, and a two point line per link or ray.  The instance buffers take the overlay's arrays
+// unchanged (orphaned and refilled every frame, grown by doubling), so the cost is the upload and
+// not one draw per voxel.  Needs GL 3.3 for the attribute divisor.
+//
+// The GL declarations come from the including file (GLEW in the driver).
+
+class OverlayRenderer {
+public:
+    OverlayRenderer() {}
+    OverlayRenderer(const OverlayRenderer&) = delete;
+    OverlayRenderer& operator=(const OverlayRenderer&) = delete;
+
+    // With the context current; false (and draw a no-op) without GL 3.3
+    bool init() {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        if (major < 3 || (major == 3 && minor < 3)) {
+            return false;
+        }
+        boxProgram = link(box_vertex_text);
+        lineProgram = link(line_vertex_text);
+        if (boxProgram == 0 || lineProgram == 0) {
+            shutdown();
+            return false;
+        }
+        glGenVertexArrays(2, vaos);
+        glGenBuffers(4, vbos);
+
+        // cube edges as corner selectors, instanced by voxel
+        const float edges[24][3] = {
+            {0,0,0}, {1,0,0}, {0,1,0}, {1,1,0}, {0,0,1}, {1,0,1}, {0,1,1}, {1,1,1},
+            {0,0,0}, {0,1,0}, {1,0,0}, {1,1,0}, {0,0,1}, {0,1,1}, {1,0,1}, {1,1,1},
+            {0,0,0}, {0,0,1}, {1,0,0}, {1,0,1}, {0,1,0}, {0,1,1}, {1,1,0}, {1,1,1}
+        };
+        glBindVertexArray(vaos[BOXES]);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[BOX_EDGES]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(edges), edges, GL_STATIC_DRAW);
+        attribute(boxProgram, "corner", 3, 3 * sizeof(float), 0, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[BOX_INSTANCES]);
+        attribute(boxProgram, "lo", 3, sizeof(OverlayBox), offsetof(OverlayBox, lo), 1);
+        attribute(boxProgram, "hi", 3, sizeof(OverlayBox), offsetof(OverlayBox, hi), 1);
+        attribute(boxProgram, "heat", 1, sizeof(OverlayBox), offsetof(OverlayBox, heat), 1);
+
+        const float ends[2] = { 0, 1 };
+        glBindVertexArray(vaos[LINES]);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[LINE_ENDS]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(ends), ends, GL_STATIC_DRAW);
+        attribute(lineProgram, "end", 1, sizeof(float), 0, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[LINE_INSTANCES]);
+        attribute(lineProgram, "from", 3, sizeof(OverlayLine), offsetof(OverlayLine, from), 1);
+        attribute(lineProgram, "to", 3, sizeof(OverlayLine), offsetof(OverlayLine, to), 1);
+        attribute(lineProgram, "color", 3, sizeof(OverlayLine), offsetof(OverlayLine, color), 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        capacity[BOX_EDGES] = sizeof(edges);
+        capacity[LINE_ENDS] = sizeof(ends);
+        memoryAccount(MemoryTag::GL_BUFFERS).allocated(capacity[BOX_EDGES] + capacity[LINE_ENDS]);
+        ready = true;
+        return true;
+    }
+
+    void shutdown() {
+        if (ready) {
+            glDeleteVertexArrays(2, vaos);
+            glDeleteBuffers(4, vbos);
+            for (size_t& bytes : capacity) {
+                memoryAccount(MemoryTag::GL_BUFFERS).freed(bytes);
+                bytes = 0;
+            }
+        }
+        if (boxProgram != 0) {
+            glDeleteProgram(boxProgram);
+        }
+        if (lineProgram != 0) {
+            glDeleteProgram(lineProgram);
+        }
+        boxProgram = lineProgram = 0;
+        ready = false;
+    }
+
+    bool available() const {
+        return ready;
+    }
+
+    // Uploads and draws the overlay of the last update; leaves no program or vertex array bound
+    void draw(const DebugOverlay& overlay, const glm::mat4& VP) {
+        if (!ready) {
+            return;
+        }
+        size_t boxes = overlay.ShowVoxels ? overlay.voxels().size() : 0;
+        size_t lines = overlay.segments().size();
+        if (boxes > 0) {
+            upload(BOX_INSTANCES, overlay.voxels().data(), boxes * sizeof(OverlayBox));
+            glUseProgram(boxProgram);
+            glUniformMatrix4fv(glGetUniformLocation(boxProgram, "VP_matrix"), 1, false, &VP[0][0]);
+            glBindVertexArray(vaos[BOXES]);
+            glDrawArraysInstanced(GL_LINES, 0, 24, GLsizei(boxes));
+        }
+        if (lines > 0) {
+            upload(LINE_INSTANCES, overlay.segments().data(), lines * sizeof(OverlayLine));
+            glUseProgram(lineProgram);
+            glUniformMatrix4fv(glGetUniformLocation(lineProgram, "VP_matrix"), 1, false, &VP[0][0]);
+            glBindVertexArray(vaos[LINES]);
+            glDrawArraysInstanced(GL_LINES, 0, 2, GLsizei(lines));
+        }
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+
+private:
+    enum { BOXES, LINES };
+    enum { BOX_EDGES, BOX_INSTANCES, LINE_ENDS, LINE_INSTANCES };
+
+    static GLuint link(const char* vertex_text) {
+        const char* source[2] = { vertex_text, fragment_text };
+        GLenum type[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+        GLuint program = glCreateProgram();
+        for (int i = 0; i < 2; i++) {
+            GLuint shader = glCreateShader(type[i]);
+            glShaderSource(shader, 1, source + i, 0);
+            glCompileShader(shader);
+            GLint value = 0;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &value);
+            if (!value) {
+                char buffer[1024];
+                glGetShaderInfoLog(shader, 1024, 0, buffer);
+                std::cerr << "overlay shader error:" << std::endl << buffer << std::endl;
+            }
+            glAttachShader(program, shader);
+            glDeleteShader(shader);
+        }
+        glLinkProgram(program);
+        GLint linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+
+    // float attribute from the bound GL_ARRAY_BUFFER; divisor 1 advances per instance
+    static void attribute(GLuint program, const char* name, int size, size_t stride, size_t offset, GLuint divisor) {
+        GLint loc = glGetAttribLocation(program, name);
+        if (loc < 0) {
+            return;
+        }
+        glVertexAttribPointer(GLuint(loc), size, GL_FLOAT, false, GLsizei(stride), reinterpret_cast<const void*>(offset));
+        glEnableVertexAttribArray(GLuint(loc));
+        glVertexAttribDivisor(GLuint(loc), divisor);
+    }
+
+    // orphans the buffer so the upload never waits for last frame's draw
+    void upload(int buffer, const void* data, size_t bytes) {
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[buffer]);
+        if (bytes > capacity[buffer]) {
+            size_t grown = std::max(bytes, 2 * capacity[buffer]);
+            memoryAccount(MemoryTag::GL_BUFFERS).allocated(grown);
+            memoryAccount(MemoryTag::GL_BUFFERS).freed(capacity[buffer]);
+            capacity[buffer] = grown;
+        }
+        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(capacity[buffer]), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(bytes), data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    static constexpr const char* box_vertex_text = R"blah(
+      #version 330
+      in vec3 corner;
+      in vec3 lo;
+      in vec3 hi;
+      in float heat;
+      uniform mat4 VP_matrix;
+      out vec3 line_color;
+      void main() {
+        gl_Position = VP_matrix * vec4(mix(lo, hi, corner), 1);
+        line_color = mix(vec3(0.3, 0.5, 1.0), vec3(1.0, 0.1, 0.0), heat);
+      }
+    )blah";
+
+    static constexpr const char* line_vertex_text = R"blah(
+      #version 330
+      in float end;
+      in vec3 from;
+      in vec3 to;
+      in vec3 color;
+      uniform mat4 VP_matrix;
+      out vec3 line_color;
+      void main() {
+        gl_Position = VP_matrix * vec4(mix(from, to, end), 1);
+        line_color = color;
+      }
+    )blah";
+
+    static constexpr const char* fragment_text = R"blah(
+      #version 330
+      in vec3 line_color;
+      out vec4 frag_color;
+      void main(void) {
+        frag_color = vec4(line_color, 1);
+      }
+    )blah";
+
+    GLuint boxProgram = 0;
+    GLuint lineProgram = 0;
+    GLuint vaos[2] = {};
+    GLuint vbos[4] = {};
+    size_t capacity[4] = {};            // bytes of every buffer, accounted to MemoryTag::GL_BUFFERS
+    bool ready = false;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef CS561_PERF_COUNTERS_H
+#define CS561_PERF_COUNTERS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters around the phases of a flock update, to tell why a phase is slow
+// and not only that it is: instructions per cycle, and cache, branch and TLB misses per agent.
+// Counters come from Linux perf_event_open for the calling thread, user space only.  Any counter
+// the kernel or the CPU refuses (no PMU in a VM, perf_event_paranoid, other platforms) is marked
+// unavailable and reads as zero; the rest keep working.
+//
+// The counters are opened as one group led by cycles (or the first counter that opens), so the
+// kernel schedules them together and they all cover the same time: ratios like IPC and misses
+// per agent stay meaningful even when the group has to share the PMU with other events.
+//
+// Set flock.Counters to an opened PerfCounters to enable it; without one the flocker does no extra
+// work.
+
+enum class PerfCounter {
+    CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, DTLB_MISSES
+};
+const int PERF_COUNTER_COUNT = 6;
+
+enum class PerfPhase {
+    GRID,           // buildVoxelCache: voxel hashing, cell traversal order, Verlet list upkeep
+    NEIGHBORS,      // neighbor queries and rule evaluation
+    INTEGRATE       // avoidance, velocity and position update
+};
+const int PERF_PHASE_COUNT = 3;
+
+inline const char* perfCounterName(PerfCounter counter) {
+    static const char* names[PERF_COUNTER_COUNT] = { "cycles", "instructions", "L1d misses", "LLC misses", "branch misses", "dTLB misses" };
+    return names[static_cast<int>(counter)];
+}
+
+inline const char* perfPhaseName(PerfPhase phase) {
+    static const char* names[PERF_PHASE_COUNT] = { "grid", "neighbors", "integrate" };
+    return names[static_cast<int>(phase)];
+}
+
+// Counts of one phase in one frame, scaled up by the same factor when the kernel had to multiplex
+// the counter group
+struct PhaseCounts {
+    uint64_t values[PERF_COUNTER_COUNT] = {};
+    double milliseconds = 0;
+    int agents = 0;
+
+    uint64_t operator[](PerfCounter counter) const {
+        return values[static_cast<int>(counter)];
+    }
+
+    double ipc() const {
+        uint64_t cycles = (*this)[PerfCounter::CYCLES];
+        return cycles > 0 ? double((*this)[PerfCounter::INSTRUCTIONS]) / double(cycles) : 0.0;
+    }
+
+    double perAgent(PerfCounter counter) const {
+        return agents > 0 ? double((*this)[counter]) / double(agents) : 0.0;
+    }
+
+    void add(const PhaseCounts& other) {
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            values[i] += other.values[i];
+        }
+        milliseconds += other.milliseconds;
+        agents += other.agents;
+    }
+};
+
+class PerfCounters {
+public:
+    PerfCounters() {}
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+        close();
+    }
+
+    // Opens the counters for the calling thread; true when at least one is available.  The
+    // phases must then run on this thread.
+    bool open() {
+        close();
+        error.clear();
+#if defined(__linux__)
+        static const uint32_t types[PERF_COUNTER_COUNT] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+        };
+        static const uint64_t configs[PERF_COUNTER_COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+        };
+        int groupSize = 0;
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int groupFd = leader >= 0 ? fds[leader] : -1;
+            fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+            if (fds[i] >= 0) {
+                leader = leader >= 0 ? leader : i;
+                slots[i] = groupSize++;   // position in the group read, in the order of opening
+            }
+            if (fds[i] < 0 && error.empty()) {
+                error = std::string(perfCounterName(static_cast<PerfCounter>(i))) + ": " + strerror(errno);
+                if (errno == EACCES || errno == EPERM) {
+                    error += " (see /proc/sys/kernel/perf_event_paranoid)";
+                }
+            }
+        }
+#else
+        error = "hardware counters need Linux perf_event_open";
+#endif
+        return available();
+    }
+
+    void close() {
+#if defined(__linux__)
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            if (fds[i] >= 0 && i != leader) {
+                ::close(fds[i]);
+            }
+        }
+        if (leader >= 0) {
+            ::close(fds[leader]);
+        }
+#endif
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            fds[i] = -1;
+            slots[i] = -1;
+        }
+        leader = -1;
+    }
+
+    bool available() const {
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            if (available(static_cast<PerfCounter>(i))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool available(PerfCounter counter) const {
+        return fds[static_cast<int>(counter)] >= 0;
+    }
+
+    // why the first unavailable counter could not be opened, empty when all are open
+    const std::string& lastError() const {
+        return error;
+    }
+
+    void begin(PerfPhase phase) {
+        Running& r = running[static_cast<int>(phase)];
+        r.start = std::chrono::steady_clock::now();
+        sample(r.at);
+    }
+
+    // The whole group ran for the same share of the phase, so every count is scaled by it; a phase
+    // the group never got on the PMU for reads as zero
+    void end(PerfPhase phase, int agents) {
+        Sample now;
+        sample(now);
+        Running& r = running[static_cast<int>(phase)];
+        PhaseCounts& counts = last[static_cast<int>(phase)];
+        counts.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - r.start).count();
+        counts.agents = agents;
+        uint64_t enabled = now.enabled - r.at.enabled;
+        uint64_t ran = now.running - r.at.running;
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            uint64_t value = now.values[i] - r.at.values[i];
+            counts.values[i] = ran == 0 ? 0 : (ran < enabled ? uint64_t(double(value) * double(enabled) / double(ran)) : value);
+        }
+    }
+
+    // the phase in the last frame that ran it
+    const PhaseCounts& phase(PerfPhase p) const {
+        return last[static_cast<int>(p)];
+    }
+
+private:
+    // one read of the group: every counter and the group's enabled and running time
+    struct Sample {
+        uint64_t values[PERF_COUNTER_COUNT] = {};
+        uint64_t enabled = 0;
+        uint64_t running = 0;
+    };
+
+    struct Running {
+        Sample at;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    int fds[PERF_COUNTER_COUNT] = { -1, -1, -1, -1, -1, -1 };
+    int slots[PERF_COUNTER_COUNT] = { -1, -1, -1, -1, -1, -1 };   // index in the group read
+    int leader = -1;                                                // counter leading the group
+    std::string error;
+    Running running[PERF_PHASE_COUNT];
+    PhaseCounts last[PERF_PHASE_COUNT];
+
+    // PERF_FORMAT_GROUP layout: counter count, time enabled, time running, then the values
+    void sample(Sample& out) const {
+        out = Sample();
+#if defined(__linux__)
+        uint64_t data[3 + PERF_COUNTER_COUNT];
+        if (leader < 0) {
+            return;
+        }
+        ssize_t bytes = read(fds[leader], data, sizeof(data));
+        if (bytes < static_cast<ssize_t>(3 * sizeof(uint64_t)) || bytes < static_cast<ssize_t>((3 + data[0]) * sizeof(uint64_t))) {
+            return;
+        }
+        out.enabled = data[1];
+        out.running = data[2];
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            if (slots[i] >= 0 && uint64_t(slots[i]) < data[0]) {
+                out.values[i] = data[3 + slots[i]];
+            }
+        }
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef CS561_PROXIMITY_EVENTS_H
+#define CS561_PROXIMITY_EVENTS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Enter / exit events for gameplay code: an agent gaining or losing a neighbor, and an agent
+// entering or leaving a trigger sphere (a player, a pickup, a zone).  The flocker hands the
+// tracker sorted agent id lists from its neighbor pass and from grid queries around each trigger;
+// the tracker merges each list against last frame's and only emits the differences.  Events of a
+// frame are published as one batch into a single producer / single consumer ring, so the game
+// thread can drain them while the next frame simulates.
+//
+// Set flock.Proximity to a tracker to enable it; without one the flocker does no extra work.
+
+enum class ProximityEventType : uint8_t {
+    NEIGHBOR_ENTER, NEIGHBOR_EXIT, TRIGGER_ENTER, TRIGGER_EXIT
+};
+
+struct ProximityEvent {
+    ProximityEventType type;
+    uint32_t frame;
+    uint32_t observer;    // agent id for neighbor events, trigger id for trigger events
+    uint32_t agent;       // the agent that came into or went out of range
+};
+
+// A sphere whose members are tracked; Id is reported in the events
+struct ProximityTrigger {
+    uint32_t Id = 0;
+    glm::vec3 Center = glm::vec3(0);
+    float Radius = 1.0f;
+};
+
+struct ProximityStats {
+    uint32_t frame = 0;
+    int neighborEnters = 0;     // last frame
+    int neighborExits = 0;
+    int triggerEnters = 0;
+    int triggerExits = 0;
+    long long dropped = 0;      // events lost because the consumer fell behind, since start
+};
+
+// Bounded single producer / single consumer ring; push and pop never block or allocate
+template <class T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity = 1 << 16) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        items.resize(size);
+        mask = size - 1;
+    }
+
+    // copies as many items as fit and makes them visible together; returns how many were taken
+    size_t push(const T* source, size_t count) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t n = std::min(count, items.size() - (h - t));
+        for (size_t i = 0; i < n; i++) {
+            items[(h + i) & mask] = source[i];
+        }
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t pop(T* target, size_t maxCount) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        size_t n = std::min(maxCount, h - t);
+        for (size_t i = 0; i < n; i++) {
+            target[i] = items[(t + i) & mask];
+        }
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> items;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{ 0 };   // written by the producer
+    alignas(64) std::atomic<size_t> tail{ 0 };   // written by the consumer
+};
+
+class ProximityTracker {
+public:
+    bool TrackNeighbors = true;
+    std::vector<ProximityTrigger> Triggers;
+
+    explicit ProximityTracker(size_t ringCapacity = 1 << 16) : ring(ringCapacity) {}
+
+    // Consumer side: moves up to maxCount published events into out, returns how many
+    size_t drain(std::vector<ProximityEvent>& out, size_t maxCount = 4096) {
+        size_t first = out.size();
+        out.resize(first + maxCount);
+        size_t n = ring.pop(out.data() + first, maxCount);
+        out.resize(first + n);
+        return n;
+    }
+
+    const ProximityStats& getStats() const {
+        return stats;
+    }
+
+    // events published but not drained yet
+    size_t queued() const {
+        return ring.size();
+    }
+
+    // --- producer side, called by the flocker ---
+
+    // Matches the per slot state to the agents now in the slots.  Agents moved to another slot
+    // (pool compaction) keep their lists; agents that are gone report an exit for every neighbor.
+    template <class BoidList>
+    void beginFrame(const BoidList& boids) {
+        stats.frame++;
+        stats.neighborEnters = stats.neighborExits = stats.triggerEnters = stats.triggerExits = 0;
+        pending.clear();
+        if (!TrackNeighbors) {
+            slots.clear();
+            return;
+        }
+        for (size_t s = boids.size(); s < slots.size(); s++) {
+            orphan(slots[s]);
+        }
+        slots.resize(boids.size());
+        moved.clear();
+        for (size_t s = 0; s < boids.size(); s++) {
+            uint32_t owner = boids[s].alive ? boids[s].id : 0;
+            if (slots[s].owner != owner) {
+                orphan(slots[s]);
+                slots[s].owner = owner;
+                moved.push_back(static_cast<int>(s));
+            }
+        }
+        for (int s : moved) {
+            auto iter = orphans.find(slots[s].owner);
+            if (iter != orphans.end()) {
+                slots[s].ids.swap(iter->second);
+                orphans.erase(iter);
+            }
+        }
+        for (auto& entry : orphans) {
+            for (uint32_t id : entry.second) {
+                emit(ProximityEventType::NEIGHBOR_EXIT, entry.first, id);
+            }
+        }
+        orphans.clear();
+    }
+
+    // sortedIds: ids of the neighbors of the agent in `slot` this frame, ascending
+    void neighbors(int slot, const std::vector<uint32_t>& sortedIds) {
+        SlotState& state = slots[slot];
+        diff(state.ids, sortedIds, state.owner, ProximityEventType::NEIGHBOR_ENTER, ProximityEventType::NEIGHBOR_EXIT);
+        state.ids.assign(sortedIds.begin(), sortedIds.end());
+    }
+
+    // sortedIds: ids of the agents inside Triggers[index] this frame, ascending
+    void triggerMembers(size_t index, const std::vector<uint32_t>& sortedIds) {
+        if (triggers.size() < Triggers.size()) {
+            triggers.resize(Triggers.size());
+        }
+        SlotState& state = triggers[index];
+        uint32_t id = Triggers[index].Id;
+        if (state.owner != id) {
+            // the trigger in this entry was replaced: everyone left the old one
+            for (uint32_t member : state.ids) {
+                emit(ProximityEventType::TRIGGER_EXIT, state.owner, member);
+            }
+            state.ids.clear();
+            state.owner = id;
+        }
+        diff(state.ids, sortedIds, id, ProximityEventType::TRIGGER_ENTER, ProximityEventType::TRIGGER_EXIT);
+        state.ids.assign(sortedIds.begin(), sortedIds.end());
+    }
+
+    // Publishes the frame's events in one batch
+    void endFrame() {
+        for (size_t t = Triggers.size(); t < triggers.size(); t++) {
+            for (uint32_t member : triggers[t].ids) {
+                emit(ProximityEventType::TRIGGER_EXIT, triggers[t].owner, member);
+            }
+        }
+        triggers.resize(std::min(triggers.size(), Triggers.size()));
+        size_t pushed = ring.push(pending.data(), pending.size());
+        stats.dropped += static_cast<long long>(pending.size() - pushed);
+        pending.clear();
+    }
+
+private:
+    struct SlotState {
+        uint32_t owner = 0;             // agent (or trigger) id the list belongs to, 0 for none
+        std::vector<uint32_t> ids;      // sorted
+    };
+
+    std::vector<SlotState> slots;       // per agent slot, last frame's neighbors
+    std::vector<SlotState> triggers;    // per trigger, last frame's members
+    std::unordered_map<uint32_t, std::vector<uint32_t>> orphans;   // lists whose agent left its slot
+    std::vector<int> moved;
+    std::vector<ProximityEvent> pending;
+    SpscRing<ProximityEvent> ring;
+    ProximityStats stats;
+
+    void orphan(SlotState& state) {
+        if (state.owner != 0) {
+            orphans[state.owner].swap(state.ids);
+        }
+        state.ids.clear();
+        state.owner = 0;
+    }
+
+    // merge of two sorted lists; equal lists cost one pass and emit nothing
+    void diff(const std::vector<uint32_t>& before, const std::vector<uint32_t>& after, uint32_t observer,
+              ProximityEventType enter, ProximityEventType exit) {
+        if (before == after) {
+            return;
+        }
+        size_t i = 0, j = 0;
+        while (i < before.size() || j < after.size()) {
+            if (j == after.size() || (i < before.size() && before[i] < after[j])) {
+                emit(exit, observer, before[i++]);
+            }
+            else if (i == before.size() || after[j] < before[i]) {
+                emit(enter, observer, after[j++]);
+            }
+            else {
+                i++;
+                j++;
+            }
+        }
+    }
+
+    void emit(ProximityEventType type, uint32_t observer, uint32_t agent) {
+        ProximityEvent e;
+        e.type = type;
+        e.frame = stats.frame;
+        e.observer = observer;
+        e.agent = agent;
+        pending.push_back(e);
+        switch (type) {
+        case ProximityEventType::NEIGHBOR_ENTER: stats.neighborEnters++; break;
+        case ProximityEventType::NEIGHBOR_EXIT: stats.neighborExits++; break;
+        case ProximityEventType::TRIGGER_ENTER: stats.triggerEnters++; break;
+        case ProximityEventType::TRIGGER_EXIT: stats.triggerExits++; break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef CS561_RULE_PLUGINS_H
+#define CS561_RULE_PLUGINS_H
+
+#include <tuple>
+#include "BehaviorStates.h"
+
+// Steering rules as compile-time plugins.  A rule is a copyable type that is its own per-agent
+// accumulator: a fresh copy is made for every agent, fed every neighbor, then asked for its force.
+//
+//     template <class Flocker, class Boid, class Neighbor>
+//     void accumulate(Flocker& flock, const Boid& self, const Neighbor& neighbor);
+//
+//     template <class Flocker, class Boid>
+//     Vec3 finalize(Flocker& flock, const Boid& self, int count, const StateRules& rules);
+//
+// finalize returns the rule's weighted contribution to the acceleration.  applyRules() expands a
+// tuple of rules into a single neighbor loop, so every rule is inlined into the same traversal
+// and a rule costs only its own arithmetic.  Extra rules are added as template arguments of
+// BasicFlocker, e.g. BasicFlocker<FloatTraits, VelocityMatchingRule<FloatTraits>>.
+
+// true if any component of a equals the same component of b
+template <class Vec3>
+bool anyComponentEqual(const Vec3& a, const Vec3& b) {
+    return a.x == b.x || a.y == b.y || a.z == b.z;
+}
+
+template <class Tuple, class Flocker, class Boid, class Neighbors>
+typename Flocker::Vec3 applyRules(Tuple& rules, Flocker& flock, const Boid& self, const Neighbors& nearby,
+                                  const StateRules& stateRules) {
+    for (const auto& neighbor : nearby) {
+        std::apply([&](auto&... rule) { (rule.accumulate(flock, self, neighbor), ...); }, rules);
+    }
+    typename Flocker::Vec3 acceleration(0);
+    int count = static_cast<int>(nearby.size());
+    std::apply([&](auto&... rule) { ((acceleration += rule.finalize(flock, self, count, stateRules)), ...); }, rules);
+    return acceleration;
+}
+
+// applyRules, also storing every rule's contribution in tuple order; the sum is formed in the same
+// order, so the acceleration is identical
+template <class Tuple, class Flocker, class Boid, class Neighbors>
+typename Flocker::Vec3 applyRulesRecorded(Tuple& rules, Flocker& flock, const Boid& self, const Neighbors& nearby,
+                                          const StateRules& stateRules, typename Flocker::Vec3* contributions) {
+    for (const auto& neighbor : nearby) {
+        std::apply([&](auto&... rule) { (rule.accumulate(flock, self, neighbor), ...); }, rules);
+    }
+    typename Flocker::Vec3 acceleration(0);
+    int count = static_cast<int>(nearby.size());
+    int i = 0;
+    std::apply([&](auto&... rule) {
+        ((contributions[i] = rule.finalize(flock, self, count, stateRules), acceleration += contributions[i], i++), ...);
+    }, rules);
+    return acceleration;
+}
+
+// Separation: steer to avoid crowding local agents
+template <class Traits>
+struct SeparationRule {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    Vec3 sum = Vec3(0);
+    Vec3 value = Vec3(0);   // average before weighting, set by finalize
+
+    template <class Flocker, class Boid, class Neighbor>
+    void accumulate(Flocker& flock, const Boid&, const Neighbor& neighbor) {
+        if (neighbor.distance == Scalar(0)) {
+            sum += flock.randomDirection() * Scalar(1000);
+        }
+        else {
+            Scalar separationFactor = Flocker::transformDistance(neighbor.distance, flock.frameParams().SeparationType);
+            sum += -neighbor.direction * separationFactor;  // moving away from neighbor boid
+        }
+    }
+
+    template <class Flocker, class Boid>
+    Vec3 finalize(Flocker& flock, const Boid&, int count, const StateRules& rules) {
+        value = count > 0 ? sum / Scalar(count) : sum;
+        return value * (flock.frameParams().SeparationWeight * Scalar(rules.SeparationScale));
+    }
+};
+
+// Alignment: steer towards the average heading of local agents
+template <class Traits>
+struct AlignmentRule {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    Vec3 sum = Vec3(0);
+    Vec3 value = Vec3(0);
+
+    template <class Flocker, class Boid, class Neighbor>
+    void accumulate(Flocker&, const Boid&, const Neighbor& neighbor) {
+        sum += neighbor.boid->velocity;
+    }
+
+    template <class Flocker, class Boid>
+    Vec3 finalize(Flocker& flock, const Boid&, int count, const StateRules& rules) {
+        value = count > 0 ? sum / Scalar(count) : sum;
+        return value * (flock.frameParams().AlignmentWeight * Scalar(rules.AlignmentScale));
+    }
+};
+
+// Cohesion: steer to move toward the average position of local agents
+template <class Traits>
+struct CohesionRule {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    Vec3 sum = Vec3(0);
+    Vec3 value = Vec3(0);
+
+    template <class Flocker, class Boid, class Neighbor>
+    void accumulate(Flocker&, const Boid&, const Neighbor& neighbor) {
+        sum += neighbor.boid->position;
+    }
+
+    template <class Flocker, class Boid>
+    Vec3 finalize(Flocker& flock, const Boid& self, int count, const StateRules& rules) {
+        Vec3 avgPosition = count > 0 ? sum / Scalar(count) : self.position;
+        value = avgPosition - self.position;
+        return value * (flock.frameParams().CohesionWeight * Scalar(rules.CohesionScale));
+    }
+};
+
+// Steering: steer towards the nearest world target location (like a moth to the light)
+template <class Traits>
+struct SteeringRule {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    Vec3 target = Vec3(0);   // chosen target, the agent's own position without targets
+
+    template <class Flocker, class Boid, class Neighbor>
+    void accumulate(Flocker&, const Boid&, const Neighbor&) {}
+
+    template <class Flocker, class Boid>
+    Vec3 finalize(Flocker& flock, const Boid& self, int, const StateRules& rules) {
+        target = self.position;
+        Scalar targetDistance = Scalar(-1);
+        for (auto& candidate : flock.frameParams().SteeringTargets) {
+            Scalar distance = Flocker::transformDistance(length(self.position - candidate), flock.frameParams().SteeringTargetType);
+            if (targetDistance < Scalar(0) || distance < targetDistance) {
+                target = candidate;
+                targetDistance = distance;
+            }
+        }
+        Vec3 steering(0);
+        // avoid division by zero
+        if (!anyComponentEqual(target, self.position)) {
+            steering = normalize(target - self.position) * targetDistance;
+        }
+        return steering * (flock.frameParams().SteeringWeight * Scalar(rules.SteeringScale));
+    }
+};
+
+// Fleeing: steer straight away from the obstacle (weight is zero outside the fleeing state)
+template <class Traits>
+struct FleeRule {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+
+    template <class Flocker, class Boid, class Neighbor>
+    void accumulate(Flocker&, const Boid&, const Neighbor&) {}
+
+    template <class Flocker, class Boid>
+    Vec3 finalize(Flocker& flock, const Boid& self, int, const StateRules& rules) {
+        Vec3 fleeing = self.position - flock.frameParams().CollisionCenter;
+        Scalar fleeLength = length(fleeing);
+        fleeing = fleeLength > Scalar(0) ? fleeing / fleeLength : fleeing;
+        return fleeing * Scalar(rules.FleeWeight);
+    }
+};
+
+// Example extra rule: match the velocity of close neighbors, weighted by 1 / (1 + distance)
+template <class Traits>
+struct VelocityMatchingRule {
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    Scalar Weight = Scalar(0.5f);
+    Vec3 sum = Vec3(0);
+    Scalar totalWeight = Scalar(0);
+
+    template <class Flocker, class Boid, class Neighbor>
+    void accumulate(Flocker&, const Boid& self, const Neighbor& neighbor) {
+        Scalar w = Scalar(1) / (Scalar(1) + neighbor.distance);
+        sum += (neighbor.boid->velocity - self.velocity) * w;
+        totalWeight += w;
+    }
+
+    template <class Flocker, class Boid>
+    Vec3 finalize(Flocker&, const Boid&, int, const StateRules&) {
+        return totalWeight > Scalar(0) ? sum * (Weight / totalWeight) : Vec3(0);
+    }
+};
+
+#endif
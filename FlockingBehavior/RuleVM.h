@@ -0,0 +1,616 @@
+#ifndef CS561_RULE_VM_H
+#define CS561_RULE_VM_H
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+// A small language for prototyping extra steering forces without rebuilding the simulation.
+// A rule is a list of statements, separated by new lines or ';', '#' starts a comment:
+//
+//     param swirl = 1.5                          # tunable, changeable while the rule runs
+//     let side = cross(vec(0, 0, 1), toTarget)   # named intermediate value
+//     force = normalize(side) * swirl            # required, added to the agent's acceleration
+//
+// Values are scalars or 3-vectors.  Operators: + - * / (component-wise, scalars broadcast),
+// unary -, and .x .y .z.  Functions: vec(x, y, z), dot, cross, length, normalize, min, max,
+// clamp(x, lo, hi), abs, sqrt, step(edge, x) (1 where x >= edge, else 0).  Division by zero
+// and the square root of a negative number give 0.
+//
+// Rules compile once to a register bytecode in which every vector operation is split into its
+// components.  The interpreter runs each instruction over a batch of RULE_BATCH_SIZE agents, so
+// the dispatch cost is paid once per batch and the inner loops vectorize.
+
+const int RULE_BATCH_SIZE = 16;
+
+// Per agent values a rule can read
+enum class RuleInput {
+    NEIGHBORS,          // number of neighbors
+    SPEED,              // length of the agent's velocity
+    TARGET_DISTANCE,    // distance to the steering target the agent follows (0 without targets)
+    OBSTACLE_DISTANCE,  // distance to the obstacle surface
+    POSITION,
+    VELOCITY,
+    SEPARATION,         // average separation, alignment and cohesion terms of the built-in rules
+    ALIGNMENT,
+    COHESION,
+    TO_TARGET,          // from the agent to that steering target
+    TO_OBSTACLE,        // from the agent to the obstacle center
+    COUNT
+};
+
+const int RULE_INPUT_COUNT = static_cast<int>(RuleInput::COUNT);
+
+struct RuleInputInfo {
+    const char* name;
+    bool vector;
+};
+
+inline const RuleInputInfo& ruleInputInfo(RuleInput input) {
+    static const RuleInputInfo inputs[RULE_INPUT_COUNT] = {
+        { "neighbors", false }, { "speed", false }, { "targetDistance", false }, { "obstacleDistance", false },
+        { "position", true }, { "velocity", true }, { "separation", true }, { "alignment", true },
+        { "cohesion", true }, { "toTarget", true }, { "toObstacle", true },
+    };
+    return inputs[static_cast<int>(input)];
+}
+
+// first register of an input; inputs occupy the lowest registers, vectors take three
+inline int ruleInputRegister(RuleInput input) {
+    struct Table {
+        int first[RULE_INPUT_COUNT + 1];
+        Table() {
+            first[0] = 0;
+            for (int i = 0; i < RULE_INPUT_COUNT; i++) {
+                first[i + 1] = first[i] + (ruleInputInfo(static_cast<RuleInput>(i)).vector ? 3 : 1);
+            }
+        }
+    };
+    static const Table table;
+    return table.first[static_cast<int>(input)];
+}
+
+enum class RuleOp : unsigned char {
+    ADD, SUB, MUL, DIV, MIN, MAX, STEP, NEG, ABS, SQRT
+};
+
+struct RuleInstruction {
+    RuleOp op;
+    unsigned short dst, a, b;
+};
+
+struct RuleParameter {
+    std::string name;
+    int reg;
+    float value;
+};
+
+struct RuleProgram {
+    bool valid = false;
+    std::string error;               // "line N: ..." when compilation failed
+    std::vector<RuleInstruction> code;
+    std::vector<std::pair<int, float>> constants;   // register, value
+    std::vector<RuleParameter> parameters;
+    int registerCount = 0;
+    int force[3] = { 0, 0, 0 };      // registers of the force components
+
+    bool setParameter(const std::string& name, float value) {
+        for (auto& p : parameters) {
+            if (p.name == name) {
+                p.value = value;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+namespace rulevm_detail {
+
+const int MAX_REGISTERS = 4096;
+
+struct Value {
+    bool vector;
+    int reg[3];
+};
+
+class Compiler {
+public:
+    Compiler(const std::string& text, RuleProgram& out) : src(text), program(out) {}
+
+    void compile() {
+        program = RuleProgram();
+        program.registerCount = ruleInputRegister(RuleInput::COUNT);
+        for (int i = 0; i < RULE_INPUT_COUNT; i++) {
+            RuleInput input = static_cast<RuleInput>(i);
+            int reg = ruleInputRegister(input);
+            bool vector = ruleInputInfo(input).vector;
+            Value v = { vector, { reg, vector ? reg + 1 : reg, vector ? reg + 2 : reg } };
+            names[ruleInputInfo(input).name] = v;
+        }
+        bool hasForce = false;
+        while (!failed) {
+            skipSeparators();
+            if (pos >= src.size()) {
+                break;
+            }
+            std::string word = identifier();
+            if (word == "param") {
+                std::string name = identifier();
+                expect('=');
+                float sign = accept('-') ? -1.0f : 1.0f;
+                float value = sign * number();
+                if (!failed && declare(name)) {
+                    Value v = scalar(newRegister());
+                    RuleParameter p = { name, v.reg[0], value };
+                    program.parameters.push_back(p);
+                    names[name] = v;
+                }
+            }
+            else if (word == "let") {
+                std::string name = identifier();
+                expect('=');
+                Value v = expression();
+                if (!failed && declare(name)) {
+                    names[name] = v;
+                }
+            }
+            else if (word == "force") {
+                expect('=');
+                Value v = expression();
+                if (!failed && !v.vector) {
+                    fail("force must be a vector");
+                }
+                for (int c = 0; c < 3 && !failed; c++) {
+                    program.force[c] = v.reg[c];
+                }
+                hasForce = !failed;
+            }
+            else if (!failed) {
+                fail("expected 'param', 'let' or 'force'");
+            }
+            if (!failed) {
+                skipSpaces();
+                if (pos < src.size() && src[pos] != '\n' && src[pos] != ';' && src[pos] != '#') {
+                    fail("unexpected '" + std::string(1, src[pos]) + "'");
+                }
+            }
+        }
+        if (!failed && !hasForce) {
+            fail("missing 'force = ...'");
+        }
+        program.valid = !failed;
+        if (failed) {
+            program.code.clear();
+        }
+    }
+
+private:
+    const std::string& src;
+    RuleProgram& program;
+    size_t pos = 0;
+    int line = 1;
+    bool failed = false;
+    std::map<std::string, Value> names;
+    std::map<float, int> constantRegisters;
+
+    void fail(const std::string& message) {
+        if (!failed) {
+            failed = true;
+            program.error = "line " + std::to_string(line) + ": " + message;
+        }
+    }
+
+    void skipSpaces() {
+        while (pos < src.size() && (src[pos] == ' ' || src[pos] == '\t' || src[pos] == '\r')) {
+            pos++;
+        }
+    }
+
+    void skipSeparators() {
+        for (;;) {
+            skipSpaces();
+            if (pos >= src.size()) {
+                return;
+            }
+            if (src[pos] == '#') {
+                while (pos < src.size() && src[pos] != '\n') {
+                    pos++;
+                }
+            }
+            else if (src[pos] == '\n' || src[pos] == ';') {
+                line += src[pos] == '\n' ? 1 : 0;
+                pos++;
+            }
+            else {
+                return;
+            }
+        }
+    }
+
+    bool accept(char c) {
+        skipSpaces();
+        if (pos < src.size() && src[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!failed && !accept(c)) {
+            fail(std::string("expected '") + c + "'");
+        }
+    }
+
+    std::string identifier() {
+        skipSpaces();
+        size_t start = pos;
+        while (pos < src.size() && (std::isalnum(static_cast<unsigned char>(src[pos])) || src[pos] == '_')) {
+            pos++;
+        }
+        if (start == pos || std::isdigit(static_cast<unsigned char>(src[start]))) {
+            fail("expected a name");
+            return std::string();
+        }
+        return src.substr(start, pos - start);
+    }
+
+    float number() {
+        skipSpaces();
+        const char* begin = src.c_str() + pos;
+        char* end = nullptr;
+        float value = std::strtof(begin, &end);
+        if (end == begin) {
+            fail("expected a number");
+            return 0;
+        }
+        pos += end - begin;
+        return value;
+    }
+
+    bool declare(const std::string& name) {
+        if (names.count(name) || name == "param" || name == "let" || name == "force") {
+            fail("'" + name + "' is already defined");
+            return false;
+        }
+        return true;
+    }
+
+    int newRegister() {
+        if (program.registerCount >= MAX_REGISTERS) {
+            fail("rule too long");
+            return 0;
+        }
+        return program.registerCount++;
+    }
+
+    int constant(float value) {
+        auto iter = constantRegisters.find(value);
+        if (iter != constantRegisters.end()) {
+            return iter->second;
+        }
+        int reg = newRegister();
+        program.constants.push_back(std::make_pair(reg, value));
+        constantRegisters[value] = reg;
+        return reg;
+    }
+
+    int emit(RuleOp op, int a, int b = 0) {
+        RuleInstruction instruction;
+        instruction.op = op;
+        instruction.dst = static_cast<unsigned short>(newRegister());
+        instruction.a = static_cast<unsigned short>(a);
+        instruction.b = static_cast<unsigned short>(b);
+        program.code.push_back(instruction);
+        return instruction.dst;
+    }
+
+    static Value scalar(int reg) {
+        Value v = { false, { reg, reg, reg } };
+        return v;
+    }
+
+    // component-wise operation, scalars broadcast against vectors
+    Value apply(RuleOp op, const Value& a, const Value& b) {
+        Value r = { a.vector || b.vector, { 0, 0, 0 } };
+        int n = r.vector ? 3 : 1;
+        for (int c = 0; c < n; c++) {
+            r.reg[c] = emit(op, a.reg[a.vector ? c : 0], b.reg[b.vector ? c : 0]);
+        }
+        if (!r.vector) {
+            r.reg[1] = r.reg[2] = r.reg[0];
+        }
+        return r;
+    }
+
+    Value apply(RuleOp op, const Value& a) {
+        Value r = a;
+        for (int c = 0; c < (a.vector ? 3 : 1); c++) {
+            r.reg[c] = emit(op, a.reg[c]);
+        }
+        if (!r.vector) {
+            r.reg[1] = r.reg[2] = r.reg[0];
+        }
+        return r;
+    }
+
+    Value dot(const Value& a, const Value& b) {
+        Value x = apply(RuleOp::MUL, scalar(a.reg[0]), scalar(b.reg[0]));
+        Value y = apply(RuleOp::MUL, scalar(a.reg[1]), scalar(b.reg[1]));
+        Value z = apply(RuleOp::MUL, scalar(a.reg[2]), scalar(b.reg[2]));
+        return apply(RuleOp::ADD, apply(RuleOp::ADD, x, y), z);
+    }
+
+    Value expression() {
+        Value v = term();
+        for (;;) {
+            if (failed) {
+                return v;
+            }
+            if (accept('+')) {
+                v = apply(RuleOp::ADD, v, term());
+            }
+            else if (accept('-')) {
+                v = apply(RuleOp::SUB, v, term());
+            }
+            else {
+                return v;
+            }
+        }
+    }
+
+    Value term() {
+        Value v = unary();
+        for (;;) {
+            if (failed) {
+                return v;
+            }
+            if (accept('*')) {
+                v = apply(RuleOp::MUL, v, unary());
+            }
+            else if (accept('/')) {
+                v = apply(RuleOp::DIV, v, unary());
+            }
+            else {
+                return v;
+            }
+        }
+    }
+
+    Value unary() {
+        if (accept('-')) {
+            return apply(RuleOp::NEG, unary());
+        }
+        Value v = primary();
+        while (!failed && accept('.')) {
+            std::string c = identifier();
+            int index = c == "x" ? 0 : (c == "y" ? 1 : (c == "z" ? 2 : -1));
+            if (!failed && (index < 0 || !v.vector)) {
+                fail("'." + c + "' needs a vector and one of x, y, z");
+                return v;
+            }
+            v = scalar(v.reg[index]);
+        }
+        return v;
+    }
+
+    Value primary() {
+        Value none = scalar(0);
+        skipSpaces();
+        if (failed || pos >= src.size()) {
+            fail("expected a value");
+            return none;
+        }
+        char c = src[pos];
+        if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+            float value = number();
+            return failed ? none : scalar(constant(value));
+        }
+        if (accept('(')) {
+            Value v = expression();
+            expect(')');
+            return v;
+        }
+        std::string name = identifier();
+        if (failed) {
+            return none;
+        }
+        if (!accept('(')) {
+            auto iter = names.find(name);
+            if (iter == names.end()) {
+                fail("unknown name '" + name + "'");
+                return none;
+            }
+            return iter->second;
+        }
+        std::vector<Value> args;
+        if (!accept(')')) {
+            do {
+                args.push_back(expression());
+            } while (!failed && accept(','));
+            expect(')');
+        }
+        return failed ? none : call(name, args);
+    }
+
+    bool checkArgs(const std::string& name, const std::vector<Value>& args, size_t count) {
+        if (args.size() != count) {
+            fail(name + "() takes " + std::to_string(count) + " argument" + (count == 1 ? "" : "s"));
+            return false;
+        }
+        return true;
+    }
+
+    bool checkVectors(const std::string& name, const std::vector<Value>& args, size_t count) {
+        if (!checkArgs(name, args, count)) {
+            return false;
+        }
+        for (const Value& a : args) {
+            if (!a.vector) {
+                fail(name + "() takes vectors");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Value call(const std::string& name, const std::vector<Value>& args) {
+        Value none = scalar(0);
+        if (name == "vec") {
+            if (!checkArgs(name, args, 3)) {
+                return none;
+            }
+            for (const Value& a : args) {
+                if (a.vector) {
+                    fail("vec() takes scalars");
+                    return none;
+                }
+            }
+            Value v = { true, { args[0].reg[0], args[1].reg[0], args[2].reg[0] } };
+            return v;
+        }
+        if (name == "dot") {
+            return checkVectors(name, args, 2) ? dot(args[0], args[1]) : none;
+        }
+        if (name == "cross") {
+            if (!checkVectors(name, args, 2)) {
+                return none;
+            }
+            const Value& a = args[0];
+            const Value& b = args[1];
+            Value v = { true, { 0, 0, 0 } };
+            for (int c = 0; c < 3; c++) {
+                int i = (c + 1) % 3, j = (c + 2) % 3;
+                Value l = apply(RuleOp::MUL, scalar(a.reg[i]), scalar(b.reg[j]));
+                Value r = apply(RuleOp::MUL, scalar(a.reg[j]), scalar(b.reg[i]));
+                v.reg[c] = apply(RuleOp::SUB, l, r).reg[0];
+            }
+            return v;
+        }
+        if (name == "length") {
+            return checkVectors(name, args, 1) ? apply(RuleOp::SQRT, dot(args[0], args[0])) : none;
+        }
+        if (name == "normalize") {
+            return checkVectors(name, args, 1) ? apply(RuleOp::DIV, args[0], apply(RuleOp::SQRT, dot(args[0], args[0]))) : none;
+        }
+        if (name == "min" || name == "max" || name == "step") {
+            RuleOp op = name == "min" ? RuleOp::MIN : (name == "max" ? RuleOp::MAX : RuleOp::STEP);
+            return checkArgs(name, args, 2) ? apply(op, args[0], args[1]) : none;
+        }
+        if (name == "clamp") {
+            return checkArgs(name, args, 3) ? apply(RuleOp::MIN, apply(RuleOp::MAX, args[0], args[1]), args[2]) : none;
+        }
+        if (name == "abs" || name == "sqrt") {
+            return checkArgs(name, args, 1) ? apply(name == "abs" ? RuleOp::ABS : RuleOp::SQRT, args[0]) : none;
+        }
+        fail("unknown function '" + name + "'");
+        return none;
+    }
+};
+
+} // namespace rulevm_detail
+
+// Compiles rule source; on failure the program is invalid and error says why
+inline RuleProgram compileRule(const std::string& source) {
+    RuleProgram program;
+    rulevm_detail::Compiler(source, program).compile();
+    return program;
+}
+
+// Executes a compiled rule over batches of agents.  Registers are stored lane by lane, so every
+// instruction is a short loop over RULE_BATCH_SIZE contiguous scalars.
+template <class Scalar>
+class RuleVM {
+public:
+    // Sets up the registers for a program; call again after changing its parameters
+    void bind(const RuleProgram& rule) {
+        program = &rule;
+        registers.assign(static_cast<size_t>(rule.registerCount) * RULE_BATCH_SIZE, Scalar(0));
+        for (const auto& c : rule.constants) {
+            broadcast(c.first, Scalar(c.second));
+        }
+        for (const auto& p : rule.parameters) {
+            broadcast(p.reg, Scalar(p.value));
+        }
+    }
+
+    void setInput(RuleInput input, int lane, Scalar value) {
+        registers[ruleInputRegister(input) * RULE_BATCH_SIZE + lane] = value;
+    }
+
+    template <class Vec3>
+    void setInput(RuleInput input, int lane, const Vec3& value) {
+        Scalar* reg = &registers[ruleInputRegister(input) * RULE_BATCH_SIZE + lane];
+        reg[0] = value.x;
+        reg[RULE_BATCH_SIZE] = value.y;
+        reg[2 * RULE_BATCH_SIZE] = value.z;
+    }
+
+    // runs the bound program on all lanes; lanes without inputs compute unused values
+    void run() {
+        using std::abs;
+        using std::sqrt;
+        for (const RuleInstruction& in : program->code) {
+            Scalar* d = lane(in.dst);
+            const Scalar* a = lane(in.a);
+            const Scalar* b = lane(in.b);
+            switch (in.op) {
+            case RuleOp::ADD:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = a[l] + b[l];
+                break;
+            case RuleOp::SUB:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = a[l] - b[l];
+                break;
+            case RuleOp::MUL:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = a[l] * b[l];
+                break;
+            case RuleOp::DIV:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = b[l] == Scalar(0) ? Scalar(0) : a[l] / b[l];
+                break;
+            case RuleOp::MIN:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = b[l] < a[l] ? b[l] : a[l];
+                break;
+            case RuleOp::MAX:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = a[l] < b[l] ? b[l] : a[l];
+                break;
+            case RuleOp::STEP:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = b[l] >= a[l] ? Scalar(1) : Scalar(0);
+                break;
+            case RuleOp::NEG:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = -a[l];
+                break;
+            case RuleOp::ABS:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = abs(a[l]);
+                break;
+            case RuleOp::SQRT:
+                for (int l = 0; l < RULE_BATCH_SIZE; l++) d[l] = a[l] > Scalar(0) ? sqrt(a[l]) : Scalar(0);
+                break;
+            }
+        }
+    }
+
+    template <class Vec3>
+    Vec3 force(int l) const {
+        return Vec3(lane(program->force[0])[l], lane(program->force[1])[l], lane(program->force[2])[l]);
+    }
+
+private:
+    const RuleProgram* program = nullptr;
+    std::vector<Scalar> registers;
+
+    Scalar* lane(int reg) { return &registers[static_cast<size_t>(reg) * RULE_BATCH_SIZE]; }
+    const Scalar* lane(int reg) const { return &registers[static_cast<size_t>(reg) * RULE_BATCH_SIZE]; }
+
+    void broadcast(int reg, Scalar value) {
+        Scalar* d = lane(reg);
+        for (int l = 0; l < RULE_BATCH_SIZE; l++) {
+            d[l] = value;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CS561_SCALAR_TRAITS_H
+#define CS561_SCALAR_TRAITS_H
+
+#include <cmath>
+#include <random>
+#include <glm/glm.hpp>
+#include "FixedPoint.h"
+
+# define TWO_PI 6.28318530717958647692
+
+inline glm::vec3 getRandomUniform(std::mt19937& engine) {
+    std::uniform_real_distribution<float> thetaRange(0.0f, TWO_PI);
+    std::uniform_real_distribution<float> oneRange(0, 1);
+    float theta = thetaRange(engine);
+    float r = sqrt(oneRange(engine));
+    float z = sqrt(1.0f - r * r) * (oneRange(engine) > 0.5f ? -1.0f : 1.0f);
+    return glm::vec3(r * cos(theta), r * sin(theta), z);
+}
+
+// Scalar and vector types the simulation core is instantiated with.  The core only uses arithmetic
+// operators and unqualified dot / length / length2 / normalize / cross / sqrt / abs on them, which
+// resolve to glm for the floating point builds and to FixedPoint.h for the fixed point build.
+//   SimdWidth: scalars per 256-bit vector register, used to pad small per-agent tables so that
+//              loops over them run in whole registers
+//   fromVec3 / toVec3: conversion from / to the float vectors used by rendering and the UI
+//   cosDegrees / randomDirection: the only transcendental math and random numbers of the core;
+//              the fixed point versions use integer arithmetic and raw engine bits only, so a
+//              seeded fixed point flock gives the same bits on every compiler and standard library
+
+template <class T>
+struct FloatingPointTraits {
+    typedef T Scalar;
+    typedef glm::vec<3, T> Vec3;
+    static const int SimdWidth = int(32 / sizeof(T));
+
+    static Vec3 fromVec3(const glm::vec3& v) { return Vec3(v); }
+    static glm::vec3 toVec3(const Vec3& v) { return glm::vec3(v); }
+
+    static T cosDegrees(T degrees) { return T(cosf(TWO_PI * float(degrees) / 360.0f)); }
+    static Vec3 randomDirection(std::mt19937& engine) { return fromVec3(getRandomUniform(engine)); }
+};
+
+typedef FloatingPointTraits<float> FloatTraits;
+typedef FloatingPointTraits<double> DoubleTraits;
+
+struct FixedTraits {
+    typedef Fixed Scalar;
+    typedef FixedVec3 Vec3;
+    static const int SimdWidth = 4;   // 64-bit lanes
+
+    static Vec3 fromVec3(const glm::vec3& v) { return Vec3(Fixed(v.x), Fixed(v.y), Fixed(v.z)); }
+    static glm::vec3 toVec3(const Vec3& v) { return glm::vec3(float(v.x), float(v.y), float(v.z)); }
+
+    static Fixed cosDegrees(Fixed degrees) { return cos(degrees * Fixed::fromRaw(FIXED_TWO_PI_RAW) / Fixed(360)); }
+
+    // uniform in the unit ball by rejection from the cube; the bits of std::mt19937 are fixed
+    // by the standard, unlike the output of the distributions.  Each draw gets its own statement:
+    // the evaluation order of constructor arguments differs between compilers.
+    static Vec3 randomDirection(std::mt19937& engine) {
+        for (;;) {
+            int64_t x = int64_t(engine() & 0x1ffff) - Fixed::ONE;
+            int64_t y = int64_t(engine() & 0x1ffff) - Fixed::ONE;
+            int64_t z = int64_t(engine() & 0x1ffff) - Fixed::ONE;
+            Vec3 v(Fixed::fromRaw(x), Fixed::fromRaw(y), Fixed::fromRaw(z));
+            Fixed l2 = length2(v);
+            if (l2 <= Fixed(1) && l2 != Fixed()) {
+                return v;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,666 @@
+#ifndef CS561_STATE_STREAM_H
+#define CS561_STATE_STREAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Live flock state for local viewers and tools over a UNIX domain socket.  A client connects and
+// sends a StreamSubscription (an interest box or view frustum and an update rate); from then on
+// it receives the agents inside its interest, quantized to 16 bits per component and encoded as
+// changes against the previous update: agents that left, and agents that entered or moved.
+//
+// Interest boxes are widened to a lattice of ShareGrid units, so viewers looking at about the same
+// region at the same rate land in one group: the group selects its agents from the flocker's grid
+// and encodes each update once, and the bytes are queued to every member.
+//
+// The server never blocks: publish() is called on the simulation thread after the flock update
+// and only does non-blocking socket calls.  A client that falls MaxBacklog bytes behind is dropped.
+//
+// Wire format, little endian.  Client to server: StreamSubscription, at any time to change it.
+// Server to client, per update:
+//   uint32 magic, uint32 frame, uint32 payload bytes, then the payload as varints:
+//   flags (1 = keyframe: forget every agent), on keyframes the group box as 6 floats,
+//   removed count, removed ids (first absolute, then gaps),
+//   changed count, per changed agent the id gap and 6 zigzag deltas (px py pz vx vy vz)
+//   against its last quantized state, or against zero for agents that just entered.
+// Positions are box lo + q * (hi - lo) / 65535, velocities q * velocityStep.
+
+const uint32_t STREAM_MAGIC = 0x52545346;     // "FSTR"
+
+enum class StreamShape : uint32_t {
+    BOX, FRUSTUM
+};
+
+struct StreamSubscription {
+    uint32_t magic = STREAM_MAGIC;
+    StreamShape shape = StreamShape::BOX;
+    float rateHz = 0;               // updates per second, 0 for every simulated frame
+    float boxMin[3] = { 0, 0, 0 };  // the box; for a frustum, a box around it
+    float boxMax[3] = { 0, 0, 0 };
+    float planes[6][4] = {};        // frustum planes, inside where n.x * x + n.y * y + n.z * z + d >= 0
+};
+
+struct StateStreamStats {
+    int clients = 0;
+    int groups = 0;                  // encoders; clients minus groups is the work saved by sharing
+    long long updates = 0;           // encoded, since start
+    long long bytesEncoded = 0;
+    long long bytesSent = 0;
+    long long dropped = 0;           // clients disconnected for falling behind
+};
+
+namespace stream_detail {
+
+inline void putVarint(std::vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// false on a truncated value
+inline bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint32_t b = *p++;
+        v |= (b & 0x7f) << shift;
+        if (b < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint32_t zigzag(int32_t v) {
+    return (uint32_t(v) << 1) ^ (0u - (uint32_t(v) >> 31));
+}
+
+inline int32_t unzigzag(uint32_t v) {
+    return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+// a - b with wrap around instead of signed overflow
+inline int32_t wrappingDifference(int32_t a, int32_t b) {
+    return static_cast<int32_t>(uint32_t(a) - uint32_t(b));
+}
+
+// float to int32, clamped first since the cast is undefined outside the int32 range; NaN goes to
+// the upper bound
+inline int32_t quantize(float v) {
+    const float limit = 2147483520.0f;   // largest float below 2^31
+    v = v < limit ? v : limit;
+    v = v > -limit ? v : -limit;
+    return static_cast<int32_t>(v);
+}
+
+inline void putU32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+}
+
+inline uint32_t getU32(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+inline void putFloat(std::vector<uint8_t>& out, float f) {
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    putU32(out, v);
+}
+
+inline float getFloat(const uint8_t* p) {
+    uint32_t v = getU32(p);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+// An agent as sent: id and quantized position / velocity
+struct QuantizedAgent {
+    uint32_t id;
+    int32_t q[6];
+};
+
+} // namespace stream_detail
+
+// Client side: applies updates and keeps the agents of the interest region
+class StreamDecoder {
+public:
+    struct Agent {
+        glm::vec3 position;
+        glm::vec3 velocity;
+    };
+
+    float VelocityStep = 1.0f / 256.0f;      // must match the server
+
+    // Feeds received bytes; returns the number of complete updates applied, -1 on a corrupt stream
+    int feed(const uint8_t* data, size_t size) {
+        buffer.insert(buffer.end(), data, data + size);
+        int applied = 0;
+        size_t offset = 0;
+        while (buffer.size() - offset >= 12) {
+            const uint8_t* header = buffer.data() + offset;
+            uint32_t payload = stream_detail::getU32(header + 8);
+            if (stream_detail::getU32(header) != STREAM_MAGIC) {
+                return -1;
+            }
+            if (buffer.size() - offset < 12 + payload) {
+                break;
+            }
+            if (!apply(header + 12, header + 12 + payload)) {
+                return -1;
+            }
+            frame = stream_detail::getU32(header + 4);
+            offset += 12 + payload;
+            applied++;
+        }
+        buffer.erase(buffer.begin(), buffer.begin() + offset);
+        return applied;
+    }
+
+    uint32_t lastFrame() const {
+        return frame;
+    }
+
+    size_t size() const {
+        return agents.size();
+    }
+
+    template <class Visit>
+    void forEach(Visit visit) const {
+        for (const auto& entry : agents) {
+            visit(entry.first, decode(entry.second));
+        }
+    }
+
+private:
+    std::vector<uint8_t> buffer;
+    std::unordered_map<uint32_t, stream_detail::QuantizedAgent> agents;
+    glm::vec3 lo = glm::vec3(0);
+    glm::vec3 hi = glm::vec3(0);
+    uint32_t frame = 0;
+
+    Agent decode(const stream_detail::QuantizedAgent& a) const {
+        Agent out;
+        glm::vec3 step = (hi - lo) / 65535.0f;
+        out.position = lo + glm::vec3(float(a.q[0]), float(a.q[1]), float(a.q[2])) * step;
+        out.velocity = glm::vec3(float(a.q[3]), float(a.q[4]), float(a.q[5])) * VelocityStep;
+        return out;
+    }
+
+    bool apply(const uint8_t* p, const uint8_t* end) {
+        using namespace stream_detail;
+        uint32_t flags, count, gap;
+        if (!getVarint(p, end, flags)) {
+            return false;
+        }
+        if (flags & 1) {
+            if (end - p < 24) {
+                return false;
+            }
+            agents.clear();
+            for (int i = 0; i < 3; i++) {
+                lo[i] = getFloat(p + 4 * i);
+                hi[i] = getFloat(p + 12 + 4 * i);
+            }
+            p += 24;
+        }
+        uint32_t id = 0;
+        if (!getVarint(p, end, count)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            if (!getVarint(p, end, gap)) {
+                return false;
+            }
+            id += gap;
+            agents.erase(id);
+        }
+        id = 0;
+        if (!getVarint(p, end, count)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            if (!getVarint(p, end, gap)) {
+                return false;
+            }
+            id += gap;
+            auto iter = agents.find(id);
+            if (iter == agents.end()) {
+                QuantizedAgent fresh = { id, { 0, 0, 0, 0, 0, 0 } };
+                iter = agents.emplace(id, fresh).first;
+            }
+            for (int c = 0; c < 6; c++) {
+                uint32_t delta;
+                if (!getVarint(p, end, delta)) {
+                    return false;
+                }
+                iter->second.q[c] = static_cast<int32_t>(uint32_t(iter->second.q[c]) + uint32_t(unzigzag(delta)));
+            }
+        }
+        return p == end;
+    }
+};
+
+class StateStreamServer {
+public:
+    float ShareGrid = 4.0f;              // interest boxes are widened to multiples of this
+    float GridSlack = 1.0f;              // how far agents may have moved since the flocker built its grid
+    float VelocityStep = 1.0f / 256.0f;  // velocity quantum
+    size_t MaxBacklog = 8 << 20;         // unsent bytes after which a client is dropped
+    float MaxCoordinate = 1e6f;          // clients asking for a box reaching beyond this are dropped
+
+    StateStreamServer() {}
+    StateStreamServer(const StateStreamServer&) = delete;
+    StateStreamServer& operator=(const StateStreamServer&) = delete;
+
+    ~StateStreamServer() {
+        stop();
+    }
+
+    // Listens on a socket file, replacing a stale one; false when that fails
+    bool start(const char* socketPath) {
+        if (running()) {
+            return true;
+        }
+#if defined(_WIN32)
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+            return false;
+        }
+#endif
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(address.sun_path)) {
+            return false;
+        }
+        strcpy(address.sun_path, socketPath);
+        removeFile(socketPath);
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == INVALID) {
+            return false;
+        }
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0
+            || !setNonBlocking(listener)) {
+            closeSocket(listener);
+            listener = INVALID;
+            return false;
+        }
+        path = socketPath;
+        return true;
+    }
+
+    void stop() {
+        if (!running()) {
+            return;
+        }
+        for (Client& c : clients) {
+            closeSocket(c.socket);
+        }
+        clients.clear();
+        groups.clear();
+        closeSocket(listener);
+        listener = INVALID;
+        removeFile(path.c_str());
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+    }
+
+    bool running() const {
+        return listener != INVALID;
+    }
+
+    const StateStreamStats& getStats() const {
+        return stats;
+    }
+
+    // Simulation thread, after the flock update: takes new clients and subscriptions, encodes the
+    // groups that are due at `time` (seconds) and writes as much as every socket accepts
+    template <class Flock>
+    void publish(const Flock& flock, uint32_t frame, double time) {
+        if (!running()) {
+            return;
+        }
+        acceptClients();
+        readSubscriptions();
+        for (size_t g = 0; g < groups.size(); g++) {
+            Group& group = groups[g];
+            if (group.members == 0) {
+                continue;
+            }
+            if (group.subscription.rateHz > 0 && time - group.lastSent < 1.0 / group.subscription.rateHz - 1e-6) {
+                continue;
+            }
+            group.lastSent = time;
+            encode(group, flock, frame);
+            for (Client& c : clients) {
+                if (c.group == static_cast<int>(g)) {
+                    c.out.insert(c.out.end(), group.message.begin(), group.message.end());
+                }
+            }
+        }
+        writeClients();
+        stats.clients = static_cast<int>(clients.size());
+        stats.groups = 0;
+        for (const Group& group : groups) {
+            stats.groups += group.members > 0 ? 1 : 0;
+        }
+    }
+
+private:
+#if defined(_WIN32)
+    typedef SOCKET Socket;
+    static const Socket INVALID = INVALID_SOCKET;
+    static const int SEND_FLAGS = 0;
+    static void closeSocket(Socket s) { closesocket(s); }
+    static bool setNonBlocking(Socket s) { u_long on = 1; return ioctlsocket(s, FIONBIO, &on) == 0; }
+    static void removeFile(const char* file) { DeleteFileA(file); }
+    static bool wouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+#else
+    typedef int Socket;
+    static const Socket INVALID = -1;
+    static const int SEND_FLAGS = MSG_NOSIGNAL;
+    static void closeSocket(Socket s) { close(s); }
+    static bool setNonBlocking(Socket s) { return fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) == 0; }
+    static void removeFile(const char* file) { unlink(file); }
+    static bool wouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+#endif
+
+    struct Client {
+        Socket socket;
+        std::vector<uint8_t> in;     // partial subscription
+        std::vector<uint8_t> out;    // encoded updates not written yet
+        int group = -1;
+    };
+
+    // Clients with equal (widened) subscriptions, and the state they were last sent
+    struct Group {
+        StreamSubscription subscription;
+        int members = 0;
+        bool keyframe = true;        // a member joined: next update replaces everything
+        double lastSent = -std::numeric_limits<double>::infinity();
+        std::vector<stream_detail::QuantizedAgent> baseline;   // by id
+        std::vector<stream_detail::QuantizedAgent> current;
+        std::vector<uint8_t> message;
+    };
+
+    Socket listener = INVALID;
+    std::string path;
+    std::vector<Client> clients;
+    std::vector<Group> groups;
+    StateStreamStats stats;
+
+    void acceptClients() {
+        for (;;) {
+            Socket s = accept(listener, nullptr, nullptr);
+            if (s == INVALID) {
+                return;
+            }
+            if (!setNonBlocking(s)) {
+                closeSocket(s);
+                continue;
+            }
+            Client c;
+            c.socket = s;
+            clients.push_back(std::move(c));
+        }
+    }
+
+    void readSubscriptions() {
+        uint8_t chunk[1024];
+        for (size_t i = 0; i < clients.size(); ) {
+            Client& c = clients[i];
+            bool closed = false;
+            for (;;) {
+                int n = static_cast<int>(recv(c.socket, reinterpret_cast<char*>(chunk), sizeof(chunk), 0));
+                if (n == 0 || (n < 0 && !wouldBlock())) {
+                    closed = true;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                c.in.insert(c.in.end(), chunk, chunk + n);
+            }
+            // only the newest complete subscription counts
+            StreamSubscription subscription;
+            bool changed = false;
+            while (c.in.size() >= sizeof(StreamSubscription)) {
+                memcpy(&subscription, c.in.data(), sizeof(subscription));
+                c.in.erase(c.in.begin(), c.in.begin() + sizeof(subscription));
+                changed = true;
+            }
+            if (changed && (subscription.magic != STREAM_MAGIC || !widen(subscription))) {
+                closed = true;
+            }
+            if (closed) {
+                leave(c);
+                closeSocket(c.socket);
+                clients.erase(clients.begin() + i);
+                continue;
+            }
+            if (changed) {
+                leave(c);
+                join(c, subscription);
+            }
+            i++;
+        }
+    }
+
+    // Widens the box of a client's subscription to the ShareGrid lattice; false for a box that is
+    // not finite, inverted or beyond MaxCoordinate, which would overflow the voxel and quantized
+    // coordinates
+    bool widen(StreamSubscription& s) const {
+        float grid = ShareGrid > 0 ? ShareGrid : 1.0f;
+        for (int a = 0; a < 3; a++) {
+            bool valid = std::isfinite(s.boxMin[a]) && std::isfinite(s.boxMax[a]) && s.boxMin[a] <= s.boxMax[a] &&
+                         s.boxMin[a] >= -MaxCoordinate && s.boxMax[a] <= MaxCoordinate;
+            if (!valid) {
+                return false;
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            s.boxMin[a] = std::floor(s.boxMin[a] / grid) * grid;
+            s.boxMax[a] = std::max(std::ceil(s.boxMax[a] / grid) * grid, s.boxMin[a] + grid);
+        }
+        if (s.shape == StreamShape::BOX) {
+            memset(s.planes, 0, sizeof(s.planes));
+        }
+        if (!(s.rateHz >= 0)) {
+            s.rateHz = 0;
+        }
+        return true;
+    }
+
+    void join(Client& c, const StreamSubscription& subscription) {
+        int free = -1;
+        for (size_t g = 0; g < groups.size(); g++) {
+            if (groups[g].members > 0 && memcmp(&groups[g].subscription, &subscription, sizeof(subscription)) == 0) {
+                c.group = static_cast<int>(g);
+                groups[g].members++;
+                groups[g].keyframe = true;
+                return;
+            }
+            if (groups[g].members == 0 && free < 0) {
+                free = static_cast<int>(g);
+            }
+        }
+        if (free < 0) {
+            free = static_cast<int>(groups.size());
+            groups.emplace_back();
+        }
+        Group& group = groups[free];
+        group = Group();
+        group.subscription = subscription;
+        group.members = 1;
+        c.group = free;
+    }
+
+    void leave(Client& c) {
+        if (c.group >= 0) {
+            groups[c.group].members--;
+            c.group = -1;
+        }
+    }
+
+    template <class Flock>
+    void encode(Group& group, const Flock& flock, uint32_t frame) {
+        using namespace stream_detail;
+        typedef typename Flock::Boid Boid;
+        const StreamSubscription& s = group.subscription;
+        glm::vec3 lo(s.boxMin[0], s.boxMin[1], s.boxMin[2]);
+        glm::vec3 hi(s.boxMax[0], s.boxMax[1], s.boxMax[2]);
+        glm::vec3 scale = 65535.0f / (hi - lo);
+        float velocityScale = 1.0f / VelocityStep;
+
+        // select from the grid, then test the current positions
+        std::vector<QuantizedAgent>& current = group.current;
+        current.clear();
+        flock.forEachVoxelInBox(lo - GridSlack, hi + GridSlack, [&](const typename Flock::VoxelBucket& bucket) {
+            for (const Boid* b : bucket) {
+                glm::vec3 p(float(b->position.x), float(b->position.y), float(b->position.z));
+                bool inside = b->alive && p.x >= lo.x && p.y >= lo.y && p.z >= lo.z && p.x <= hi.x && p.y <= hi.y && p.z <= hi.z;
+                for (int k = 0; s.shape == StreamShape::FRUSTUM && k < 6 && inside; k++) {
+                    inside = s.planes[k][0] * p.x + s.planes[k][1] * p.y + s.planes[k][2] * p.z + s.planes[k][3] >= 0;
+                }
+                if (!inside) {
+                    continue;
+                }
+                glm::vec3 v(float(b->velocity.x), float(b->velocity.y), float(b->velocity.z));
+                QuantizedAgent a;
+                a.id = b->id;
+                for (int c = 0; c < 3; c++) {
+                    a.q[c] = quantize((p[c] - lo[c]) * scale[c] + 0.5f);
+                    a.q[3 + c] = quantize(std::round(v[c] * velocityScale));
+                }
+                current.push_back(a);
+            }
+        });
+        std::sort(current.begin(), current.end(),
+            [](const QuantizedAgent& l, const QuantizedAgent& r) { return l.id < r.id; });
+
+        if (group.keyframe) {
+            group.baseline.clear();
+        }
+        std::vector<uint8_t>& m = group.message;
+        m.clear();
+        putU32(m, STREAM_MAGIC);
+        putU32(m, frame);
+        putU32(m, 0);
+        putVarint(m, group.keyframe ? 1 : 0);
+        if (group.keyframe) {
+            for (int c = 0; c < 3; c++) {
+                putFloat(m, lo[c]);
+            }
+            for (int c = 0; c < 3; c++) {
+                putFloat(m, hi[c]);
+            }
+        }
+        group.keyframe = false;
+
+        // removed: in the baseline, not in the current set (both sorted by id)
+        const std::vector<QuantizedAgent>& before = group.baseline;
+        size_t countAt = m.size();
+        uint32_t removed = 0, previous = 0;
+        m.resize(m.size() + 5);      // room for the count, fixed up below
+        for (size_t i = 0, j = 0; i < before.size(); i++) {
+            while (j < current.size() && current[j].id < before[i].id) {
+                j++;
+            }
+            if (j == current.size() || current[j].id != before[i].id) {
+                putVarint(m, before[i].id - previous);
+                previous = before[i].id;
+                removed++;
+            }
+        }
+        patchCount(m, countAt, removed);
+
+        countAt = m.size();
+        uint32_t changed = 0;
+        previous = 0;
+        m.resize(m.size() + 5);
+        for (size_t i = 0, j = 0; j < current.size(); j++) {
+            while (i < before.size() && before[i].id < current[j].id) {
+                i++;
+            }
+            const int32_t* base = (i < before.size() && before[i].id == current[j].id) ? before[i].q : nullptr;
+            if (base != nullptr && memcmp(base, current[j].q, sizeof(current[j].q)) == 0) {
+                continue;
+            }
+            putVarint(m, current[j].id - previous);
+            previous = current[j].id;
+            for (int c = 0; c < 6; c++) {
+                putVarint(m, zigzag(wrappingDifference(current[j].q[c], base != nullptr ? base[c] : 0)));
+            }
+            changed++;
+        }
+        patchCount(m, countAt, changed);
+
+        uint32_t payload = static_cast<uint32_t>(m.size() - 12);
+        for (int i = 0; i < 4; i++) {
+            m[8 + i] = static_cast<uint8_t>(payload >> (8 * i));
+        }
+        group.baseline.swap(current);
+        stats.updates++;
+        stats.bytesEncoded += static_cast<long long>(m.size());
+    }
+
+    // writes a varint count into the 5 bytes reserved at `at`, closing the gap it leaves
+    static void patchCount(std::vector<uint8_t>& m, size_t at, uint32_t count) {
+        std::vector<uint8_t> bytes;
+        stream_detail::putVarint(bytes, count);
+        std::copy(bytes.begin(), bytes.end(), m.begin() + at);
+        m.erase(m.begin() + at + bytes.size(), m.begin() + at + 5);
+    }
+
+    void writeClients() {
+        for (size_t i = 0; i < clients.size(); ) {
+            Client& c = clients[i];
+            size_t sent = 0;
+            bool failed = false;
+            while (sent < c.out.size()) {
+                int n = static_cast<int>(send(c.socket, reinterpret_cast<const char*>(c.out.data() + sent),
+                                              static_cast<int>(c.out.size() - sent), SEND_FLAGS));
+                if (n <= 0) {
+                    failed = n < 0 && !wouldBlock();
+                    break;
+                }
+                sent += static_cast<size_t>(n);
+            }
+            c.out.erase(c.out.begin(), c.out.begin() + sent);
+            stats.bytesSent += static_cast<long long>(sent);
+            if (failed || c.out.size() > MaxBacklog) {
+                stats.dropped += failed ? 0 : 1;
+                leave(c);
+                closeSocket(c.socket);
+                clients.erase(clients.begin() + i);
+                continue;
+            }
+            i++;
+        }
+    }
+};
+
+#endif
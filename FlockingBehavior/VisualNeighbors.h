@@ -0,0 +1,111 @@
+#ifndef CS561_VISUAL_NEIGHBORS_H
+#define CS561_VISUAL_NEIGHBORS_H
+
+#include <cmath>
+
+// Which agents a boid interacts with
+enum class NeighborModel {
+    RADIUS,   // everyone inside the perception radius and field of view
+    VISUAL    // only the nearest agent seen in each direction of an angular bin map
+};
+
+// The view sphere around an agent is split into the 20 faces of an icosahedron.  A candidate falls
+// into the face whose center direction is closest to its own direction, and only the nearest
+// candidate of each face is kept, so agents hidden behind a closer one are ignored.
+const int VISUAL_BIN_COUNT = 20;
+
+// Face centers of the icosahedron (= vertices of the dual dodecahedron), stored per component and
+// padded to whole SIMD registers (padding directions are zero and never win) so that projecting a
+// direction onto all bins is a single vectorizable loop without a remainder.
+template <class Scalar, int SimdWidth>
+struct VisualBinDirections {
+    static const int PADDED_COUNT = (VISUAL_BIN_COUNT + SimdWidth - 1) / SimdWidth * SimdWidth;
+
+    Scalar x[PADDED_COUNT];
+    Scalar y[PADDED_COUNT];
+    Scalar z[PADDED_COUNT];
+
+    VisualBinDirections() {
+        const float phi = 1.61803398874989484820f;
+        const float iphi = 1.0f / phi;
+        int k = 0;
+        for (int sx = -1; sx <= 1; sx += 2) {
+            for (int sy = -1; sy <= 1; sy += 2) {
+                for (int sz = -1; sz <= 1; sz += 2) {
+                    set(k++, float(sx), float(sy), float(sz));
+                }
+            }
+        }
+        for (int s1 = -1; s1 <= 1; s1 += 2) {
+            for (int s2 = -1; s2 <= 1; s2 += 2) {
+                set(k++, 0, s1 * iphi, s2 * phi);
+                set(k++, s1 * iphi, s2 * phi, 0);
+                set(k++, s1 * phi, 0, s2 * iphi);
+            }
+        }
+        for (int pad = VISUAL_BIN_COUNT; pad < PADDED_COUNT; pad++) {
+            x[pad] = y[pad] = z[pad] = Scalar(0);
+        }
+    }
+
+    // index of the bin a (not necessarily normalized) direction falls into
+    int binOf(Scalar dx, Scalar dy, Scalar dz) const {
+        Scalar dots[PADDED_COUNT];
+        for (int k = 0; k < PADDED_COUNT; k++) {
+            dots[k] = x[k] * dx + y[k] * dy + z[k] * dz;
+        }
+        int best = 0;
+        for (int k = 1; k < VISUAL_BIN_COUNT; k++) {
+            best = dots[k] > dots[best] ? k : best;
+        }
+        return best;
+    }
+
+private:
+    void set(int k, float vx, float vy, float vz) {
+        float len = std::sqrt(vx * vx + vy * vy + vz * vz);
+        x[k] = Scalar(vx / len);
+        y[k] = Scalar(vy / len);
+        z[k] = Scalar(vz / len);
+    }
+};
+
+template <class Scalar, int SimdWidth>
+const VisualBinDirections<Scalar, SimdWidth>& visualBinDirections() {
+    static const VisualBinDirections<Scalar, SimdWidth> directions;
+    return directions;
+}
+
+// Nearest candidate per angular bin.  Lives on the stack of the neighbor query, so the cost per
+// agent is bounded by the number of grid candidates and the output by VISUAL_BIN_COUNT.
+template <class Candidate, class Scalar>
+struct VisualBinMap {
+    Candidate nearest[VISUAL_BIN_COUNT];
+    Scalar distance[VISUAL_BIN_COUNT];
+    bool occupied[VISUAL_BIN_COUNT];
+
+    VisualBinMap() {
+        for (int k = 0; k < VISUAL_BIN_COUNT; k++) {
+            occupied[k] = false;
+        }
+    }
+
+    void insert(int bin, const Candidate& candidate, Scalar candidateDistance) {
+        if (!occupied[bin] || candidateDistance < distance[bin]) {
+            occupied[bin] = true;
+            distance[bin] = candidateDistance;
+            nearest[bin] = candidate;
+        }
+    }
+
+    template <class Output>
+    void collect(Output& output) const {
+        for (int k = 0; k < VISUAL_BIN_COUNT; k++) {
+            if (occupied[k]) {
+                output.push_back(nearest[k]);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,553 @@
+#ifndef CS561_WORLD_CHUNKS_H
+#define CS561_WORLD_CHUNKS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Flocker.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Out-of-core world.  Space is split into cubic chunks; only chunks near an observer stay in the
+// agent list the flocker simulates.  The agents of the other chunks are written to memory-mapped
+// files on a background thread and dropped from memory, keeping a per-chunk summary (count, mean
+// position and velocity).  While paged out, a summary drifts with its mean velocity; when its
+// chunk is wanted again (an observer came close, or the drifting flock reached an observer) the
+// agents are read back asynchronously, shifted by the accumulated drift and relaxed toward the
+// mean velocity.  MaxResidentAgents bounds the agents kept in memory.
+
+struct ChunkKey {
+    int x, y, z;
+    bool operator==(const ChunkKey& o) const { return x == o.x && y == o.y && z == o.z; }
+};
+
+struct ChunkKeyHasher {
+    size_t operator()(const ChunkKey& k) const {
+        return (size_t(uint32_t(k.x)) * 73856093u) ^ (size_t(uint32_t(k.y)) * 19349663u) ^ (size_t(uint32_t(k.z)) * 83492791u);
+    }
+};
+
+struct ChunkStreamStats {
+    int residentChunks = 0;
+    int pagedOutChunks = 0;
+    long long residentAgents = 0;
+    long long pagedOutAgents = 0;
+    long long bytesOnDisk = 0;
+    int pendingJobs = 0;
+    long long pageOuts = 0;          // segments written since start
+    long long pageIns = 0;           // segments read back since start
+    long long failedWrites = 0;      // segments kept in memory because the file could not be written
+    long long lostAgents = 0;        // agents of segments that could not be read back
+    double planMilliseconds = 0;     // last residency pass on the simulation thread
+};
+
+namespace chunks_detail {
+
+const uint32_t FILE_MAGIC = 0x4b4e4843;   // "CHNK"
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t recordSize;
+    uint64_t count;
+};
+
+// Writes header + records through a shared mapping of a new file
+inline bool writeMapped(const std::string& path, const void* data, size_t recordSize, size_t count) {
+    FileHeader header = { FILE_MAGIC, uint32_t(recordSize), uint64_t(count) };
+    size_t bytes = sizeof(header) + recordSize * count;
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(uint64_t(bytes) >> 32), DWORD(bytes & 0xffffffffu), nullptr);
+    void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, bytes) : nullptr;
+    if (view != nullptr) {
+        memcpy(view, &header, sizeof(header));
+        memcpy(static_cast<char*>(view) + sizeof(header), data, recordSize * count);
+        UnmapViewOfFile(view);
+    }
+    if (mapping != nullptr) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    return view != nullptr;
+#else
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    void* view = MAP_FAILED;
+    if (ftruncate(fd, off_t(bytes)) == 0) {
+        view = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (view != MAP_FAILED) {
+        memcpy(view, &header, sizeof(header));
+        memcpy(static_cast<char*>(view) + sizeof(header), data, recordSize * count);
+        munmap(view, bytes);
+    }
+    close(fd);
+    return view != MAP_FAILED;
+#endif
+}
+
+// Maps a file written by writeMapped and copies its records out
+template <class Record>
+bool readMapped(const std::string& path, std::vector<Record>& records) {
+    size_t bytes = 0;
+    const char* view = nullptr;
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart >= LONGLONG(sizeof(FileHeader))) {
+        bytes = size_t(size.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        view = mapping != nullptr ? static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size >= off_t(sizeof(FileHeader))) {
+        bytes = size_t(info.st_size);
+        void* p = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        view = p != MAP_FAILED ? static_cast<const char*>(p) : nullptr;
+    }
+#endif
+    bool ok = false;
+    if (view != nullptr) {
+        FileHeader header;
+        memcpy(&header, view, sizeof(header));
+        if (header.magic == FILE_MAGIC && header.recordSize == sizeof(Record) &&
+            sizeof(header) + header.count * sizeof(Record) <= bytes) {
+            // the header keeps the page aligned records aligned
+            const Record* first = reinterpret_cast<const Record*>(view + sizeof(header));
+            records.assign(first, first + header.count);
+            ok = true;
+        }
+    }
+#if defined(_WIN32)
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+    }
+    if (mapping != nullptr) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    if (view != nullptr) {
+        munmap(const_cast<char*>(view), bytes);
+    }
+    close(fd);
+#endif
+    return ok;
+}
+
+} // namespace chunks_detail
+
+template <class Traits>
+class WorldChunks {
+public:
+    typedef typename Traits::Scalar Scalar;
+    typedef typename Traits::Vec3 Vec3;
+    typedef BasicBoid<Traits> Boid;
+    typedef BasicBoidList<Traits> BoidList;
+
+    float ChunkSize = 64.0f;
+    float ActiveRadius = 96.0f;           // chunks whose center is this close to an observer stay resident
+    long long MaxResidentAgents = 1 << 20;
+    float UpdateInterval = 0.25f;         // seconds between residency passes
+    float VelocityRelaxTime = 5.0f;       // paged out velocities decay toward the chunk mean with this time constant
+    std::string Directory = "chunks";
+    std::vector<glm::vec3> Observers;
+
+    WorldChunks() {}
+
+    explicit WorldChunks(BoidList* entities) : agents(entities) {}
+
+    WorldChunks(const WorldChunks&) = delete;
+    WorldChunks& operator=(const WorldChunks&) = delete;
+
+    // Stops the worker; paged out agents are discarded along with their files
+    ~WorldChunks() {
+        stopWorker();
+        std::error_code ignored;
+        for (auto& entry : chunks) {
+            for (auto& segment : entry.second.segments) {
+                std::filesystem::remove(segment.path, ignored);
+            }
+        }
+    }
+
+    void setAgents(BoidList* entities) {
+        agents = entities;
+    }
+
+    // Call on the simulation thread between flock updates; may add and remove agents
+    void update(float dt) {
+        auto start = std::chrono::steady_clock::now();
+        integrateFinishedJobs();
+        for (auto& entry : chunks) {
+            for (auto& segment : entry.second.segments) {
+                segment.age += dt;
+            }
+        }
+        sinceLastPass += dt;
+        if (sinceLastPass >= UpdateInterval) {
+            sinceLastPass = 0;
+            planResidency();
+        }
+        updateStats();
+        streamStats.planMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Blocks until the worker is idle and its results are integrated
+    void flush() {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        jobsDone.wait(lock, [this] { return jobs.empty() && !workerBusy; });
+        lock.unlock();
+        integrateFinishedJobs();
+        updateStats();
+    }
+
+    const ChunkStreamStats& getStats() const {
+        return streamStats;
+    }
+
+private:
+    // agents of a chunk that live in a file
+    struct Segment {
+        long long id;
+        std::string path;
+        long long count;
+        glm::vec3 meanPosition;
+        glm::vec3 meanVelocity;
+        float age;            // seconds since it was paged out
+        bool loading;
+    };
+
+    struct Chunk {
+        long long residentAgents = 0;
+        std::vector<Segment> segments;
+    };
+
+    struct Job {
+        bool write;
+        bool failed;
+        ChunkKey key;
+        long long segment;
+        std::string path;
+        std::vector<Boid> agents;
+    };
+
+    BoidList* agents = nullptr;
+    std::unordered_map<ChunkKey, Chunk, ChunkKeyHasher> chunks;
+    ChunkStreamStats streamStats;
+    float sinceLastPass = 0;
+    long long nextSegment = 0;
+
+    std::thread worker;
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobsDone;
+    std::deque<Job> jobs;
+    std::vector<Job> finished;
+    bool workerBusy = false;
+    bool stopping = false;
+
+    ChunkKey keyOf(const glm::vec3& p) const {
+        ChunkKey k = { int(std::floor(p.x / ChunkSize)), int(std::floor(p.y / ChunkSize)), int(std::floor(p.z / ChunkSize)) };
+        return k;
+    }
+
+    glm::vec3 centerOf(const ChunkKey& k) const {
+        return (glm::vec3(k.x, k.y, k.z) + glm::vec3(0.5f)) * ChunkSize;
+    }
+
+    float observerDistance(const glm::vec3& p) const {
+        float best = Observers.empty() ? 0.0f : -1.0f;
+        for (const glm::vec3& o : Observers) {
+            float d = glm::length(p - o);
+            best = best < 0 || d < best ? d : best;
+        }
+        return best;
+    }
+
+    // where the chunk's content is thought to be: its center, or the drifted mean of its files
+    glm::vec3 contentPosition(const ChunkKey& key, const Chunk& chunk) const {
+        if (chunk.residentAgents > 0 || chunk.segments.empty()) {
+            return centerOf(key);
+        }
+        glm::vec3 sum(0);
+        long long count = 0;
+        for (const Segment& s : chunk.segments) {
+            sum += (s.meanPosition + s.meanVelocity * s.age) * float(s.count);
+            count += s.count;
+        }
+        return count > 0 ? sum / float(count) : centerOf(key);
+    }
+
+    void planResidency() {
+        BoidList& list = *agents;
+        for (auto& entry : chunks) {
+            entry.second.residentAgents = 0;
+        }
+        std::vector<ChunkKey> keys(list.size());
+        for (size_t i = 0; i < list.size(); i++) {
+            keys[i] = keyOf(Traits::toVec3(list[i].position));
+            chunks[keys[i]].residentAgents += list[i].alive ? 1 : 0;
+        }
+
+        struct Candidate {
+            ChunkKey key;
+            float distance;
+            long long agents;
+        };
+        std::vector<Candidate> resident, wanted;
+        long long residentTotal = 0;
+        for (const auto& entry : chunks) {
+            residentTotal += entry.second.residentAgents;
+        }
+        long long loading = 0;
+        for (auto iter = chunks.begin(); iter != chunks.end();) {
+            Chunk& chunk = iter->second;
+            if (chunk.residentAgents == 0 && chunk.segments.empty()) {
+                iter = chunks.erase(iter);
+                continue;
+            }
+            float distance = observerDistance(contentPosition(iter->first, chunk));
+            if (chunk.residentAgents > 0) {
+                Candidate c = { iter->first, distance, chunk.residentAgents };
+                resident.push_back(c);
+            }
+            long long waiting = 0;
+            for (const Segment& s : chunk.segments) {
+                waiting += s.loading ? 0 : s.count;
+                loading += s.loading ? s.count : 0;
+            }
+            if (waiting > 0 && distance <= ActiveRadius) {
+                Candidate c = { iter->first, distance, waiting };
+                wanted.push_back(c);
+            }
+            ++iter;
+        }
+
+        // page out everything out of range, then the farthest chunks until under the budget
+        std::sort(resident.begin(), resident.end(), [](const Candidate& l, const Candidate& r) { return l.distance > r.distance; });
+        std::unordered_map<ChunkKey, bool, ChunkKeyHasher> evict;
+        for (const Candidate& c : resident) {
+            if (c.distance > ActiveRadius || residentTotal + loading > MaxResidentAgents) {
+                evict[c.key] = true;
+                residentTotal -= c.agents;
+            }
+        }
+        if (!evict.empty()) {
+            pageOut(keys, evict);
+        }
+
+        // page in the nearest wanted chunks that fit
+        std::sort(wanted.begin(), wanted.end(), [](const Candidate& l, const Candidate& r) { return l.distance < r.distance; });
+        for (const Candidate& c : wanted) {
+            if (evict.count(c.key) || residentTotal + loading + c.agents > MaxResidentAgents) {
+                continue;
+            }
+            loading += c.agents;
+            for (Segment& s : chunks[c.key].segments) {
+                if (!s.loading) {
+                    s.loading = true;
+                    Job job = { false, false, c.key, s.id, s.path, std::vector<Boid>() };
+                    submit(std::move(job));
+                }
+            }
+        }
+    }
+
+    // moves the agents of the evicted chunks into one new segment per chunk
+    void pageOut(const std::vector<ChunkKey>& keys, const std::unordered_map<ChunkKey, bool, ChunkKeyHasher>& evict) {
+        BoidList& list = *agents;
+        std::unordered_map<ChunkKey, std::vector<Boid>, ChunkKeyHasher> outgoing;
+        size_t kept = 0;
+        for (size_t i = 0; i < list.size(); i++) {
+            if (!list[i].alive) {
+                continue;   // free pool slots are dropped
+            }
+            if (evict.count(keys[i])) {
+                outgoing[keys[i]].push_back(list[i]);
+            }
+            else {
+                if (kept != i) {
+                    list[kept] = list[i];
+                }
+                kept++;
+            }
+        }
+        list.erase(list.begin() + kept, list.end());
+        agentListGeneration()++;
+
+        std::error_code ignored;
+        std::filesystem::create_directories(Directory, ignored);
+        for (auto& entry : outgoing) {
+            const ChunkKey& key = entry.first;
+            std::vector<Boid>& moved = entry.second;
+            glm::vec3 position(0), velocity(0);
+            for (const Boid& b : moved) {
+                position += Traits::toVec3(b.position);
+                velocity += Traits::toVec3(b.velocity);
+            }
+            float n = float(moved.size());
+            Segment segment = { nextSegment++, std::string(), static_cast<long long>(moved.size()),
+                                position / n, velocity / n, 0.0f, false };
+            segment.path = Directory + "/chunk_" + std::to_string(key.x) + "_" + std::to_string(key.y) + "_" +
+                           std::to_string(key.z) + "_" + std::to_string(segment.id) + ".bin";
+            Chunk& chunk = chunks[key];
+            chunk.residentAgents = 0;
+            chunk.segments.push_back(segment);
+            Job job = { true, false, key, segment.id, segment.path, std::move(moved) };
+            submit(std::move(job));
+            streamStats.pageOuts++;
+        }
+    }
+
+    // adds read back (or unwritable) segments to the agent list
+    void integrateFinishedJobs() {
+        std::vector<Job> done;
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            done.swap(finished);
+        }
+        for (Job& job : done) {
+            Chunk& chunk = chunks[job.key];
+            auto segment = std::find_if(chunk.segments.begin(), chunk.segments.end(),
+                                        [&](const Segment& s) { return s.id == job.segment; });
+            if (segment == chunk.segments.end()) {
+                continue;
+            }
+            if (job.write) {
+                // nothing was paged out, the agents come back as they were
+                streamStats.failedWrites++;
+                segment->age = 0;
+            }
+            else if (job.failed) {
+                streamStats.lostAgents += segment->count;
+                chunk.segments.erase(segment);
+                continue;
+            }
+            else {
+                streamStats.pageIns++;
+            }
+            Vec3 drift = Traits::fromVec3(segment->meanVelocity * segment->age);
+            Vec3 mean = Traits::fromVec3(segment->meanVelocity);
+            Scalar keep = Scalar(VelocityRelaxTime > 0 ? std::exp(-segment->age / VelocityRelaxTime) : 0.0f);
+            for (Boid& b : job.agents) {
+                b.position += drift;
+                b.velocity = mean + (b.velocity - mean) * keep;
+                agents->push_back(b);
+            }
+            agentListGeneration()++;
+            chunk.segments.erase(segment);
+        }
+    }
+
+    void updateStats() {
+        streamStats.residentChunks = 0;
+        streamStats.pagedOutChunks = 0;
+        streamStats.pagedOutAgents = 0;
+        streamStats.bytesOnDisk = 0;
+        for (auto& entry : chunks) {
+            streamStats.residentChunks += entry.second.residentAgents > 0 ? 1 : 0;
+            streamStats.pagedOutChunks += entry.second.segments.empty() ? 0 : 1;
+            for (const Segment& s : entry.second.segments) {
+                streamStats.pagedOutAgents += s.count;
+                streamStats.bytesOnDisk += static_cast<long long>(sizeof(chunks_detail::FileHeader) + s.count * sizeof(Boid));
+            }
+        }
+        streamStats.residentAgents = agents != nullptr ? static_cast<long long>(agents->size()) : 0;
+        std::lock_guard<std::mutex> lock(jobMutex);
+        streamStats.pendingJobs = static_cast<int>(jobs.size()) + (workerBusy ? 1 : 0);
+    }
+
+    void submit(Job&& job) {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if (!worker.joinable()) {
+            worker = std::thread([this] { workerLoop(); });
+        }
+        jobs.push_back(std::move(job));
+        jobReady.notify_one();
+    }
+
+    // jobs run in submission order, so a read always follows the write of the same segment
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        for (;;) {
+            jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            Job job = std::move(jobs.front());
+            jobs.pop_front();
+            workerBusy = true;
+            lock.unlock();
+
+            if (job.write) {
+                job.failed = !chunks_detail::writeMapped(job.path, job.agents.data(), sizeof(Boid), job.agents.size());
+                if (!job.failed) {
+                    std::vector<Boid>().swap(job.agents);
+                }
+            }
+            else {
+                job.failed = !chunks_detail::readMapped(job.path, job.agents);
+                std::error_code ignored;
+                std::filesystem::remove(job.path, ignored);
+            }
+
+            lock.lock();
+            workerBusy = false;
+            if (!job.write || job.failed) {
+                finished.push_back(std::move(job));
+            }
+            jobsDone.notify_all();
+        }
+    }
+
+    void stopWorker() {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+            jobReady.notify_all();
+        }
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+};
+
+#endif